@@ -3,10 +3,13 @@
 #include <error.h>
 #include <errno.h>
 #include <useful/algorithms.h>
+#include <useful/allocator.h>
+#include <useful/random.h>
 
 /**
-   Makes a duplicate of a string. It is the caller's responsibility to
-   free the copy.
+   Makes a duplicate of a string, allocated with the thread's current
+   allocator. It is the caller's responsibility to free the copy with
+   u_free().
 
    \param src Null terminated string.
    \return Copy of the parameter string
@@ -14,7 +17,7 @@
 
 char *u_strdup(const char *src)
 {
-        char *dest = malloc(strlen(src) + 1), *p = dest;
+        char *dest = u_alloc(strlen(src) + 1), *p = dest;
         if (dest == NULL)
                 return NULL;
         while (*src)
@@ -24,24 +27,14 @@ char *u_strdup(const char *src)
 }
 
 /**
-   Generates a random number in the semi-open range 0 .. to - 1.
+   Generates a random number in the semi-open range 0 .. to - 1, without
+   bias, from the calling thread's generator (see random.h).
    \param to Upper bound of semi-open range from which to draw random number
-   \param rng NULL for now
  */
 
 uint32_t u_rand_to(uint32_t to)
 {
-        uint32_t num_bins = to;
-        uint32_t num_rand = ~(to & 0);
-        uint32_t bin_size = num_rand / num_bins;
-        uint32_t defect = num_rand % num_bins;
-
-        uint32_t x;
-        do {
-                x = U_RANDOM;
-        } while (num_rand - defect <= (unsigned long)x);
-
-        return x / bin_size;
+        return u_rng_below(u_rng_default(), to);
 }
 
 /**
@@ -59,21 +52,16 @@ void u_swap(void *a, void *b, size_t size)
 }
 
 /**
-   Shuffles an array.
+   Shuffles an array so that every order is equally likely, using the
+   calling thread's generator (see random.h). Call u_rng_shuffle() to use
+   another.
 
    \param data Array to shuffle
    \param nmemb Number of elements in the array
    \param size Size of an element in chars (or bytes)
-   \param gen Random number generator (can be NULL)
-   \param rand_to Function that returns random int than its first parameter.
-   Its second parameter is gen.
  */
 void u_shuffle(void *data, size_t nmemb, size_t size)
 {
-        for (size_t i = nmemb; i-- > 1;) {
-                size_t __to__ = i + 1;
-                size_t j = U_RANDOM % __to__;
-                u_swap(U_VOS(data, i, size), U_VOS(data, j, size), size);
-        }
+        u_rng_shuffle(u_rng_default(), data, nmemb, size);
 }
 
@@ -0,0 +1,443 @@
+/**
+   \file
+
+   \brief Definitions of the default, arena, pool and counting allocators
+
+*/
+#include <errno.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "useful/allocator.h"
+
+/**
+   Alignment of memory returned by the arena, pool and counting allocators,
+   and size of the header in front of arena and counting allocations.
+ */
+#define ALIGN alignof(max_align_t)
+
+/**
+   A block of memory that an arena allocates from.
+ */
+struct u_arena_block {
+        struct u_arena_block *next;
+        size_t size;
+        size_t used;
+        max_align_t data[];
+};
+
+_Thread_local const struct u_allocator *u_thread_allocator;
+
+static inline size_t round_up(size_t n)
+{
+        return (n + ALIGN - 1) / ALIGN * ALIGN;
+}
+
+static inline size_t *size_of(void *ptr)
+{
+        return (size_t *)((char *)ptr - ALIGN);
+}
+
+static void *malloc_alloc(void *ctx, size_t size)
+{
+        (void)ctx;
+        return malloc(size);
+}
+
+static void *malloc_realloc(void *ctx, void *ptr, size_t size)
+{
+        (void)ctx;
+        return realloc(ptr, size);
+}
+
+static void malloc_free(void *ctx, void *ptr)
+{
+        (void)ctx;
+        free(ptr);
+}
+
+/**
+   The default allocator, using malloc, realloc and free.
+ */
+const struct u_allocator u_malloc_allocator = {
+        .alloc = malloc_alloc,
+        .realloc = malloc_realloc,
+        .free = malloc_free,
+        .ctx = NULL
+};
+
+/**
+   Sets the calling thread's allocator.
+
+   @param a Allocator to use from now on, or NULL for u_malloc_allocator. It
+   must remain valid for as long as it is set.
+
+   @return The previous allocator, so it can be restored.
+ */
+
+const struct u_allocator *u_allocator_set(const struct u_allocator *a)
+{
+        const struct u_allocator *old = u_allocator_get();
+        u_thread_allocator = a;
+        return old;
+}
+
+/**
+   Allocates zeroed memory for an array with the thread's current allocator.
+
+   @param nmemb Number of elements
+   @param size Size of each element
+
+   @return Pointer to the memory, or NULL (with errno set) on failure
+ */
+
+void *u_calloc(size_t nmemb, size_t size)
+{
+        if (size && nmemb > SIZE_MAX / size) {
+                errno = ENOMEM;
+                return NULL;
+        }
+        void *p = u_alloc(nmemb * size);
+        if (p)
+                memset(p, 0, nmemb * size);
+        return p;
+}
+
+static void *arena_alloc(void *ctx, size_t size)
+{
+        struct u_arena *arena = ctx;
+        struct u_arena_block *b = arena->head;
+        size_t need = ALIGN + round_up(size);
+
+        if (need < size) {
+                errno = ENOMEM;
+                return NULL;
+        }
+        if (b == NULL || b->size - b->used < need) {
+                size_t block_size = need > arena->block_size
+                    ? need : arena->block_size;
+                if (NULL == (b = malloc(sizeof(*b) + block_size)))
+                        return NULL;
+                b->size = block_size;
+                b->used = 0;
+                // Keep filling the current block after a one-off large one
+                if (arena->head && need > arena->block_size) {
+                        b->next = arena->head->next;
+                        arena->head->next = b;
+                } else {
+                        b->next = arena->head;
+                        arena->head = b;
+                }
+        }
+        char *p = (char *)b->data + b->used + ALIGN;
+        *size_of(p) = size;
+        b->used += need;
+        arena->last = p;
+        return p;
+}
+
+/**
+   True if ptr is the most recent allocation and ends the current block, so
+   it can change size in place.
+ */
+
+static bool arena_is_top(const struct u_arena *arena, void *ptr)
+{
+        const struct u_arena_block *b = arena->head;
+        return ptr == arena->last && b &&
+            (char *)ptr + round_up(*size_of(ptr)) ==
+            (char *)b->data + b->used;
+}
+
+static void *arena_realloc(void *ctx, void *ptr, size_t size)
+{
+        struct u_arena *arena = ctx;
+
+        if (ptr == NULL)
+                return arena_alloc(ctx, size);
+
+        size_t old = *size_of(ptr);
+        if (arena_is_top(arena, ptr)) {
+                struct u_arena_block *b = arena->head;
+                size_t start = (char *)ptr - (char *)b->data;
+                if (round_up(size) <= b->size - start) {
+                        b->used = start + round_up(size);
+                        *size_of(ptr) = size;
+                        return ptr;
+                }
+        } else if (size <= old) {
+                *size_of(ptr) = size;
+                return ptr;
+        }
+
+        void *p = arena_alloc(ctx, size);
+        if (p)
+                memcpy(p, ptr, old < size ? old : size);
+        return p;
+}
+
+static void arena_free(void *ctx, void *ptr)
+{
+        struct u_arena *arena = ctx;
+        if (ptr && arena_is_top(arena, ptr)) {
+                arena->head->used = (char *)ptr - ALIGN -
+                    (char *)arena->head->data;
+                arena->last = NULL;
+        }
+}
+
+/**
+   Initializes an arena. No memory is allocated until it is first used.
+
+   @param arena Arena to initialize
+   @param block_size Size in bytes of the blocks the arena allocates from.
+   Larger requests get a block of their own.
+ */
+
+void u_arena_init(struct u_arena *arena, size_t block_size)
+{
+        arena->head = NULL;
+        arena->block_size = block_size;
+        arena->last = NULL;
+}
+
+/**
+   Makes an allocator that allocates from an arena. Freeing memory through it
+   does nothing, except that the most recent allocation is handed back.
+
+   @param arena Arena to allocate from
+
+   @return Allocator, valid for as long as the arena is
+ */
+
+struct u_allocator u_arena_allocator(struct u_arena *arena)
+{
+        return (struct u_allocator) {
+                .alloc = arena_alloc,
+                .realloc = arena_realloc,
+                .free = arena_free,
+                .ctx = arena
+        };
+}
+
+/**
+   Releases everything allocated from an arena at once, keeping its current
+   block for reuse.
+
+   @param arena Arena to reset
+ */
+
+void u_arena_reset(struct u_arena *arena)
+{
+        if (arena->head == NULL)
+                return;
+        struct u_arena_block *b = arena->head->next;
+        while (b) {
+                struct u_arena_block *next = b->next;
+                free(b);
+                b = next;
+        }
+        arena->head->next = NULL;
+        arena->head->used = 0;
+        arena->last = NULL;
+}
+
+/**
+   Releases everything allocated from an arena and the arena's own blocks.
+
+   @param arena Arena to free
+ */
+
+void u_arena_free(struct u_arena *arena)
+{
+        u_arena_reset(arena);
+        free(arena->head);
+        arena->head = NULL;
+}
+
+static void *pool_alloc(void *ctx, size_t size)
+{
+        struct u_pool *pool = ctx;
+
+        if (size > pool->block_size) {
+                errno = ENOMEM;
+                return NULL;
+        }
+        if (pool->free_list == NULL) {
+                char *chunk = malloc(ALIGN + pool->block_size *
+                                     pool->blocks_per_chunk);
+                if (chunk == NULL)
+                        return NULL;
+                *(void **)chunk = pool->chunks;
+                pool->chunks = chunk;
+                for (size_t i = pool->blocks_per_chunk; i-- > 0;) {
+                        void *block = chunk + ALIGN + i * pool->block_size;
+                        *(void **)block = pool->free_list;
+                        pool->free_list = block;
+                }
+        }
+        void *p = pool->free_list;
+        pool->free_list = *(void **)p;
+        return p;
+}
+
+static void *pool_realloc(void *ctx, void *ptr, size_t size)
+{
+        struct u_pool *pool = ctx;
+
+        if (ptr == NULL)
+                return pool_alloc(ctx, size);
+        if (size > pool->block_size) {
+                errno = ENOMEM;
+                return NULL;
+        }
+        return ptr;
+}
+
+static void pool_free(void *ctx, void *ptr)
+{
+        struct u_pool *pool = ctx;
+        if (ptr) {
+                *(void **)ptr = pool->free_list;
+                pool->free_list = ptr;
+        }
+}
+
+/**
+   Initializes a pool of equally sized blocks. No memory is allocated until
+   it is first used.
+
+   @param pool Pool to initialize
+   @param block_size Largest allocation the pool can satisfy
+   @param blocks_per_chunk Number of blocks to allocate at a time
+ */
+
+void u_pool_init(struct u_pool *pool, size_t block_size,
+                 size_t blocks_per_chunk)
+{
+        pool->block_size = round_up(block_size ? block_size : 1);
+        pool->blocks_per_chunk = blocks_per_chunk ? blocks_per_chunk : 1;
+        pool->free_list = NULL;
+        pool->chunks = NULL;
+}
+
+/**
+   Makes an allocator that allocates from a pool. Requests larger than the
+   pool's block size fail with ENOMEM.
+
+   @param pool Pool to allocate from
+
+   @return Allocator, valid for as long as the pool is
+ */
+
+struct u_allocator u_pool_allocator(struct u_pool *pool)
+{
+        return (struct u_allocator) {
+                .alloc = pool_alloc,
+                .realloc = pool_realloc,
+                .free = pool_free,
+                .ctx = pool
+        };
+}
+
+/**
+   Releases every block of a pool, whether or not it has been freed.
+
+   @param pool Pool to free
+ */
+
+void u_pool_free(struct u_pool *pool)
+{
+        void *chunk = pool->chunks;
+        while (chunk) {
+                void *next = *(void **)chunk;
+                free(chunk);
+                chunk = next;
+        }
+        pool->chunks = pool->free_list = NULL;
+}
+
+static void *counting_alloc(void *ctx, size_t size)
+{
+        struct u_alloc_stats *stats = ctx;
+        char *base = u_alloc_with(stats->parent, ALIGN + size);
+
+        if (base == NULL)
+                return NULL;
+        *(size_t *)base = size;
+        ++stats->allocs;
+        stats->bytes += size;
+        if (stats->bytes > stats->peak_bytes)
+                stats->peak_bytes = stats->bytes;
+        return base + ALIGN;
+}
+
+static void *counting_realloc(void *ctx, void *ptr, size_t size)
+{
+        struct u_alloc_stats *stats = ctx;
+
+        if (ptr == NULL)
+                return counting_alloc(ctx, size);
+
+        size_t old = *size_of(ptr);
+        char *base = u_realloc_with(stats->parent, size_of(ptr), ALIGN + size);
+        if (base == NULL)
+                return NULL;
+        *(size_t *)base = size;
+        ++stats->reallocs;
+        stats->bytes += size - old;
+        if (stats->bytes > stats->peak_bytes)
+                stats->peak_bytes = stats->bytes;
+        return base + ALIGN;
+}
+
+static void counting_free(void *ctx, void *ptr)
+{
+        struct u_alloc_stats *stats = ctx;
+
+        if (ptr == NULL)
+                return;
+        size_t size = *size_of(ptr);
+        memset(ptr, U_FREED_BYTE, size);
+        ++stats->frees;
+        stats->bytes -= size;
+        u_free_with(stats->parent, size_of(ptr));
+}
+
+/**
+   Initializes the statistics of a counting allocator.
+
+   @param stats Statistics to initialize
+   @param parent Allocator that does the actual allocation, or NULL for
+   u_malloc_allocator
+ */
+
+void u_counting_init(struct u_alloc_stats *stats,
+                     const struct u_allocator *parent)
+{
+        *stats = (struct u_alloc_stats) {
+                .parent = parent ? parent : &u_malloc_allocator
+        };
+}
+
+/**
+   Makes an allocator that counts allocations, frees and bytes in use, and
+   overwrites freed memory with U_FREED_BYTE.
+
+   @param stats Statistics to update, initialized with u_counting_init()
+
+   @return Allocator, valid for as long as stats is
+ */
+
+struct u_allocator u_counting_allocator(struct u_alloc_stats *stats)
+{
+        return (struct u_allocator) {
+                .alloc = counting_alloc,
+                .realloc = counting_realloc,
+                .free = counting_free,
+                .ctx = stats
+        };
+}
@@ -4,24 +4,210 @@
    \brief Definitions of array management functions
 
 */
+#define _GNU_SOURCE
 #include <error.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include <math.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#endif
 
 #include "useful/array.h"
+#include "useful/hash.h"
+
+#ifdef __linux__
+
+U_HASH_MAP_DEFINE(mapping_map, uint64_t, size_t, u_hash_u64, u_u64_equal)
+
+/**
+   Every buffer u_array_resize() has mapped, with its size. Whether a buffer
+   is a mapping is looked up here, never guessed from the thread's current
+   allocator, which may have changed since the buffer was allocated.
+ */
+static struct mapping_map mappings = {
+        .allocator = &u_malloc_allocator
+};
+static pthread_mutex_t mappings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+   Number of entries in mappings, so that programs with no mapped buffers
+   never take the lock.
+ */
+static atomic_size_t mapped_buffers;
+
+/**
+   Gets the size of a mapped buffer, or 0 if ptr isn't one.
+ */
+
+static size_t mapping_size(const void *ptr)
+{
+        size_t size = 0;
+
+        if (ptr == NULL ||
+            atomic_load_explicit(&mapped_buffers, memory_order_relaxed) == 0)
+                return 0;
+        pthread_mutex_lock(&mappings_lock);
+        size_t *s = mapping_map_get(&mappings, (uintptr_t)ptr);
+        if (s)
+                size = *s;
+        pthread_mutex_unlock(&mappings_lock);
+        return size;
+}
+
+/**
+   Replaces the record of mapping old, if not NULL, by one of mapping p of
+   size bytes, if p is not NULL. Fails only if memory for a new record runs
+   out; replacing a record never needs any.
+ */
+
+static bool mapping_set(const void *old, const void *p, size_t size)
+{
+        bool ok = true;
+
+        pthread_mutex_lock(&mappings_lock);
+        if (old)
+                mapping_map_remove(&mappings, (uintptr_t)old);
+        if (p)
+                ok = mapping_map_put(&mappings, (uintptr_t)p, size);
+        atomic_store_explicit(&mapped_buffers, mappings.len,
+                              memory_order_relaxed);
+        pthread_mutex_unlock(&mappings_lock);
+        return ok;
+}
+
+/**
+   True if a new buffer of size bytes for an array allocated with a should
+   be a mapping.
+ */
+
+static bool should_map(const struct u_allocator *a, size_t size)
+{
+        if (a == NULL)
+                a = u_allocator_get();
+        return a == &u_malloc_allocator && size >= U_ARRAY_MAP_THRESHOLD;
+}
+
+static void *map(size_t size)
+{
+        void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+                return NULL;
+#ifdef MADV_HUGEPAGE
+        madvise(p, size, MADV_HUGEPAGE);
+#endif
+        if (!mapping_set(NULL, p, size)) {
+                munmap(p, size);
+                errno = ENOMEM;
+                return NULL;
+        }
+        return p;
+}
+
+#endif
+
+/**
+   Resizes the buffer of an array. On Linux, new buffers of at least
+   U_ARRAY_MAP_THRESHOLD bytes for arrays using the default allocator are
+   anonymous mappings, which mremap grows by moving page table entries
+   instead of copying. Each mapping is recorded when it is made, so such
+   buffers are resized and freed correctly whatever the thread's allocator is
+   by then, but only by u_array_resize() and u_array_release(), never by
+   realloc() or free().
+
+   @param a Allocator of the array, or NULL for the thread's current allocator
+   @param ptr Buffer to resize, or NULL to allocate a new one
+   @param old_size Current size of the buffer in bytes, 0 if ptr is NULL
+   @param new_size Size to resize it to in bytes
+
+   @return The resized buffer, or NULL (with errno set) on failure, in which
+   case ptr is left untouched. Resizing a buffer to 0 bytes may free it and
+   return NULL.
+ */
+
+void *u_array_resize(const struct u_allocator *a, void *ptr, size_t old_size,
+                     size_t new_size)
+{
+#ifdef __linux__
+        size_t mapped_size = mapping_size(ptr);
+        bool mapped = should_map(a, new_size);
+        void *p;
+
+        if (!mapped_size && !mapped)
+                return u_realloc_with(a, ptr, new_size);
+        if (mapped_size)
+                old_size = mapped_size;
+        if (mapped_size && mapped) {
+                p = mremap(ptr, old_size, new_size, MREMAP_MAYMOVE);
+                if (p == MAP_FAILED)
+                        return NULL;
+                mapping_set(ptr, p, new_size);
+                return p;
+        }
+        if (new_size == 0) {
+                u_array_release(a, ptr, old_size);
+                return NULL;
+        }
+        p = mapped ? map(new_size) : u_alloc_with(a, new_size);
+        if (p == NULL)
+                return NULL;
+        if (ptr != NULL)
+                memcpy(p, ptr, old_size < new_size ? old_size : new_size);
+        u_array_release(a, ptr, old_size);
+        return p;
+#else
+        (void)old_size;
+        return u_realloc_with(a, ptr, new_size);
+#endif
+}
+
+/**
+   Frees the buffer of an array allocated by u_array_resize() or
+   u_array_grow(). A mapped buffer is unmapped whatever a and size are.
+
+   @param a Allocator of the array, or NULL for the thread's current allocator
+   @param ptr Buffer to free. Does nothing if NULL.
+   @param size Size of the buffer in bytes, i.e. capacity times element size
+ */
+
+void u_array_release(const struct u_allocator *a, void *ptr, size_t size)
+{
+#ifdef __linux__
+        size_t mapped_size = mapping_size(ptr);
+        if (mapped_size) {
+                mapping_set(ptr, NULL, 0);
+                munmap(ptr, mapped_size);
+                return;
+        }
+#endif
+        (void)size;
+        u_free_with(a, ptr);
+}
 
 /**
    Grows an array if its capacity is full.
+
+   @return the new capacity, or 0 (with errno set) if memory ran out or the
+   new size would overflow
  */
 size_t u_array_grow(void **array, size_t current_capacity, size_t object_size)
 {
-        size_t new_capacity = current_capacity == 0
-            ? U_INIT_CAPACITY : current_capacity * U_GROWTH;
-        size_t new_size = new_capacity * object_size;
-        void *__t = realloc(*array, new_size);
+        size_t new_capacity = u_array_next_capacity(current_capacity,
+                                                    current_capacity + 1,
+                                                    object_size);
+        if (new_capacity == 0) {
+                errno = ENOMEM;
+                return 0;
+        }
+        void *__t = u_array_resize(NULL, *array,
+                                   current_capacity * object_size,
+                                   new_capacity * object_size);
         if (__t)
                 *array = __t;
         else
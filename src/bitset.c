@@ -0,0 +1,432 @@
+/**
+   \file
+
+   \brief Definitions of bitset functions
+
+*/
+#include <errno.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define U_BITSET_AVX2
+#endif
+
+#include "useful/bitset.h"
+
+/**
+   Mask of the bits of the last word of a bitset of len bits that are in it.
+ */
+
+static inline uint64_t tail_mask(size_t len)
+{
+        return len % 64 ? (UINT64_C(1) << (len % 64)) - 1 : UINT64_MAX;
+}
+
+/**
+   Initializes an empty bitset that takes the calling thread's allocator when
+   it first allocates, and keeps it.
+
+   @param b Bitset to initialize
+ */
+
+void u_bitset_init(struct u_bitset *b)
+{
+        u_bitset_init_allocator(b, NULL);
+}
+
+/**
+   Initializes an empty bitset.
+
+   @param b Bitset to initialize
+   @param alloc Allocator to use, or NULL to take the calling thread's
+   allocator on the first allocation
+ */
+
+void u_bitset_init_allocator(struct u_bitset *b,
+                             const struct u_allocator *alloc)
+{
+        b->len = b->capacity = 0;
+        b->words = NULL;
+        b->allocator = alloc;
+}
+
+/**
+   Makes room for n bits.
+
+   @param b Bitset to grow
+   @param n Number of bits
+
+   @return true, or false if memory runs out
+ */
+
+bool u_bitset_reserve(struct u_bitset *b, size_t n)
+{
+        size_t words = n / 64 + (n % 64 != 0);
+        if (words <= b->capacity)
+                return true;
+        size_t capacity = u_array_next_capacity(b->capacity, words,
+                                                sizeof(uint64_t));
+        if (capacity == 0) {
+                errno = ENOMEM;
+                return false;
+        }
+        if (b->allocator == NULL)
+                b->allocator = u_allocator_get();
+        uint64_t *w = u_array_resize(b->allocator, b->words,
+                                     b->capacity * sizeof(uint64_t),
+                                     capacity * sizeof(uint64_t));
+        if (w == NULL)
+                return false;
+        b->words = w;
+        b->capacity = capacity;
+        return true;
+}
+
+/**
+   Changes the number of bits. New bits are clear.
+
+   @param b Bitset to resize
+   @param len New number of bits
+
+   @return true, or false if memory runs out
+ */
+
+bool u_bitset_resize(struct u_bitset *b, size_t len)
+{
+        if (!u_bitset_reserve(b, len))
+                return false;
+        size_t old = U_BITSET_WORDS(b->len), words = U_BITSET_WORDS(len);
+        if (words > old)
+                memset(b->words + old, 0, (words - old) * sizeof(uint64_t));
+        b->len = len;
+        if (len % 64)
+                b->words[words - 1] &= tail_mask(len);
+        return true;
+}
+
+/**
+   Appends a bit.
+
+   @param b Bitset to append to
+   @param x Value of the bit
+
+   @return true, or false if memory runs out
+ */
+
+bool u_bitset_push(struct u_bitset *b, bool x)
+{
+        if (b->len % 64 == 0) {
+                if (!u_bitset_reserve(b, b->len + 1))
+                        return false;
+                b->words[b->len / 64] = 0;
+        }
+        b->words[b->len / 64] |= (uint64_t) x << (b->len % 64);
+        ++b->len;
+        return true;
+}
+
+/**
+   Sets or clears every bit.
+
+   @param b Bitset to fill
+   @param x Value of the bits
+ */
+
+void u_bitset_fill(struct u_bitset *b, bool x)
+{
+        size_t words = U_BITSET_WORDS(b->len);
+        if (words == 0)
+                return;
+        memset(b->words, x ? 0xff : 0, words * sizeof(uint64_t));
+        b->words[words - 1] &= tail_mask(b->len);
+}
+
+/* The word loops below have no dependencies between iterations, so
+   compilers vectorize them. */
+
+/**
+   Keeps the bits of dest that are set in src.
+
+   @param dest Bitset to change
+   @param src Bitset of the same length
+ */
+
+void u_bitset_and(struct u_bitset *dest, const struct u_bitset *src)
+{
+        assert(dest->len == src->len);
+        uint64_t *restrict d = dest->words;
+        const uint64_t *restrict s = src->words;
+        for (size_t i = 0; i < U_BITSET_WORDS(dest->len); ++i)
+                d[i] &= s[i];
+}
+
+/**
+   Sets the bits of dest that are set in src.
+
+   @param dest Bitset to change
+   @param src Bitset of the same length
+ */
+
+void u_bitset_or(struct u_bitset *dest, const struct u_bitset *src)
+{
+        assert(dest->len == src->len);
+        uint64_t *restrict d = dest->words;
+        const uint64_t *restrict s = src->words;
+        for (size_t i = 0; i < U_BITSET_WORDS(dest->len); ++i)
+                d[i] |= s[i];
+}
+
+/**
+   Flips the bits of dest that are set in src.
+
+   @param dest Bitset to change
+   @param src Bitset of the same length
+ */
+
+void u_bitset_xor(struct u_bitset *dest, const struct u_bitset *src)
+{
+        assert(dest->len == src->len);
+        uint64_t *restrict d = dest->words;
+        const uint64_t *restrict s = src->words;
+        for (size_t i = 0; i < U_BITSET_WORDS(dest->len); ++i)
+                d[i] ^= s[i];
+}
+
+/**
+   Clears the bits of dest that are set in src.
+
+   @param dest Bitset to change
+   @param src Bitset of the same length
+ */
+
+void u_bitset_andnot(struct u_bitset *dest, const struct u_bitset *src)
+{
+        assert(dest->len == src->len);
+        uint64_t *restrict d = dest->words;
+        const uint64_t *restrict s = src->words;
+        for (size_t i = 0; i < U_BITSET_WORDS(dest->len); ++i)
+                d[i] &= ~s[i];
+}
+
+/**
+   Flips every bit.
+
+   @param b Bitset to change
+ */
+
+void u_bitset_not(struct u_bitset *b)
+{
+        size_t words = U_BITSET_WORDS(b->len);
+        if (words == 0)
+                return;
+        for (size_t i = 0; i < words; ++i)
+                b->words[i] = ~b->words[i];
+        b->words[words - 1] &= tail_mask(b->len);
+}
+
+static size_t count_words(const uint64_t *a, const uint64_t *b, size_t n)
+{
+        size_t count = 0;
+        if (b)
+                for (size_t i = 0; i < n; ++i)
+                        count += __builtin_popcountll(a[i] & b[i]);
+        else
+                for (size_t i = 0; i < n; ++i)
+                        count += __builtin_popcountll(a[i]);
+        return count;
+}
+
+#ifdef U_BITSET_AVX2
+
+/**
+   Counts the bits of each byte of v by looking up each half byte in a table
+   of 16 counts, and adds the counts of each group of 8 bytes.
+ */
+
+__attribute__ ((target("avx2")))
+static inline __m256i popcount256(__m256i v)
+{
+        const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                               1, 2, 2, 3, 2, 3, 3, 4,
+                                               0, 1, 1, 2, 1, 2, 2, 3,
+                                               1, 2, 2, 3, 2, 3, 3, 4);
+        const __m256i low = _mm256_set1_epi8(0x0f);
+        __m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(v, low));
+        __m256i hi = _mm256_shuffle_epi8(table,
+                                         _mm256_and_si256(_mm256_srli_epi16
+                                                          (v, 4), low));
+        return _mm256_sad_epu8(_mm256_add_epi8(lo, hi),
+                               _mm256_setzero_si256());
+}
+
+/**
+   Counts the bits of n words (of a AND b if b isn't NULL) 256 bits at a
+   time. This is Muła's vpshufb algorithm, which beats the scalar popcnt
+   instruction on large inputs.
+ */
+
+__attribute__ ((target("avx2")))
+static size_t count_avx2(const uint64_t *a, const uint64_t *b, size_t n)
+{
+        __m256i sum = _mm256_setzero_si256();
+        size_t i = 0;
+        if (b) {
+                for (; i + 4 <= n; i += 4) {
+                        __m256i x = _mm256_loadu_si256((const void *)(a + i));
+                        __m256i y = _mm256_loadu_si256((const void *)(b + i));
+                        sum = _mm256_add_epi64(sum,
+                                               popcount256(_mm256_and_si256
+                                                           (x, y)));
+                }
+        } else {
+                for (; i + 4 <= n; i += 4) {
+                        __m256i x = _mm256_loadu_si256((const void *)(a + i));
+                        sum = _mm256_add_epi64(sum, popcount256(x));
+                }
+        }
+        size_t count = _mm256_extract_epi64(sum, 0) +
+            _mm256_extract_epi64(sum, 1) + _mm256_extract_epi64(sum, 2) +
+            _mm256_extract_epi64(sum, 3);
+        return count + count_words(a + i, b ? b + i : NULL, n - i);
+}
+
+#endif
+
+/**
+   Counts the set bits of n words, a AND b if b isn't NULL, with AVX2 if the
+   CPU has it and there are enough words to pay for it.
+ */
+
+static size_t count(const uint64_t *a, const uint64_t *b, size_t n)
+{
+#ifdef U_BITSET_AVX2
+        if (n >= 16 && __builtin_cpu_supports("avx2"))
+                return count_avx2(a, b, n);
+#endif
+        return count_words(a, b, n);
+}
+
+/**
+   Counts the set bits of an array of words.
+
+   @param words Words to count
+   @param n Number of words
+
+   @return Number of set bits
+ */
+
+size_t u_bitset_popcount(const uint64_t *words, size_t n)
+{
+        return count(words, NULL, n);
+}
+
+/**
+   Counts the set bits of a bitset.
+
+   @param b Bitset to count
+
+   @return Number of set bits
+ */
+
+size_t u_bitset_count(const struct u_bitset *b)
+{
+        return count(b->words, NULL, U_BITSET_WORDS(b->len));
+}
+
+/**
+   Counts the bits set in both of two bitsets, without changing either.
+
+   @param a Bitset
+   @param b Bitset of the same length
+
+   @return Number of bits set in both
+ */
+
+size_t u_bitset_and_count(const struct u_bitset *a, const struct u_bitset *b)
+{
+        assert(a->len == b->len);
+        return count(a->words, b->words, U_BITSET_WORDS(a->len));
+}
+
+/**
+   Finds the first set bit at or after bit i.
+
+   @param b Bitset to search
+   @param i First bit to look at
+
+   @return Index of the bit, or b->len if no bit from i on is set
+ */
+
+size_t u_bitset_next(const struct u_bitset *b, size_t i)
+{
+        if (i >= b->len)
+                return b->len;
+        size_t w = i / 64, words = U_BITSET_WORDS(b->len);
+        uint64_t word = b->words[w] & (UINT64_MAX << (i % 64));
+        while (word == 0) {
+                if (++w == words)
+                        return b->len;
+                word = b->words[w];
+        }
+        return w * 64 + __builtin_ctzll(word);
+}
+
+/**
+   Makes a bitset of len bits with the bits at a list of indices set.
+
+   @param b Bitset to set, which is resized to len bits
+   @param len Number of bits
+   @param indices Indices of the bits to set, each less than len, in any
+   order
+   @param n Number of indices
+
+   @return true, or false if memory runs out
+ */
+
+bool u_bitset_from_indices(struct u_bitset *b, size_t len,
+                           const size_t *indices, size_t n)
+{
+        if (!u_bitset_resize(b, len))
+                return false;
+        u_bitset_fill(b, false);
+        for (size_t i = 0; i < n; ++i)
+                u_bitset_set(b, indices[i]);
+        return true;
+}
+
+/**
+   Lists the indices of the set bits of a bitset, in increasing order.
+
+   @param b Bitset to list
+   @param indices Where to write the indices. It must have room for
+   u_bitset_count(b) indices.
+
+   @return Number of indices written
+ */
+
+size_t u_bitset_to_indices(const struct u_bitset *b, size_t *indices)
+{
+        size_t n = 0;
+        for (size_t w = 0; w < U_BITSET_WORDS(b->len); ++w) {
+                uint64_t word = b->words[w];
+                while (word) {
+                        indices[n++] = w * 64 + __builtin_ctzll(word);
+                        word &= word - 1;
+                }
+        }
+        return n;
+}
+
+/**
+   Frees the words of a bitset, leaving it empty.
+
+   @param b Bitset to free
+ */
+
+void u_bitset_free(struct u_bitset *b)
+{
+        u_array_release(b->allocator, b->words,
+                        b->capacity * sizeof(uint64_t));
+        u_bitset_init_allocator(b, b->allocator);
+}
@@ -4,22 +4,182 @@
    \brief Definitions of csv management functions
 
 */
+#define _GNU_SOURCE
+#include <glob.h>
+
+#include "useful/bitset.h"
 #include "useful/csv.h"
+#include "useful/intern.h"
+#include "useful/thread_pool.h"
+#include "useful/utf8.h"
 
-struct string {
-        size_t len;
-        size_t capacity;
-        char *str;
-};
+/**
+   Makes the allocator of a container the thread's current one, so that
+   everything allocated or freed for the container, by the U_ARRAY macros,
+   u_strdup() and u_aligned_alloc() included, goes through it. Pass the
+   result to u_allocator_set() when done.
+ */
+
+static const struct u_allocator *use(const struct u_allocator *a)
+{
+        return a ? u_allocator_set(a) : u_allocator_get();
+}
+
+/**
+   Allocates validity bitmaps for cols columns of rows rows, with every cell
+   marked NA.
+ */
+
+static uint64_t **valid_new(size_t cols, size_t rows)
+{
+        uint64_t **valid = u_alloc(cols * sizeof(*valid));
+        if (NULL == valid && cols > 0)
+                error(EXIT_FAILURE, errno,
+                      "Failed to allocate space for validity bitmaps.");
+        for (size_t i = 0; i < cols; ++i) {
+                valid[i] = u_calloc(U_NA_WORDS(rows), sizeof(uint64_t));
+                if (NULL == valid[i] && rows > 0)
+                        error(EXIT_FAILURE, errno,
+                              "Failed to allocate space for validity bitmap.");
+        }
+        return valid;
+}
+
+/**
+   Adds a word, with every cell marked NA, to the end of each column's
+   validity bitmap. Call this before appending row rows when rows is a
+   multiple of 64.
+ */
+
+static void valid_grow(uint64_t **valid, size_t cols, size_t rows)
+{
+        size_t words = U_NA_WORDS(rows + 1);
+        for (size_t i = 0; i < cols; ++i) {
+                valid[i] = u_realloc(valid[i], words * sizeof(uint64_t));
+                if (NULL == valid[i])
+                        error(EXIT_FAILURE, errno,
+                              "Failed to allocate space for validity bitmap.");
+                valid[i][words - 1] = 0;
+        }
+}
+
+static void valid_free(uint64_t **valid, size_t cols)
+{
+        if (valid == NULL)
+                return;
+        for (size_t i = 0; i < cols; ++i)
+                u_free(valid[i]);
+        u_free(valid);
+}
+
+static inline void valid_set(uint64_t *bits, size_t row)
+{
+        bits[row / 64] |= UINT64_C(1) << (row % 64);
+}
+
+static inline void valid_clear(uint64_t *bits, size_t row)
+{
+        bits[row / 64] &= ~(UINT64_C(1) << (row % 64));
+}
+
+static inline bool valid_test(const uint64_t *bits, size_t row)
+{
+        return (bits[row / 64] >> (row % 64)) & 1;
+}
+
+/**
+   Counts the valid cells in a column. Bits past the last row are always
+   clear so whole words can be counted.
+ */
+
+static size_t valid_count(const uint64_t *bits, size_t rows)
+{
+        return u_bitset_popcount(bits, U_NA_WORDS(rows));
+}
+
+/**
+   Sums the valid doubles in a column whose first value is at base and whose
+   subsequent values are stride bytes apart. Fully valid words of 64 rows are
+   summed without testing bits; other words visit only their set bits.
+ */
+
+static double valid_sum(const uint64_t *bits, size_t rows,
+                        const char *base, size_t stride)
+{
+        double sum = 0.0;
+        for (size_t w = 0; w < U_NA_WORDS(rows); ++w) {
+                uint64_t mask = bits[w];
+                const char *p = base + w * 64 * stride;
+                if (mask == UINT64_MAX) {
+                        for (size_t k = 0; k < 64; ++k)
+                                sum += *(const double *)(p + k * stride);
+                } else {
+                        while (mask) {
+                                size_t k = __builtin_ctzll(mask);
+                                sum += *(const double *)(p + k * stride);
+                                mask &= mask - 1;
+                        }
+                }
+        }
+        return sum;
+}
+
+/**
+   Parses a cell as a double. Empty, missing and unparseable cells are NA.
+   errno is left untouched.
+
+   @param s Cell to parse. May be NULL for a missing cell.
+   @param d Where to store the value
+
+   @return true if the cell held a number, else false with *d set to NAN.
+ */
 
-static struct u_csv_row u_csv_append_row(const char *strings[], size_t n)
+bool u_csv_parse_dbl(const char *s, double *d)
+{
+        char *ptr;
+        int saved_errno = errno;
+
+        if (s == NULL || *s == '\0') {
+                *d = NAN;
+                return false;
+        }
+        *d = strtod(s, &ptr);
+        errno = saved_errno;
+        if (*ptr != '\0') {
+                *d = NAN;
+                return false;
+        }
+        return true;
+}
+
+/**
+   Copies a cell's string, or interns it if in isn't NULL.
+ */
+
+static char *cell_dup(struct u_interner *in, const char *s)
+{
+        return in ? (char *)u_intern(in, s) : u_strdup(s);
+}
+
+/**
+   Frees a cell's string unless it belongs to an interner.
+ */
+
+static void cell_free(struct u_interner *in, char *s)
+{
+        if (in == NULL)
+                u_free(s);
+}
+
+static struct u_csv_row u_csv_append_row(struct u_interner *in,
+                                         const char *strings[], size_t n)
 {
         struct u_csv_row row;
         char *s;
 
         U_ARRAY(row, cells);
         for (size_t i = 0; i < n; ++i) {
-                if (NULL == (s = u_strdup(strings[i])))
+                if (NULL == (s = cell_dup(in, strings[i])))
                         error(EXIT_FAILURE, errno,
                               "Failed to allocate space for cell.");
                 U_ARRAY_PUSH(row, cells, s);
@@ -43,12 +203,14 @@ struct u_csv u_csv_new(bool header, const char *strings[], size_t n)
 
         struct u_csv cs;
         if (header) {
-                cs.header = u_csv_append_row(strings, n);
+                cs.header = u_csv_append_row(NULL, strings, n);
         } else {
                 cs.header.len = cs.header.capacity = 0;
                 cs.header.cells = NULL;
         }
         U_ARRAY(cs, rows);
+        cs.interner = NULL;
+        cs.allocator = u_allocator_get();
         return cs;
 }
 
@@ -61,25 +223,62 @@ struct u_csv u_csv_new(bool header, const char *strings[], size_t n)
 
 void u_csv_append(struct u_csv *cs, const char *strings[], size_t n)
 {
+        const struct u_allocator *old = use(cs->allocator);
         struct u_csv_row row;
-        row = u_csv_append_row(strings, n);
+        row = u_csv_append_row(cs->interner, strings, n);
         U_ARRAY_PUSH(*cs, rows, row);
+        u_allocator_set(old);
+}
+
+/**
+   Creates an empty buffer for u_csv_read_cells().
+
+   @return Empty ready-to-use cells structure. Free it with u_csv_cells_free().
+ */
+
+struct u_csv_cells u_csv_cells_new(void)
+{
+        struct u_csv_cells cells;
+        U_ARRAY(cells.text, chars);
+        U_ARRAY(cells.index, offsets);
+        if (cells.text.capacity == 0 || cells.index.capacity == 0)
+                error(EXIT_FAILURE, errno,
+                      "Failed to allocate space for cells.");
+        return cells;
 }
 
-static struct u_csv_row u_csv_read_row(FILE * f, const char delim)
+static inline void push_char(struct u_csv_cells *cells, char c)
+{
+        U_ARRAY_PUSH(cells->text, chars, c);
+        if (cells->text.capacity == 0)
+                error(EXIT_FAILURE, errno,
+                      "Failed to allocate space for cell.");
+}
+
+/**
+   Reads the next row of a CSV file, appending its cells to a buffer. Call
+   u_csv_cells_clear() between rows to reuse the buffer, or leave it alone
+   to accumulate several rows.
+
+   @param f Already opened file to read from
+   @param delim The CSV file delimiter, usually a comma
+   @param cells Buffer to append the cells to
+
+   @return Number of cells appended, 0 at the end of the file
+ */
+
+size_t u_csv_read_cells(FILE * f, char delim, struct u_csv_cells *cells)
 {
-        struct u_csv_row row;
-        struct string cell;
         bool inrow = true, inquote = false;
-        char c, *s;
+        size_t n = 0, start = cells->text.len;
+        int c;
 
-        U_ARRAY(row, cells);
-        U_ARRAY(cell, str);
+        flockfile(f);
         while (inrow) {
                 bool endcell = false;
-                if ((c = fgetc(f)) == '"') {
-                        if ((c = fgetc(f)) == '"' && inquote) {
-                                U_ARRAY_PUSH(cell, str, c);
+                if ((c = getc_unlocked(f)) == '"') {
+                        if ((c = getc_unlocked(f)) == '"' && inquote) {
+                                push_char(cells, c);
                         } else {
                                 ungetc(c, f);
                                 inquote = !inquote;
@@ -88,24 +287,97 @@ static struct u_csv_row u_csv_read_row(FILE * f, const char delim)
                         endcell = true;
                 } else if (c == EOF || (c == '\n' && inquote == false)) {
                         inrow = false;
-                        if (c == EOF)
-                                ungetc(c, f);
                 } else {
-                        U_ARRAY_PUSH(cell, str, c);
+                        push_char(cells, c);
                 }
                 if (endcell || inrow == false) {
-                        U_ARRAY_PUSH(cell, str, '\0');
-                        if (NULL == (s = u_strdup(cell.str)))
-                                error(EXIT_FAILURE, errno,
-                                      "Failed to allocate space for cell.");
-                        if (strlen(s) || !(c == EOF || c == '\n'))
-                                U_ARRAY_PUSH(row, cells, s);
-                        else
-                                free(s);
-                        cell.len = 0;
+                        if (cells->text.len > start || endcell) {
+                                push_char(cells, '\0');
+                                U_ARRAY_PUSH(cells->index, offsets, start);
+                                if (cells->index.capacity == 0)
+                                        error(EXIT_FAILURE, errno,
+                                              "Failed to allocate space for "
+                                              "cell index.");
+                                ++n;
+                        }
+                        start = cells->text.len;
                 }
         }
-        U_ARRAY_FREE(cell, str);
+        funlockfile(f);
+        return n;
+}
+
+/**
+   Gets a cell from a buffer filled by u_csv_read_cells().
+
+   @param cells Buffer holding the cells
+   @param i Index of the cell, counting from the first cell in the buffer
+
+   @return Null-terminated value of the cell. It is valid until the buffer is
+   next cleared, appended to or freed.
+ */
+
+const char *u_csv_cells_at(const struct u_csv_cells *cells, size_t i)
+{
+        assert(i < cells->index.len);
+        return cells->text.chars + cells->index.offsets[i];
+}
+
+/**
+   Checks that the cells in a buffer filled by u_csv_read_cells() are
+   well-formed UTF-8. The cells are consecutive in the buffer, so they are
+   all checked in one pass with u_utf8_valid() (see utf8.h).
+
+   @param cells Buffer holding the cells
+
+   @return true if every cell is well-formed
+ */
+
+bool u_csv_cells_valid_utf8(const struct u_csv_cells *cells)
+{
+        return u_utf8_valid(cells->text.chars, cells->text.len);
+}
+
+/**
+   Empties a buffer filled by u_csv_read_cells(), keeping its memory.
+
+   @param cells Buffer to empty
+ */
+
+void u_csv_cells_clear(struct u_csv_cells *cells)
+{
+        cells->text.len = 0;
+        cells->index.len = 0;
+}
+
+/**
+   Frees a buffer created by u_csv_cells_new().
+
+   @param cells Buffer to free
+ */
+
+void u_csv_cells_free(struct u_csv_cells *cells)
+{
+        U_ARRAY_FREE(cells->text, chars);
+        U_ARRAY_FREE(cells->index, offsets);
+}
+
+static struct u_csv_row u_csv_read_row(struct u_interner *in, FILE * f,
+                                       const char delim,
+                                       struct u_csv_cells *cells)
+{
+        struct u_csv_row row;
+        char *s;
+
+        u_csv_cells_clear(cells);
+        size_t n = u_csv_read_cells(f, delim, cells);
+        U_ARRAY(row, cells);
+        for (size_t i = 0; i < n; ++i) {
+                if (NULL == (s = cell_dup(in, u_csv_cells_at(cells, i))))
+                        error(EXIT_FAILURE, errno,
+                              "Failed to allocate space for cell.");
+                U_ARRAY_PUSH(row, cells, s);
+        }
         return row;
 }
 
@@ -120,20 +392,46 @@ static struct u_csv_row u_csv_read_row(FILE * f, const char delim)
  */
 
 struct u_csv u_csv_read(FILE * f, bool header, char delim)
+{
+        return u_csv_read_interned(f, header, delim, NULL);
+}
+
+/**
+   Reads a CSV file, interning every cell instead of allocating a copy of
+   each, so that a value repeated down a column is stored once. The cells
+   belong to the interner, must not be changed, and stay valid until the
+   interner is freed, even after the csv structure is. Rows appended with
+   u_csv_append() are interned too.
+
+   @param f Already opened file to read in.
+   @param header Whether the CSV file has a header
+   @param delim The CSV file delimiter, usually a comma
+   @param in Interner to hold the cells (see intern.h), or NULL to copy them
+   like u_csv_read()
+
+   @return Populated csv structure
+ */
+
+struct u_csv u_csv_read_interned(FILE * f, bool header, char delim,
+                                 struct u_interner *in)
 {
         struct u_csv cs;
         struct u_csv_row row;
+        struct u_csv_cells cells = u_csv_cells_new();
 
         U_ARRAY(cs, rows);
+        cs.interner = in;
+        cs.allocator = u_allocator_get();
         if (header)
-                cs.header = u_csv_read_row(f, delim);
+                cs.header = u_csv_read_row(in, f, delim, &cells);
         else
                 U_ARRAY(cs.header, cells);
 
-        while ((row = u_csv_read_row(f, delim)).len > 0)
+        while ((row = u_csv_read_row(in, f, delim, &cells)).len > 0)
                 U_ARRAY_PUSH(cs, rows, row);
 
         U_ARRAY_FREE(row, cells);
+        u_csv_cells_free(&cells);
 
         return cs;
 }
@@ -219,10 +517,10 @@ bool u_csv_isvalid(const struct u_csv *cs, bool verbose)
         return valid;
 }
 
-static void u_csv_free_row(struct u_csv_row *row)
+static void u_csv_free_row(struct u_interner *in, struct u_csv_row *row)
 {
         for (size_t i = 0; i < row->len; ++i)
-                free(row->cells[i]);
+                cell_free(in, row->cells[i]);
         U_ARRAY_FREE(*row, cells);
 }
 
@@ -234,12 +532,340 @@ static void u_csv_free_row(struct u_csv_row *row)
 
 void u_csv_free(struct u_csv *cs)
 {
+        const struct u_allocator *old = use(cs->allocator);
 
-        u_csv_free_row(&cs->header);
+        u_csv_free_row(cs->interner, &cs->header);
 
         for (size_t i = 0; i < cs->len; ++i)
-                u_csv_free_row(&cs->rows[i]);
+                u_csv_free_row(cs->interner, &cs->rows[i]);
         U_ARRAY_FREE(*cs, rows);
+        u_allocator_set(old);
+}
+
+/**
+   Creates a CSV structure with chunked row storage.
+
+   @param header True if the csv must have a header
+   @param strings Values of the header columns
+   @param n Number of columns
+
+   @return Empty ready-to-use structure with a header if specified.
+ */
+
+struct u_csv_chunked u_csv_chunked_new(bool header, const char *strings[],
+                                       size_t n)
+{
+        struct u_csv_chunked cs;
+        if (header) {
+                cs.header = u_csv_append_row(NULL, strings, n);
+        } else {
+                cs.header.len = cs.header.capacity = 0;
+                cs.header.cells = NULL;
+        }
+        u_csv_row_chunks_init(&cs.rows);
+        cs.allocator = u_allocator_get();
+        return cs;
+}
+
+static struct u_csv_row *push_chunked(struct u_csv_chunked *cs,
+                                      struct u_csv_row row)
+{
+        struct u_csv_row *p = u_csv_row_chunks_push(&cs->rows, row);
+        if (p == NULL)
+                error(EXIT_FAILURE, errno, "Failed to allocate space for row.");
+        return p;
+}
+
+/**
+   Appends a row to a CSV structure with chunked row storage.
+
+   @param cs Structure to append to
+   @param strings Values of cell entries
+   @param n Number of columns (or cells)
+
+   @return The new row. It stays at the same address until cs is freed.
+ */
+
+struct u_csv_row *u_csv_chunked_append(struct u_csv_chunked *cs,
+                                       const char *strings[], size_t n)
+{
+        const struct u_allocator *old = use(cs->allocator);
+        struct u_csv_row *row = push_chunked(cs, u_csv_append_row(NULL,
+                                                                  strings, n));
+        u_allocator_set(old);
+        return row;
+}
+
+/**
+   Reads a CSV file into chunked row storage. Unlike u_csv_read(), it never
+   copies the rows already read to make room for more.
+
+   @param f Already opened file to read in.
+   @param header Whether the CSV file has a header
+   @param delim The CSV file delimiter, usually a comma
+
+   @return Populated structure
+ */
+
+struct u_csv_chunked u_csv_chunked_read(FILE * f, bool header, char delim)
+{
+        struct u_csv_chunked cs;
+        struct u_csv_row row;
+        struct u_csv_cells cells = u_csv_cells_new();
+
+        u_csv_row_chunks_init(&cs.rows);
+        cs.allocator = u_allocator_get();
+        if (header)
+                cs.header = u_csv_read_row(NULL, f, delim, &cells);
+        else
+                U_ARRAY(cs.header, cells);
+
+        while ((row = u_csv_read_row(NULL, f, delim, &cells)).len > 0)
+                push_chunked(&cs, row);
+
+        U_ARRAY_FREE(row, cells);
+        u_csv_cells_free(&cells);
+
+        return cs;
+}
+
+/**
+   Get value of a cell of a CSV structure with chunked row storage.
+
+   @param cs Structure to get cell from
+   @param row Row index
+   @param col Column index
+
+   @return Value of cell[row, col], or NULL if there is no such cell
+ */
+
+const char *u_csv_chunked_at(const struct u_csv_chunked *cs, size_t row,
+                             size_t col)
+{
+        if (row >= cs->rows.len)
+                return NULL;
+        const struct u_csv_row *r = u_csv_row_chunks_at(&cs->rows, row);
+        return col < r->len ? r->cells[col] : NULL;
+}
+
+/**
+   Writes a CSV file from a structure with chunked row storage.
+
+   @param f Already opened file to write to
+   @param cs Structure to write
+ */
+
+void u_csv_chunked_write(FILE * f, const struct u_csv_chunked *cs)
+{
+        u_csv_write_row(f, &cs->header);
+        for (size_t k = 0; k < u_csv_row_chunks_chunk_count(&cs->rows); ++k) {
+                size_t len;
+                const struct u_csv_row *rows =
+                    u_csv_row_chunks_chunk(&cs->rows, k, &len);
+                for (size_t i = 0; i < len; ++i)
+                        u_csv_write_row(f, rows + i);
+        }
+}
+
+/**
+   Frees a CSV structure with chunked row storage.
+
+   @param cs struct to free
+*/
+
+void u_csv_chunked_free(struct u_csv_chunked *cs)
+{
+        const struct u_allocator *old = use(cs->allocator);
+        u_csv_free_row(NULL, &cs->header);
+        for (size_t i = 0; i < cs->rows.len; ++i)
+                u_csv_free_row(NULL, u_csv_row_chunks_at(&cs->rows, i));
+        u_csv_row_chunks_free(&cs->rows);
+        u_allocator_set(old);
+}
+
+/**
+   A file for read_files() to read.
+ */
+
+struct read_job {
+        const char *path;
+        struct u_csv cs;
+        int err;
+};
+
+/**
+   Files shared out among the pool tasks of u_csv_read_files().
+ */
+
+struct read_jobs {
+        struct read_job *jobs;
+        size_t n;               // Number of jobs
+        size_t slices;          // Number of tasks they are split between
+        bool header;
+        char delim;
+};
+
+static void read_files(size_t begin, size_t end, void *arg)
+{
+        struct read_jobs *rj = arg;
+
+        for (size_t i = begin; i < end; ++i) {
+                struct read_job *job = &rj->jobs[i];
+                FILE *f = fopen(job->path, "r");
+                if (f == NULL) {
+                        job->err = errno;
+                        continue;
+                }
+                job->cs = u_csv_read(f, rj->header, rj->delim);
+                job->err = 0;
+                fclose(f);
+        }
+}
+
+/**
+   Reads slices [begin, end) of the files, slice k being the files from
+   k * n / slices up to (k + 1) * n / slices.
+ */
+
+static void read_slices(size_t begin, size_t end, void *arg)
+{
+        struct read_jobs *rj = arg;
+
+        for (size_t k = begin; k < end; ++k)
+                read_files(k * rj->n / rj->slices,
+                           (k + 1) * rj->n / rj->slices, rj);
+}
+
+static bool same_row(const struct u_csv_row *a, const struct u_csv_row *b)
+{
+        if (a->len != b->len)
+                return false;
+        for (size_t i = 0; i < a->len; ++i)
+                if (strcmp(a->cells[i], b->cells[i]))
+                        return false;
+        return true;
+}
+
+/**
+   Reads several CSV files with the same layout concurrently and concatenates
+   them. The rows array of the result is allocated once, at its final size,
+   and the rows of each file are moved into it without copying their cells.
+
+   @param paths Names of the files to read
+   @param n Number of files
+   @param header Whether each file has a header. Headers must all be the same.
+   @param delim The CSV file delimiter, usually a comma
+   @param threads Most files to read at once: 1 to read every file on the
+   calling thread, 0 for as many as there are threads in the default thread
+   pool (see thread_pool.h). The files are split into that many slices of
+   consecutive files, each read by one task of the default pool.
+
+   The files are only read concurrently while the calling thread uses the
+   default allocator (see allocator.h). Otherwise the calling thread reads
+   them all itself, so that every allocation comes from its allocator.
+
+   @return Populated csv structure with the rows of every file in the order of
+   paths. If a file can't be opened, or the headers differ, errno is set
+   (EINVAL for differing headers) and the result has no rows.
+ */
+
+struct u_csv u_csv_read_files(const char *paths[], size_t n, bool header,
+                              char delim, unsigned threads)
+{
+        struct read_jobs rj = {.n = n,.header = header,.delim = delim };
+        struct u_csv cs;
+        size_t total = 0;
+        int err = 0;
+
+        if (n == 0)
+                return u_csv_new(false, NULL, 0);
+
+        if (NULL == (rj.jobs = u_calloc(n, sizeof(*rj.jobs))))
+                error(EXIT_FAILURE, errno,
+                      "Failed to allocate space for file list.");
+        for (size_t i = 0; i < n; ++i) {
+                rj.jobs[i].path = paths[i];
+                rj.jobs[i].err = -1;
+        }
+
+        if (threads == 0)
+                threads = u_thread_pool_size(NULL);
+        rj.slices = threads < n ? threads : n;
+        if (rj.slices <= 1 || u_allocator_get() != &u_malloc_allocator)
+                read_files(0, n, &rj);
+        else
+                u_parallel_for(NULL, 0, rj.slices, 1, read_slices, &rj);
+
+        for (size_t i = 0; i < n && err == 0; ++i) {
+                if (rj.jobs[i].err)
+                        err = rj.jobs[i].err;
+                else if (!same_row(&rj.jobs[i].cs.header,
+                                   &rj.jobs[0].cs.header))
+                        err = EINVAL;
+                else
+                        total += rj.jobs[i].cs.len;
+        }
+
+        if (err) {
+                for (size_t i = 0; i < n; ++i)
+                        if (rj.jobs[i].err == 0)
+                                u_csv_free(&rj.jobs[i].cs);
+                u_free(rj.jobs);
+                errno = err;
+                return u_csv_new(false, NULL, 0);
+        }
+
+        cs.header = rj.jobs[0].cs.header;
+        cs.interner = NULL;
+        cs.allocator = u_allocator_get();
+        cs.len = total;
+        cs.capacity = total ? total : U_INIT_CAPACITY;
+        cs.rows = u_array_resize(NULL, NULL, 0, cs.capacity * sizeof(*cs.rows));
+        if (cs.rows == NULL)
+                error(EXIT_FAILURE, errno,
+                      "Failed to allocate space for csv rows.");
+        for (size_t i = 0, j = 0; i < n; ++i) {
+                struct u_csv *part = &rj.jobs[i].cs;
+                memcpy(cs.rows + j, part->rows, part->len * sizeof(*cs.rows));
+                j += part->len;
+                if (i > 0)
+                        u_csv_free_row(NULL, &part->header);
+                U_ARRAY_FREE(*part, rows);
+        }
+        u_free(rj.jobs);
+
+        return cs;
+}
+
+/**
+   Reads every CSV file matching a glob pattern concurrently and concatenates
+   them in the sorted order of their names. See u_csv_read_files().
+
+   @param pattern Glob pattern, e.g. "daily/part-*.csv"
+   @param header Whether each file has a header. Headers must all be the same.
+   @param delim The CSV file delimiter, usually a comma
+   @param threads Most files to read at once, 1 to read on the calling
+   thread or 0 for as many as the default thread pool has threads
+
+   @return Populated csv structure. If nothing matches the pattern errno is
+   set to ENOENT and the result has no rows.
+ */
+
+struct u_csv u_csv_read_glob(const char *pattern, bool header, char delim,
+                             unsigned threads)
+{
+        glob_t g;
+        struct u_csv cs;
+
+        if (glob(pattern, 0, NULL, &g)) {
+                globfree(&g);
+                errno = ENOENT;
+                return u_csv_new(false, NULL, 0);
+        }
+        cs = u_csv_read_files((const char **)g.gl_pathv, g.gl_pathc, header,
+                              delim, threads);
+        globfree(&g);
+        return cs;
 }
 
 static void u_csv_row_to_df_row(const struct u_csv *cs, struct u_dataframe *df,
@@ -247,17 +873,20 @@ static void u_csv_row_to_df_row(const struct u_csv *cs, struct u_dataframe *df,
                               const enum u_val_type col_types[])
 {
         for (size_t i = 0; i < cols; ++i) {
+                const char *s = u_csv_at(cs, row, i);
+                union u_str_dbl *val = &df->vals[row * cols + i];
                 if (col_types[i] == str) {
-                        df->vals[row * cols + i].str =
-                            u_strdup(u_csv_at(cs, row, i));
-                } else {
-                        char *ptr;
-                        df->vals[row * cols + i].dbl =
-                            strtod(u_csv_at(cs, row, i), &ptr);
-                        if (strlen(ptr) > 0 || strlen(u_csv_at(cs, row, i)) == 0)
-                                fprintf(stderr, "Error converting '%s' to "
-                                        "double.\n", cs->rows[row].cells[i]);
-                        errno = EINVAL;
+                        if (s == NULL) {
+                                val->str = NULL;
+                                continue;
+                        }
+                        if (NULL == (val->str = cell_dup(df->interner, s)))
+                                error(EXIT_FAILURE, errno,
+                                      "Failed to allocate space for "
+                                      "dataframe cell.");
+                        valid_set(df->valid[i], row);
+                } else if (u_csv_parse_dbl(s, &val->dbl)) {
+                        valid_set(df->valid[i], row);
                 }
         }
 }
@@ -298,9 +927,12 @@ struct u_dataframe u_dataframe_new(size_t cols, const char *strings[],
         df.rows = 0;
         df.cols = cols;
 
-        df.header = u_csv_append_row(strings, cols);
+        df.header = u_csv_append_row(NULL, strings, cols);
+        df.interner = NULL;
+        df.allocator = u_allocator_get();
+        df.valid = valid_new(cols, 0);
 
-        if (NULL == (df.type = malloc(cols * sizeof(enum u_val_type))))
+        if (NULL == (df.type = u_alloc(cols * sizeof(enum u_val_type))))
                 error(EXIT_FAILURE, errno,
                       "Failed to allocate space for dataframe types.");
 
@@ -312,12 +944,16 @@ struct u_dataframe u_dataframe_new(size_t cols, const char *strings[],
 
 /**
    Converts a csv to a dataframe. Typically you'd read in a CSV file into a
-   struct csv, then convert to the dataframe.
+   struct csv, then convert to the dataframe. Missing cells, and cells of dbl
+   columns that aren't numbers, are NA.
 
    Note, that the csv must be valid else behaviour is undefined. In debug mode
    (i.e. with assert defined), validity is checked for, but not in optimised
    production code.
 
+   If the csv was read with u_csv_read_interned(), the strings of str
+   columns are shared with it through its interner rather than copied.
+
    @param cs csv structure to convert
    @param col_types type for each column (either str or dbl)
 
@@ -326,6 +962,28 @@ struct u_dataframe u_dataframe_new(size_t cols, const char *strings[],
 
 struct u_dataframe u_csv_to_dataframe(const struct u_csv *cs,
                                   const enum u_val_type col_types[])
+{
+        return u_csv_to_dataframe_interned(cs, col_types, cs->interner);
+}
+
+/**
+   Converts a csv to a dataframe like u_csv_to_dataframe(), interning the
+   strings of str columns. They belong to the interner, must not be changed,
+   and stay valid until it is freed. Strings appended to the dataframe later
+   are interned too.
+
+   @param cs csv structure to convert
+   @param col_types type for each column (either str or dbl)
+   @param in Interner to hold the strings (see intern.h), or NULL to copy
+   each string
+
+   @return Dataframe with same number of rows and columns as the csv.
+*/
+
+struct u_dataframe u_csv_to_dataframe_interned(const struct u_csv *cs,
+                                               const enum u_val_type
+                                               col_types[],
+                                               struct u_interner *in)
 {
         struct u_dataframe df;
 
@@ -337,16 +995,19 @@ struct u_dataframe u_csv_to_dataframe(const struct u_csv *cs,
 
         df.rows = rows;
         df.cols = cols;
-        df.vals = malloc(rows * cols * sizeof(union u_str_dbl));
+        df.interner = in;
+        df.allocator = u_allocator_get();
+        df.vals = u_aligned_alloc(rows * cols * sizeof(union u_str_dbl));
         if (NULL == df.vals)
                 error(EXIT_FAILURE, errno,
                       "Failed to allocate space for dataframe cells.");
-        df.type = malloc(cols * sizeof(enum u_val_type));
+        df.type = u_alloc(cols * sizeof(enum u_val_type));
         if (NULL == df.type)
                 error(EXIT_FAILURE, errno,
                       "Failed to allocate space for dataframe types.");
         for (size_t i = 0; i < cols; ++i)
                 df.type[i] = col_types[i];
+        df.valid = valid_new(cols, rows);
 
         for (size_t i = 0; i < rows; ++i)
                 u_csv_row_to_df_row(cs, &df, i, cols, col_types);
@@ -393,41 +1054,52 @@ enum u_val_type u_dataframe_col_type(struct u_dataframe *df, size_t col)
    Appends a new row to a dataframe
 
    @param df dataframe to append to
-   @param vals array of values to append
+   @param vals array of values to append. A NULL string is appended as NA.
 */
 
 void u_dataframe_append(struct u_dataframe *df, const union u_str_dbl vals[])
 {
         size_t rows = df->rows + 1, cols = df->cols;
+        const struct u_allocator *old = use(df->allocator);
 
-        df->vals = realloc(df->vals, rows * cols * sizeof(union u_str_dbl));
+        df->vals = u_aligned_realloc(df->vals,
+                                     rows * cols * sizeof(union u_str_dbl));
         if (NULL == df->vals)
                 error(EXIT_FAILURE, errno,
                       "Failed to allocate space for dataframe column.");
+        if (df->rows % 64 == 0)
+                valid_grow(df->valid, cols, df->rows);
 
         for (size_t i = 0, j = df->rows * cols; i < cols; ++i, ++j) {
                 switch (df->type[i]) {
                 case str:
-                        df->vals[j].str = u_strdup(vals[i].str);
+                        if (vals[i].str == NULL) {
+                                df->vals[j].str = NULL;
+                                break;
+                        }
+                        df->vals[j].str = cell_dup(df->interner, vals[i].str);
                         if (NULL == df->vals[j].str)
                                 error(EXIT_FAILURE, errno, "Failed to allocate "
                                       "space for dataframe cell.");
+                        valid_set(df->valid[i], df->rows);
                         break;
                 case dbl:
                         df->vals[j].dbl = vals[i].dbl;
+                        valid_set(df->valid[i], df->rows);
                         break;
                 default:
                         fprintf(stderr, "Unknown data frame column type.\n");
                 }
         }
         df->rows = rows;
+        u_allocator_set(old);
 }
 
 /**
    Appends a new row to a dataframe. Takes a variable number of arguments.
    After the first argument, each subsequent argument is either a string or
-   double of each corresponding cell in the dataframe. This is a risky function
-   Use with care.
+   double of each corresponding cell in the dataframe. A NULL string is appended
+   as NA. This is a risky function Use with care.
 
    @param df dataframe to append to
 */
@@ -435,24 +1107,35 @@ void u_dataframe_append(struct u_dataframe *df, const union u_str_dbl vals[])
 void u_dataframe_append_var(struct u_dataframe *df, ...)
 {
         size_t rows = df->rows + 1, cols = df->cols;
+        const struct u_allocator *old = use(df->allocator);
         va_list ap;
 
         va_start(ap, df);
-        df->vals = realloc(df->vals, rows * cols * sizeof(union u_str_dbl));
+        df->vals = u_aligned_realloc(df->vals,
+                                     rows * cols * sizeof(union u_str_dbl));
         if (NULL == df->vals)
                 error(EXIT_FAILURE, errno,
                       "Failed to allocate space for dataframe column.");
+        if (df->rows % 64 == 0)
+                valid_grow(df->valid, cols, df->rows);
 
         for (size_t i = 0, j = df->rows * cols; i < cols; ++i, ++j) {
+                char *s;
                 switch (df->type[i]) {
                 case str:
-                        df->vals[j].str = u_strdup(va_arg(ap, char *));
+                        if (NULL == (s = va_arg(ap, char *))) {
+                                df->vals[j].str = NULL;
+                                break;
+                        }
+                        df->vals[j].str = cell_dup(df->interner, s);
                         if (NULL == df->vals[j].str)
                                 error(EXIT_FAILURE, errno, "Failed to allocate "
                                       "space for dataframe cell.");
+                        valid_set(df->valid[i], df->rows);
                         break;
                 case dbl:
                         df->vals[j].dbl = va_arg(ap, double);
+                        valid_set(df->valid[i], df->rows);
                         break;
                 default:
                         fprintf(stderr, "Unknown data frame column type.\n");
@@ -460,10 +1143,100 @@ void u_dataframe_append_var(struct u_dataframe *df, ...)
         }
         df->rows = rows;
         va_end(ap);
+        u_allocator_set(old);
 }
 
 /**
-   Writes a dataframe to a file
+   Checks if a dataframe cell is NA.
+
+   @param df dataframe with the cell
+   @param row row of the cell
+   @param col col of the cell
+
+   @return true if the cell has no value
+*/
+
+bool u_dataframe_isna(const struct u_dataframe *df, size_t row, size_t col)
+{
+        assert(row < df->rows);
+        assert(col < df->cols);
+        return !valid_test(df->valid[col], row);
+}
+
+/**
+   Sets a dataframe cell to NA, freeing its string if it has one.
+
+   @param df dataframe with the cell
+   @param row row of the cell
+   @param col col of the cell
+*/
+
+void u_dataframe_set_na(struct u_dataframe *df, size_t row, size_t col)
+{
+        assert(row < df->rows);
+        assert(col < df->cols);
+        union u_str_dbl *val = &df->vals[row * df->cols + col];
+        if (df->type[col] == str) {
+                const struct u_allocator *old = use(df->allocator);
+                cell_free(df->interner, val->str);
+                u_allocator_set(old);
+                val->str = NULL;
+        } else {
+                val->dbl = NAN;
+        }
+        valid_clear(df->valid[col], row);
+}
+
+/**
+   Counts the cells in a dataframe column that aren't NA.
+
+   @param df dataframe with the column
+   @param col column to count
+
+   @return number of valid cells in the column
+*/
+
+size_t u_dataframe_count(const struct u_dataframe *df, size_t col)
+{
+        assert(col < df->cols);
+        return valid_count(df->valid[col], df->rows);
+}
+
+/**
+   Sums a dbl column of a dataframe, skipping NAs.
+
+   @param df dataframe with the column
+   @param col column to sum
+
+   @return sum of the valid cells in the column
+*/
+
+double u_dataframe_sum(const struct u_dataframe *df, size_t col)
+{
+        assert(col < df->cols);
+        assert(df->type[col] == dbl);
+        return valid_sum(df->valid[col], df->rows,
+                         (const char *)&df->vals[col].dbl,
+                         df->cols * sizeof(union u_str_dbl));
+}
+
+/**
+   Calculates the mean of a dbl column of a dataframe, skipping NAs.
+
+   @param df dataframe with the column
+   @param col column to average
+
+   @return mean of the valid cells in the column, or NAN if there are none
+*/
+
+double u_dataframe_mean(const struct u_dataframe *df, size_t col)
+{
+        size_t n = u_dataframe_count(df, col);
+        return n ? u_dataframe_sum(df, col) / n : NAN;
+}
+
+/**
+   Writes a dataframe to a file. NA cells are written as empty cells.
 
    @parm f already opened file for writing
    @param df dataframe to write out
@@ -475,7 +1248,9 @@ void u_dataframe_write(FILE * f, const struct u_dataframe *df)
         for (size_t i = 0; i < df->rows; ++i) {
                 for (size_t j = 0; j < df->cols && (j == 0 || fputc(',', f));
                      ++j)
-                        if (df->type[j] == dbl)
+                        if (!valid_test(df->valid[j], i))
+                                continue;
+                        else if (df->type[j] == dbl)
                                 fprintf(f, "%f",
                                         df->vals[i * df->cols + j].dbl);
                         else
@@ -486,7 +1261,7 @@ void u_dataframe_write(FILE * f, const struct u_dataframe *df)
 }
 
 /**
-   Converts a dataframe to a csv structure
+   Converts a dataframe to a csv structure. NA cells become empty strings.
 
    @param df dataframe to convert
 
@@ -502,7 +1277,12 @@ struct u_csv u_dataframe_to_csv(const struct u_dataframe *df)
                 char *strings[cols];
                 struct u_csv_row row;
                 for (size_t j = 0; j < cols; ++j) {
-                        if (df->type[j] == dbl) {
+                        if (!valid_test(df->valid[j], i)) {
+                                if ((strings[j] = u_strdup("")) == NULL)
+                                        error(EXIT_FAILURE, errno,
+                                              "Failed to allocate space for "
+                                              "csv cell.");
+                        } else if (df->type[j] == dbl) {
                                 char s[50];
                                 snprintf(s, 50, "%f",
                                          df->vals[i * cols + j].dbl);
@@ -519,16 +1299,17 @@ struct u_csv u_dataframe_to_csv(const struct u_dataframe *df)
                                               "csv cell.");
                         }
                 }
-                row = u_csv_append_row((const char **)strings, cols);
+                row = u_csv_append_row(NULL, (const char **)strings, cols);
                 U_ARRAY_PUSH(cs, rows, row);
                 for (size_t j = 0; j < cols; ++j)
-                        free(strings[j]);
+                        u_free(strings[j]);
         }
         return cs;
 }
 
 /**
-   Converts a dataframe to a matrix
+   Converts a dataframe to a matrix. NA cells, and cells of str columns that
+   aren't numbers, are NA in the matrix.
 
    @param df dataframe to convert
 
@@ -543,26 +1324,24 @@ struct u_matrix u_dataframe_to_matrix(const struct u_dataframe *df)
         const size_t cols = df->cols;
         mat.rows = rows;
         mat.cols = cols;
-        mat.vals = malloc(rows * cols * sizeof(double));
+        mat.allocator = u_allocator_get();
+        mat.vals = u_aligned_alloc(rows * cols * sizeof(double));
         if (NULL == mat.vals)
                 error(EXIT_FAILURE, errno, "Failed to allocate matrix.");
+        mat.valid = valid_new(cols, rows);
 
         for (size_t i = 0; i < rows; ++i) {
                 for (size_t j = 0; j < cols; ++j) {
-                        if (df->type[j] == str) {
-                                char *ptr;
-                                mat.vals[i * cols + j] =
-                                    strtod(u_dataframe_at(df, i, j).str, &ptr);
-                                if (strlen(ptr) > 0 ||
-                                    strlen(u_dataframe_at(df, i, j).str) == 0) {
-                                        fprintf(stderr, "Error converting '%s' "
-                                                "to double.\n",
-                                                u_dataframe_at(df, i, j).str);
-                                        errno = EINVAL;
-                                }
+                        double *val = &mat.vals[i * cols + j];
+                        if (!valid_test(df->valid[j], i)) {
+                                *val = NAN;
+                        } else if (df->type[j] == str) {
+                                if (u_csv_parse_dbl(df->vals[i * cols + j].str,
+                                                    val))
+                                        valid_set(mat.valid[j], i);
                         } else {
-                                mat.vals[i * cols + j] =
-                                    u_dataframe_at(df, i, j).dbl;
+                                *val = u_dataframe_at(df, i, j).dbl;
+                                valid_set(mat.valid[j], i);
                         }
                 }
         }
@@ -577,20 +1356,25 @@ struct u_matrix u_dataframe_to_matrix(const struct u_dataframe *df)
 
 void u_dataframe_free(struct u_dataframe *df)
 {
+        const struct u_allocator *old = use(df->allocator);
         for (size_t i = 0; i < df->rows; ++i) {
                 for (size_t j = 0; j < df->cols; ++j) {
                         if (df->type[j] == str)
-                                free(df->vals[i * df->cols + j].str);
+                                cell_free(df->interner,
+                                          df->vals[i * df->cols + j].str);
                 }
         }
-        u_csv_free_row(&df->header);
-        free(df->vals);
-        free(df->type);
+        u_csv_free_row(NULL, &df->header);
+        u_aligned_free(df->vals);
+        u_free(df->type);
+        valid_free(df->valid, df->cols);
         df->rows = df->cols = 0;
+        u_allocator_set(old);
 }
 
 /**
-   Convert a csv to a matrix of real numbers.
+   Convert a csv to a matrix of real numbers. Missing cells and cells that
+   aren't numbers are NA.
 
    @param cs struct to free
    @return matrix of real numbers
@@ -607,23 +1391,17 @@ struct u_matrix u_csv_to_matrix(const struct u_csv *cs)
         size_t cols = cs->rows[0].len;
         mat.rows = rows;
         mat.cols = cols;
-        mat.vals = malloc(rows * cols * sizeof(double));
+        mat.allocator = u_allocator_get();
+        mat.vals = u_aligned_alloc(rows * cols * sizeof(double));
         if (NULL == mat.vals)
                 error(EXIT_FAILURE, errno, "Failed to allocate matrix.");
+        mat.valid = valid_new(cols, rows);
 
-        for (size_t i = 0; i < rows; ++i) {
-                for (size_t j = 0; j < cols; ++j) {
-                        char *ptr;
-                        mat.vals[i * cols + j] =
-                            strtod(cs->rows[i].cells[j], &ptr);
-                        if (strlen(ptr) > 0 ||
-                            strlen(cs->rows[i].cells[j]) == 0) {
-                                fprintf(stderr, "Error converting '%s' "
-                                        "to double.\n", cs->rows[i].cells[j]);
-                                errno = EINVAL;
-                        }
-                }
-        }
+        for (size_t i = 0; i < rows; ++i)
+                for (size_t j = 0; j < cols; ++j)
+                        if (u_csv_parse_dbl(u_csv_at(cs, i, j),
+                                            &mat.vals[i * cols + j]))
+                                valid_set(mat.valid[j], i);
         return mat;
 }
 
@@ -658,6 +1436,87 @@ inline void u_matrix_set(struct u_matrix *mat, size_t row, size_t col, double va
         assert(row < mat->rows);
         assert(col < mat->cols);
         mat->vals[row * mat->cols + col] = val;
+        valid_set(mat->valid[col], row);
+}
+
+/**
+   Checks if a matrix cell is NA
+
+   @param mat Matrix with the cell
+   @param row Row of cell
+   @param col Column of cell
+
+   @return true if the cell has no value
+ */
+
+bool u_matrix_isna(const struct u_matrix *mat, size_t row, size_t col)
+{
+        assert(row < mat->rows);
+        assert(col < mat->cols);
+        return !valid_test(mat->valid[col], row);
+}
+
+/**
+   Set a matrix cell to NA
+
+   @param mat Matrix to change
+   @param row Row of cell
+   @param col Column of cell
+ */
+
+void u_matrix_set_na(struct u_matrix *mat, size_t row, size_t col)
+{
+        assert(row < mat->rows);
+        assert(col < mat->cols);
+        mat->vals[row * mat->cols + col] = NAN;
+        valid_clear(mat->valid[col], row);
+}
+
+/**
+   Count the cells in a matrix column that aren't NA
+
+   @param mat Matrix with the column
+   @param col Column to count
+
+   @return Number of valid cells in the column
+ */
+
+size_t u_matrix_count(const struct u_matrix *mat, size_t col)
+{
+        assert(col < mat->cols);
+        return valid_count(mat->valid[col], mat->rows);
+}
+
+/**
+   Sum a matrix column, skipping NAs
+
+   @param mat Matrix with the column
+   @param col Column to sum
+
+   @return Sum of the valid cells in the column
+ */
+
+double u_matrix_sum(const struct u_matrix *mat, size_t col)
+{
+        assert(col < mat->cols);
+        return valid_sum(mat->valid[col], mat->rows,
+                         (const char *)&mat->vals[col],
+                         mat->cols * sizeof(double));
+}
+
+/**
+   Calculate the mean of a matrix column, skipping NAs
+
+   @param mat Matrix with the column
+   @param col Column to average
+
+   @return Mean of the valid cells in the column, or NAN if there are none
+ */
+
+double u_matrix_mean(const struct u_matrix *mat, size_t col)
+{
+        size_t n = u_matrix_count(mat, col);
+        return n ? u_matrix_sum(mat, col) / n : NAN;
 }
 
 /**
@@ -668,6 +1527,9 @@ inline void u_matrix_set(struct u_matrix *mat, size_t row, size_t col, double va
 
 void u_matrix_free(struct u_matrix *matrix)
 {
-        free(matrix->vals);
+        const struct u_allocator *old = use(matrix->allocator);
+        u_aligned_free(matrix->vals);
+        valid_free(matrix->valid, matrix->cols);
         matrix->rows = matrix->cols = 0;
+        u_allocator_set(old);
 }
@@ -0,0 +1,97 @@
+/**
+   \file
+
+   \brief Definitions of hash functions
+
+*/
+#include <stdint.h>
+#include <string.h>
+
+#include "useful/hash.h"
+
+/**
+   Constants of wyhash, the algorithm u_hash_bytes() implements.
+ */
+static const uint64_t secret[4] = {
+        0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+        0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull
+};
+
+static inline uint64_t read8(const uint8_t *p)
+{
+        uint64_t v;
+        memcpy(&v, p, 8);
+        return v;
+}
+
+static inline uint64_t read4(const uint8_t *p)
+{
+        uint32_t v;
+        memcpy(&v, p, 4);
+        return v;
+}
+
+static inline uint64_t read3(const uint8_t *p, size_t k)
+{
+        return ((uint64_t) p[0] << 16) | ((uint64_t) p[k >> 1] << 8) | p[k - 1];
+}
+
+/**
+   Hashes a block of memory with wyhash. It reads 16 bytes per step (48 for
+   long inputs), so short keys such as CSV cells hash in a few cycles.
+
+   @param data Memory to hash
+   @param len Number of bytes to hash
+   @param seed Starting value, e.g. 0, or a random number to make the hashes
+   of a table hard to predict
+
+   @return The 64-bit hash
+ */
+
+uint64_t u_hash_bytes(const void *data, size_t len, uint64_t seed)
+{
+        const uint8_t *p = data;
+        uint64_t a, b;
+
+        seed ^= u_hash_mix(seed ^ secret[0], secret[1]);
+        if (len <= 16) {
+                if (len >= 4) {
+                        a = (read4(p) << 32) | read4(p + ((len >> 3) << 2));
+                        b = (read4(p + len - 4) << 32) |
+                            read4(p + len - 4 - ((len >> 3) << 2));
+                } else if (len > 0) {
+                        a = read3(p, len);
+                        b = 0;
+                } else {
+                        a = b = 0;
+                }
+        } else {
+                size_t i = len;
+                if (i >= 48) {
+                        uint64_t seed1 = seed, seed2 = seed;
+                        do {
+                                seed = u_hash_mix(read8(p) ^ secret[1],
+                                                  read8(p + 8) ^ seed);
+                                seed1 = u_hash_mix(read8(p + 16) ^ secret[2],
+                                                   read8(p + 24) ^ seed1);
+                                seed2 = u_hash_mix(read8(p + 32) ^ secret[3],
+                                                   read8(p + 40) ^ seed2);
+                                p += 48;
+                                i -= 48;
+                        } while (i >= 48);
+                        seed ^= seed1 ^ seed2;
+                }
+                while (i > 16) {
+                        seed = u_hash_mix(read8(p) ^ secret[1],
+                                          read8(p + 8) ^ seed);
+                        i -= 16;
+                        p += 16;
+                }
+                a = read8(p + i - 16);
+                b = read8(p + i - 8);
+        }
+        a ^= secret[1];
+        b ^= seed;
+        u_hash_mul128(&a, &b);
+        return u_hash_mix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
@@ -0,0 +1,340 @@
+/**
+   \file
+
+   \brief Definitions of string interning functions
+
+*/
+#include <errno.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "useful/allocator.h"
+#include "useful/hash.h"
+#include "useful/intern.h"
+#include "useful/memory.h"
+#include "useful/queue.h"
+
+/**
+   An interned string, or a string being looked up, with its hash.
+ */
+
+struct key {
+        const char *s;
+        size_t len;
+        uint64_t hash;
+};
+
+static inline uint64_t key_hash(struct key k)
+{
+        return k.hash;
+}
+
+static inline bool key_equal(struct key a, struct key b)
+{
+        return a.hash == b.hash && a.len == b.len &&
+            !memcmp(a.s, b.s, a.len);
+}
+
+U_HASH_MAP_DEFINE(handle_map, struct key, uint32_t, key_hash, key_equal)
+
+/**
+   The strings whose hashes pick a shard, and the handles of those strings.
+ */
+
+struct shard {
+        alignas(U_CACHE_LINE) pthread_mutex_t lock;
+        struct handle_map handles;
+        struct u_arena arena;
+        struct u_allocator strings;     // Allocates from arena
+};
+
+/**
+   Base 2 logarithm of the number of handles in the first chunk of the
+   handle directory. Chunk k holds twice as many as chunk k - 1, so
+   U_INTERN_CHUNKS chunks hold every handle below U_INTERN_NONE.
+ */
+#define CHUNK_SHIFT 10
+#define U_INTERN_CHUNKS (33 - CHUNK_SHIFT)
+
+/**
+   Size of the blocks of the shards' arenas.
+ */
+#define ARENA_BLOCK (64 * 1024)
+
+struct u_interner {
+        struct shard shards[U_INTERN_SHARDS];
+        alignas(U_CACHE_LINE) atomic_uint_least32_t next;       // Next handle
+        _Atomic(const char **) chunks[U_INTERN_CHUNKS];
+};
+
+/**
+   Finds the chunk holding a handle and the handle's index in it.
+ */
+
+static inline unsigned chunk_of(uint32_t handle, size_t *index)
+{
+        uint64_t b = (uint64_t) handle + (1 << CHUNK_SHIFT);
+        unsigned top = 63 - __builtin_clzll(b);
+        *index = b - (UINT64_C(1) << top);
+        return top - CHUNK_SHIFT;
+}
+
+/**
+   Creates an empty interner. Its memory comes from the default allocator
+   whichever allocator the calling thread uses (see allocator.h), since any
+   thread may add to it.
+
+   @return The interner, or NULL (with errno set) if memory runs out. Free it
+   with u_interner_free().
+ */
+
+struct u_interner *u_interner_new(void)
+{
+        const struct u_allocator *old = u_allocator_set(NULL);
+        struct u_interner *in = u_aligned_alloc(sizeof(*in));
+        u_allocator_set(old);
+        if (in == NULL)
+                return NULL;
+        for (size_t i = 0; i < U_INTERN_SHARDS; ++i) {
+                struct shard *s = &in->shards[i];
+                pthread_mutex_init(&s->lock, NULL);
+                handle_map_init_allocator(&s->handles, &u_malloc_allocator);
+                u_arena_init(&s->arena, ARENA_BLOCK);
+                s->strings = u_arena_allocator(&s->arena);
+        }
+        atomic_init(&in->next, 0);
+        for (size_t k = 0; k < U_INTERN_CHUNKS; ++k)
+                atomic_init(&in->chunks[k], NULL);
+        return in;
+}
+
+/**
+   Frees an interner and every string interned in it.
+
+   @param in Interner to free
+ */
+
+void u_interner_free(struct u_interner *in)
+{
+        if (in == NULL)
+                return;
+        for (size_t i = 0; i < U_INTERN_SHARDS; ++i) {
+                struct shard *s = &in->shards[i];
+                pthread_mutex_destroy(&s->lock);
+                handle_map_free(&s->handles);
+                u_arena_free(&s->arena);
+        }
+        for (size_t k = 0; k < U_INTERN_CHUNKS; ++k)
+                u_free_with(&u_malloc_allocator, (void *)in->chunks[k]);
+        const struct u_allocator *old = u_allocator_set(NULL);
+        u_aligned_free(in);
+        u_allocator_set(old);
+}
+
+/**
+   Gets the number of distinct strings interned.
+
+   @param in Interner to query
+ */
+
+size_t u_interner_len(const struct u_interner *in)
+{
+        return atomic_load_explicit(&in->next, memory_order_relaxed);
+}
+
+/**
+   Makes sure the chunk of the directory that will hold a handle exists.
+   Shards may race to create the same chunk; the loser frees its copy.
+ */
+
+static const char **chunk_for(struct u_interner *in, uint32_t handle,
+                              size_t *index)
+{
+        unsigned k = chunk_of(handle, index);
+        const char **chunk = atomic_load_explicit(&in->chunks[k],
+                                                  memory_order_acquire);
+        if (chunk)
+                return chunk;
+        size_t size = ((size_t)1 << (k + CHUNK_SHIFT)) * sizeof(*chunk);
+        const char **fresh = u_alloc_with(&u_malloc_allocator, size);
+        if (fresh == NULL)
+                return NULL;
+        if (atomic_compare_exchange_strong_explicit(&in->chunks[k], &chunk,
+                                                    fresh,
+                                                    memory_order_acq_rel,
+                                                    memory_order_acquire))
+                return fresh;
+        u_free_with(&u_malloc_allocator, fresh);
+        return chunk;
+}
+
+/**
+   Takes the next handle, or returns U_INTERN_NONE if they have run out.
+ */
+
+static uint32_t next_handle(struct u_interner *in)
+{
+        uint32_t h = atomic_load_explicit(&in->next, memory_order_relaxed);
+        while (h != U_INTERN_NONE &&
+               !atomic_compare_exchange_weak_explicit(&in->next, &h, h + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+                ;
+        return h;
+}
+
+/**
+   Looks a string up in its shard, which must be locked, adding it if add is
+   true and it isn't there.
+
+   @return Its handle, or U_INTERN_NONE if it isn't there and add is false or
+   memory runs out
+ */
+
+static uint32_t lookup(struct u_interner *in, struct shard *sh,
+                       struct key k, bool add)
+{
+        if (!add) {
+                const uint32_t *h = handle_map_get(&sh->handles, k);
+                return h ? *h : U_INTERN_NONE;
+        }
+        bool added;
+        size_t i = handle_map_slot_(&sh->handles, k, &added);
+        if (i == SIZE_MAX)
+                return U_INTERN_NONE;
+        if (!added)
+                return sh->handles.vals[i];
+
+        uint32_t handle = next_handle(in);
+        size_t index;
+        const char **chunk = NULL;
+        char *copy = NULL;
+        if (handle != U_INTERN_NONE && k.len < SIZE_MAX - sizeof(handle) &&
+            NULL != (chunk = chunk_for(in, handle, &index)))
+                copy = u_alloc_with(&sh->strings, sizeof(handle) + k.len + 1);
+        if (copy == NULL) {
+                handle_map_remove_at(&sh->handles, i);
+                errno = ENOMEM;
+                return U_INTERN_NONE;
+        }
+        memcpy(copy, &handle, sizeof(handle));
+        copy += sizeof(handle);
+        memcpy(copy, k.s, k.len);
+        copy[k.len] = '\0';
+        chunk[index] = copy;
+        sh->handles.keys[i].s = copy;
+        sh->handles.vals[i] = handle;
+        return handle;
+}
+
+/**
+   Looks a string up, choosing its shard from bits of its hash that the
+   shard's table doesn't use for slots or control bytes.
+ */
+
+static uint32_t find(struct u_interner *in, const char *s, size_t len,
+                     bool add)
+{
+        struct key k = { s, len, u_hash_bytes(s, len, 0) };
+        struct shard *sh = &in->shards[(k.hash >> 40) % U_INTERN_SHARDS];
+        pthread_mutex_lock(&sh->lock);
+        uint32_t handle = lookup(in, sh, k, add);
+        pthread_mutex_unlock(&sh->lock);
+        return handle;
+}
+
+/**
+   Interns len chars, which needn't be null terminated, and gets a handle.
+
+   @param in Interner to add to
+   @param s Chars to intern
+   @param len Number of chars
+
+   @return Handle of the string, or U_INTERN_NONE (with errno set) if memory
+   or handles run out
+ */
+
+uint32_t u_intern_handle_n(struct u_interner *in, const char *s, size_t len)
+{
+        return find(in, s, len, true);
+}
+
+/**
+   Interns a string and gets a handle.
+
+   @param in Interner to add to
+   @param s Null-terminated string to intern
+
+   @return Handle of the string, or U_INTERN_NONE (with errno set) if memory
+   or handles run out
+ */
+
+uint32_t u_intern_handle(struct u_interner *in, const char *s)
+{
+        return find(in, s, strlen(s), true);
+}
+
+/**
+   Interns len chars, which needn't be null terminated.
+
+   @param in Interner to add to
+   @param s Chars to intern
+   @param len Number of chars
+
+   @return The interned, null-terminated copy, or NULL (with errno set) if
+   memory runs out
+ */
+
+const char *u_intern_n(struct u_interner *in, const char *s, size_t len)
+{
+        uint32_t h = find(in, s, len, true);
+        return h == U_INTERN_NONE ? NULL : u_intern_str(in, h);
+}
+
+/**
+   Interns a string.
+
+   @param in Interner to add to
+   @param s Null-terminated string to intern
+
+   @return The interned copy, or NULL (with errno set) if memory runs out
+ */
+
+const char *u_intern(struct u_interner *in, const char *s)
+{
+        return u_intern_n(in, s, strlen(s));
+}
+
+/**
+   Gets the handle of a string without interning it.
+
+   @param in Interner to search
+   @param s Null-terminated string to look for
+
+   @return Handle of the string, or U_INTERN_NONE if it hasn't been interned
+ */
+
+uint32_t u_intern_find(struct u_interner *in, const char *s)
+{
+        return find(in, s, strlen(s), false);
+}
+
+/**
+   Gets the string a handle stands for, without locking.
+
+   @param in Interner the handle came from
+   @param handle Handle returned by the interner
+
+   @return The interned string
+ */
+
+const char *u_intern_str(const struct u_interner *in, uint32_t handle)
+{
+        size_t index;
+        unsigned k = chunk_of(handle, &index);
+        const char **chunk = atomic_load_explicit(&in->chunks[k],
+                                                  memory_order_acquire);
+        return chunk[index];
+}
@@ -0,0 +1,219 @@
+/**
+   \file
+
+   \brief Definitions of functions for reading files a line at a time
+
+*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "useful/lines.h"
+
+/**
+   Starts reading a file descriptor a line at a time, through a buffer.
+
+   @param fd Descriptor to read from, e.g. 0 for standard input. It is not
+   closed by u_lines_close().
+
+   @return Structure to pass to u_lines_next(). Close it with u_lines_close().
+ */
+
+struct u_lines u_lines_fdopen(int fd)
+{
+        struct u_lines lines = {
+                .fd = fd,
+        };
+        return lines;
+}
+
+/**
+   Maps a whole regular file into memory, leaving lines unchanged if it
+   can't. A file that reports size 0 is left to be read instead, since
+   files such as those in /proc have contents but no size.
+ */
+
+static void map_file(struct u_lines *lines)
+{
+        struct stat st;
+
+        if (fstat(lines->fd, &st) || !S_ISREG(st.st_mode) ||
+            st.st_size == 0 || (uintmax_t)st.st_size > SIZE_MAX)
+                return;
+        void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, lines->fd, 0);
+        if (p == MAP_FAILED)
+                return;
+        madvise(p, st.st_size, MADV_SEQUENTIAL);
+        lines->buf = p;
+        lines->len = lines->capacity = st.st_size;
+        lines->mapped = lines->eof = true;
+}
+
+/**
+   Opens a file to read a line at a time.
+
+   @param path Name of the file
+   @param map Whether to map the file into memory rather than read it into a
+   buffer. Files that can't be mapped, such as pipes, are read into a buffer
+   anyway.
+
+   @return Structure to pass to u_lines_next(). If the file can't be opened
+   its fd is -1, errno is set, and it has no lines. Close it with
+   u_lines_close().
+ */
+
+struct u_lines u_lines_open(const char *path, bool map)
+{
+        struct u_lines lines = u_lines_fdopen(open(path, O_RDONLY | O_CLOEXEC));
+
+        if (lines.fd < 0) {
+                lines.error = errno;
+                lines.eof = true;
+                return lines;
+        }
+        lines.own_fd = true;
+        if (map)
+                map_file(&lines);
+        return lines;
+}
+
+/**
+   Moves the bytes not yet returned to the front of the buffer, growing it if
+   they fill it, and reads more after them.
+
+   @return false if a read fails or memory runs out
+ */
+
+static bool fill(struct u_lines *lines)
+{
+        size_t kept = lines->len - lines->start;
+
+        if (lines->start) {
+                memmove(lines->buf, lines->buf + lines->start, kept);
+                lines->start = 0;
+        }
+        lines->len = kept;
+        if (lines->len == lines->capacity) {
+                size_t needed = lines->capacity ? lines->capacity + 1 :
+                    U_LINES_BUFFER;
+                size_t capacity = u_array_next_capacity(lines->capacity,
+                                                        needed, 1);
+                char *buf = capacity ? u_array_resize(NULL, lines->buf,
+                                                      lines->capacity,
+                                                      capacity) : NULL;
+                if (buf == NULL) {
+                        lines->error = ENOMEM;
+                        return false;
+                }
+                lines->buf = buf;
+                lines->capacity = capacity;
+        }
+        for (;;) {
+                ssize_t n = read(lines->fd, lines->buf + lines->len,
+                                 lines->capacity - lines->len);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n < 0) {
+                        lines->error = errno;
+                        return false;
+                }
+                if (n == 0)
+                        lines->eof = true;
+                lines->len += n;
+                return true;
+        }
+}
+
+/**
+   Gets the next line of a file without copying it.
+
+   @param lines File being read
+   @param line Set to the line, without its newline. The last line needn't
+   end in a newline. The view is valid until the next call, or, if the file
+   is mapped, until it is closed.
+
+   @return true, or false at the end of the file or if reading it fails, in
+   which case lines->error is set
+ */
+
+bool u_lines_next(struct u_lines *lines, struct u_string_view *line)
+{
+        size_t scanned = 0;     // Bytes after start known to have no newline
+
+        for (;;) {
+                char *p = lines->buf + lines->start;
+                size_t n = lines->len - lines->start;
+                char *nl = n ? memchr(p + scanned, '\n', n - scanned) : NULL;
+                if (nl) {
+                        line->str = p;
+                        line->len = nl - p;
+                        lines->start += line->len + 1;
+                        return true;
+                }
+                if (lines->eof) {
+                        if (n == 0)
+                                return false;
+                        line->str = p;
+                        line->len = n;
+                        lines->start = lines->len;
+                        return true;
+                }
+                scanned = n;
+                if (!fill(lines))
+                        return false;
+        }
+}
+
+/**
+   Copies the next line of a file into a string, like fgets().
+
+   @param lines File being read
+   @param dest String whose contents are replaced by the line, without its
+   newline
+
+   @return dest->str, or NULL at the end of the file, if reading it fails, or
+   if memory runs out (lines->error is set in the last two cases)
+ */
+
+char *u_lines_read(struct u_lines *lines, struct u_string *dest)
+{
+        struct u_string_view line;
+
+        if (!u_lines_next(lines, &line))
+                return NULL;
+        if (!u_string_reserve(dest, line.len + 1)) {
+                lines->error = ENOMEM;
+                return NULL;
+        }
+        memcpy(dest->str, line.str, line.len);
+        dest->str[line.len] = '\0';
+        dest->len = line.len + 1;
+        return dest->str;
+}
+
+/**
+   Stops reading a file, closes it if it was opened by u_lines_open(), and
+   frees its buffer.
+
+   @param lines File being read
+ */
+
+void u_lines_close(struct u_lines *lines)
+{
+        if (lines->mapped)
+                munmap(lines->buf, lines->capacity);
+        else
+                u_array_release(NULL, lines->buf, lines->capacity);
+        if (lines->own_fd && lines->fd >= 0)
+                close(lines->fd);
+        lines->fd = -1;
+        lines->buf = NULL;
+        lines->start = lines->len = lines->capacity = 0;
+        lines->mapped = false;
+        lines->eof = true;
+}
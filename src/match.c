@@ -0,0 +1,385 @@
+/**
+   \file
+
+   \brief Definitions of functions for searching text
+
+*/
+#include <errno.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define U_MATCH_SIMD
+#endif
+
+#include "useful/allocator.h"
+#include "useful/match.h"
+
+/**
+   Finds a pattern of at least 2 chars from offset i on, by looking for its
+   first char with memchr() and checking its last char before the rest.
+ */
+
+static size_t find_scalar(const char *text, size_t n, const char *pattern,
+                          size_t m, size_t i)
+{
+        while (i + m <= n) {
+                const char *p = memchr(text + i, pattern[0], n - m + 1 - i);
+                if (p == NULL)
+                        return U_NOT_FOUND;
+                i = p - text;
+                if (text[i + m - 1] == pattern[m - 1] &&
+                    !memcmp(text + i + 1, pattern + 1, m - 2))
+                        return i;
+                ++i;
+        }
+        return U_NOT_FOUND;
+}
+
+#ifdef U_MATCH_SIMD
+
+/**
+   Finds a pattern of at least 2 chars 16 positions at a time. A position is
+   a candidate if the text has the first char of the pattern there and its
+   last char m - 1 chars further on; only candidates are compared in full.
+   SSE2 is part of x86-64, so this needs no check.
+ */
+
+static size_t find_sse2(const char *text, size_t n, const char *pattern,
+                        size_t m)
+{
+        const __m128i first = _mm_set1_epi8(pattern[0]);
+        const __m128i last = _mm_set1_epi8(pattern[m - 1]);
+        size_t i = 0;
+
+        for (; i + m - 1 + 16 <= n; i += 16) {
+                __m128i a = _mm_loadu_si128((const void *)(text + i));
+                __m128i b = _mm_loadu_si128((const void *)(text + i + m - 1));
+                unsigned mask = _mm_movemask_epi8(_mm_and_si128
+                                                  (_mm_cmpeq_epi8(a, first),
+                                                   _mm_cmpeq_epi8(b, last)));
+                while (mask) {
+                        size_t j = i + __builtin_ctz(mask);
+                        if (!memcmp(text + j + 1, pattern + 1, m - 2))
+                                return j;
+                        mask &= mask - 1;
+                }
+        }
+        return find_scalar(text, n, pattern, m, i);
+}
+
+/**
+   Same as find_sse2(), 32 positions at a time.
+ */
+
+__attribute__ ((target("avx2")))
+static size_t find_avx2(const char *text, size_t n, const char *pattern,
+                        size_t m)
+{
+        const __m256i first = _mm256_set1_epi8(pattern[0]);
+        const __m256i last = _mm256_set1_epi8(pattern[m - 1]);
+        size_t i = 0;
+
+        for (; i + m - 1 + 32 <= n; i += 32) {
+                __m256i a = _mm256_loadu_si256((const void *)(text + i));
+                __m256i b = _mm256_loadu_si256((const void *)
+                                               (text + i + m - 1));
+                unsigned mask = _mm256_movemask_epi8(_mm256_and_si256
+                                                     (_mm256_cmpeq_epi8
+                                                      (a, first),
+                                                      _mm256_cmpeq_epi8
+                                                      (b, last)));
+                while (mask) {
+                        size_t j = i + __builtin_ctz(mask);
+                        if (!memcmp(text + j + 1, pattern + 1, m - 2))
+                                return j;
+                        mask &= mask - 1;
+                }
+        }
+        return find_scalar(text, n, pattern, m, i);
+}
+
+#endif
+
+/**
+   Finds the first occurrence of a pattern in a text. Neither needs to be
+   null terminated.
+
+   @param text Text to search
+   @param n Number of chars in text
+   @param pattern Chars to look for
+   @param m Number of chars in pattern
+
+   @return Offset of the occurrence, 0 if the pattern is empty, or
+   U_NOT_FOUND
+ */
+
+size_t u_find(const char *text, size_t n, const char *pattern, size_t m)
+{
+        if (m == 0)
+                return 0;
+        if (m > n)
+                return U_NOT_FOUND;
+        if (m == 1) {
+                const char *p = memchr(text, pattern[0], n);
+                return p ? (size_t)(p - text) : U_NOT_FOUND;
+        }
+#ifdef U_MATCH_SIMD
+        if (__builtin_cpu_supports("avx2"))
+                return find_avx2(text, n, pattern, m);
+        return find_sse2(text, n, pattern, m);
+#else
+        return find_scalar(text, n, pattern, m, 0);
+#endif
+}
+
+/**
+   Finds the first occurrence of a pattern in a string at or after an index.
+
+   @param s String to search
+   @param from Index to start at
+   @param pattern Null-terminated pattern
+
+   @return Index in s of the occurrence, or U_NOT_FOUND
+ */
+
+size_t u_string_find(const struct u_string *s, size_t from,
+                     const char *pattern)
+{
+        size_t len = s->len ? s->len - 1 : 0;
+        if (from > len)
+                return U_NOT_FOUND;
+        size_t i = u_find(s->str + from, len - from, pattern, strlen(pattern));
+        return i == U_NOT_FOUND ? i : from + i;
+}
+
+/**
+   State meaning none, e.g. no pattern or no state with an output.
+ */
+#define NONE UINT32_MAX
+
+/**
+   An Aho-Corasick automaton. Chars that appear in no pattern all behave the
+   same, so chars are first mapped to classes: class 0 for chars in no
+   pattern, and a class for each char in some pattern. This keeps the table
+   small when the patterns use few distinct chars. next has a row of
+   classes entries for each state, giving the state after each class of
+   char. State 0 is the start.
+ */
+
+struct u_matcher {
+        uint32_t classes;
+        uint32_t states;
+        uint16_t class[256];
+        uint32_t *next;
+        uint32_t *report;       // Nearest state on the suffix chain (this
+                                // one included) ending a pattern, or NONE
+        uint32_t *dict;         // report of the state's longest proper
+                                // suffix, or NONE
+        uint32_t *out;          // First pattern ending at the state
+        uint32_t *same;         // Next pattern ending at the same state
+        size_t *lens;           // Lengths of the patterns
+        const struct u_allocator *allocator;    // Of the matcher and arrays
+};
+
+/**
+   Frees a matcher.
+
+   @param m Matcher to free
+ */
+
+void u_matcher_free(struct u_matcher *m)
+{
+        if (m == NULL)
+                return;
+        const struct u_allocator *a = m->allocator;
+        u_free_with(a, m->next);
+        u_free_with(a, m->report);
+        u_free_with(a, m->dict);
+        u_free_with(a, m->out);
+        u_free_with(a, m->same);
+        u_free_with(a, m->lens);
+        u_free_with(a, m);
+}
+
+/**
+   Adds the patterns to the trie, whose states are numbered in the order
+   they are created.
+ */
+
+static void build_trie(struct u_matcher *m,
+                       const struct u_string_view *patterns, size_t n)
+{
+        m->states = 1;
+        for (size_t k = 0; k < n; ++k) {
+                uint32_t s = 0;
+                for (size_t i = 0; i < patterns[k].len; ++i) {
+                        unsigned char c = patterns[k].str[i];
+                        uint32_t *t = &m->next[(size_t)s * m->classes +
+                                               m->class[c]];
+                        if (*t == 0)
+                                *t = m->states++;
+                        s = *t;
+                }
+                m->lens[k] = patterns[k].len;
+                m->same[k] = NONE;
+                if (patterns[k].len) {
+                        m->same[k] = m->out[s];
+                        m->out[s] = k;
+                }
+        }
+}
+
+/**
+   Turns the trie into the automaton, visiting states breadth first so that
+   the longest proper suffix of each state, which is shorter, has been
+   visited first. A missing transition goes where the suffix's does.
+ */
+
+static bool build_links(struct u_matcher *m)
+{
+        const size_t c = m->classes;
+        uint32_t *fail = u_calloc(m->states, sizeof(*fail));
+        uint32_t *queue = u_calloc(m->states, sizeof(*queue));
+        if (fail == NULL || queue == NULL) {
+                u_free(fail);
+                u_free(queue);
+                return false;
+        }
+        size_t head = 0, tail = 0;
+
+        m->report[0] = m->dict[0] = NONE;
+        for (size_t k = 0; k < c; ++k)
+                if (m->next[k])
+                        queue[tail++] = m->next[k];
+        while (head < tail) {
+                uint32_t s = queue[head++];
+                m->dict[s] = m->report[fail[s]];
+                m->report[s] = m->out[s] != NONE ? s : m->dict[s];
+                for (size_t k = 0; k < c; ++k) {
+                        uint32_t *t = &m->next[s * c + k];
+                        uint32_t suffix = m->next[fail[s] * c + k];
+                        if (*t) {
+                                fail[*t] = suffix;
+                                queue[tail++] = *t;
+                        } else {
+                                *t = suffix;
+                        }
+                }
+        }
+        u_free(fail);
+        u_free(queue);
+        return true;
+}
+
+/**
+   Builds a matcher that finds any of a set of patterns. Empty patterns
+   never match.
+
+   @param patterns Patterns to look for, which are copied
+   @param n Number of patterns
+
+   @return The matcher, or NULL (with errno set) if memory runs out. Free it
+   with u_matcher_free().
+ */
+
+struct u_matcher *u_matcher_new(const struct u_string_view *patterns,
+                                size_t n)
+{
+        struct u_matcher *m = u_calloc(1, sizeof(*m));
+        if (m == NULL)
+                return NULL;
+        m->allocator = u_allocator_get();
+
+        bool used[256] = { false };
+        size_t states = 1;
+        for (size_t k = 0; k < n; ++k) {
+                if (patterns[k].len >= NONE - states)
+                        goto fail;
+                states += patterns[k].len;
+                for (size_t i = 0; i < patterns[k].len; ++i)
+                        used[(unsigned char)patterns[k].str[i]] = true;
+        }
+        m->classes = 1;
+        for (size_t c = 0; c < 256; ++c)
+                m->class[c] = used[c] ? m->classes++ : 0;
+
+        if (n >= NONE || states > SIZE_MAX / m->classes)
+                goto fail;
+        m->next = u_calloc(states * m->classes, sizeof(*m->next));
+        m->report = u_calloc(states, sizeof(*m->report));
+        m->dict = u_calloc(states, sizeof(*m->dict));
+        m->out = u_calloc(states, sizeof(*m->out));
+        m->same = u_calloc(n, sizeof(*m->same));
+        m->lens = u_calloc(n, sizeof(*m->lens));
+        if (!m->next || !m->report || !m->dict || !m->out ||
+            (n && (!m->same || !m->lens)))
+                goto fail;
+        memset(m->out, 0xff, states * sizeof(*m->out));
+
+        build_trie(m, patterns, n);
+        if (!build_links(m))
+                goto fail;
+        return m;
+
+ fail:
+        errno = ENOMEM;
+        u_matcher_free(m);
+        return NULL;
+}
+
+/**
+   Finds every occurrence of every pattern of a matcher in a text, in the
+   order they end, those ending at the same char longest first.
+
+   @param m Matcher to use
+   @param text Text to search
+   @param matches Where to store the first max occurrences
+   @param max Size of matches, which may be 0 to just count them
+
+   @return Number of occurrences, which may be more than max
+ */
+
+size_t u_matcher_find(const struct u_matcher *m, struct u_string_view text,
+                      struct u_match *matches, size_t max)
+{
+        const unsigned char *p = (const unsigned char *)text.str;
+        size_t count = 0;
+        uint32_t s = 0;
+
+        for (size_t i = 0; i < text.len; ++i) {
+                s = m->next[(size_t)s * m->classes + m->class[p[i]]];
+                for (uint32_t r = m->report[s]; r != NONE; r = m->dict[r])
+                        for (uint32_t k = m->out[r]; k != NONE;
+                             k = m->same[k]) {
+                                if (count < max) {
+                                        matches[count].pattern = k;
+                                        matches[count].offset =
+                                            i + 1 - m->lens[k];
+                                }
+                                ++count;
+                        }
+        }
+        return count;
+}
+
+/**
+   Checks if any pattern of a matcher occurs in a text, stopping at the
+   first occurrence.
+
+   @param m Matcher to use
+   @param text Text to search
+ */
+
+bool u_matcher_any(const struct u_matcher *m, struct u_string_view text)
+{
+        const unsigned char *p = (const unsigned char *)text.str;
+        uint32_t s = 0;
+
+        for (size_t i = 0; i < text.len; ++i) {
+                s = m->next[(size_t)s * m->classes + m->class[p[i]]];
+                if (m->report[s] != NONE)
+                        return true;
+        }
+        return false;
+}
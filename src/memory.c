@@ -0,0 +1,224 @@
+/**
+   \file
+
+   \brief Definitions of aligned memory management functions
+
+*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include "useful/allocator.h"
+#include "useful/memory.h"
+
+/**
+   Size of an explicit huge page. Mappings that use MAP_HUGETLB are rounded up
+   to a multiple of this.
+ */
+#define U_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/**
+   Size of an ordinary page. Other mappings are rounded up to a multiple of
+   this.
+ */
+#define U_PAGE_SIZE 4096
+
+/**
+   Bookkeeping stored immediately before every pointer handed out.
+ */
+struct u_aligned_header {
+        void *base;             // Start of the malloc'd block or mapping
+        size_t size;            // Bytes requested by the caller
+        size_t mapped;          // Length of the mapping, 0 if on the heap
+        int huge;               // True if mapped with MAP_HUGETLB
+};
+
+_Static_assert(sizeof(struct u_aligned_header) <= U_ALIGNMENT,
+               "U_ALIGNMENT too small to hold allocation header");
+
+static inline struct u_aligned_header *header_of(void *ptr)
+{
+        return (struct u_aligned_header *)ptr - 1;
+}
+
+static inline char *align_up(char *p)
+{
+        uintptr_t u = (uintptr_t) p + sizeof(struct u_aligned_header);
+        return (char *)((u + U_ALIGNMENT - 1) & ~(uintptr_t) (U_ALIGNMENT - 1));
+}
+
+static inline size_t round_up(size_t n, size_t multiple)
+{
+        return (n + multiple - 1) / multiple * multiple;
+}
+
+static void *heap_alloc(size_t size)
+{
+        char *base = u_alloc(size + sizeof(struct u_aligned_header) +
+                             U_ALIGNMENT);
+        if (base == NULL)
+                return NULL;
+        char *ptr = align_up(base);
+        *header_of(ptr) = (struct u_aligned_header) {
+                .base = base,.size = size,.mapped = 0,.huge = 0
+        };
+        return ptr;
+}
+
+#ifdef __linux__
+static void *map_alloc(size_t size)
+{
+        size_t total = size + U_ALIGNMENT;
+        size_t mapped = round_up(total, U_HUGE_PAGE_SIZE);
+        int huge = 1;
+        char *base = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (base == MAP_FAILED) {
+                huge = 0;
+                mapped = round_up(total, U_PAGE_SIZE);
+                base = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (base == MAP_FAILED)
+                        return NULL;
+#ifdef MADV_HUGEPAGE
+                madvise(base, mapped, MADV_HUGEPAGE);
+#endif
+        }
+        char *ptr = base + U_ALIGNMENT;
+        *header_of(ptr) = (struct u_aligned_header) {
+                .base = base,.size = size,.mapped = mapped,.huge = huge
+        };
+        return ptr;
+}
+
+static void *map_realloc(void *ptr, size_t size)
+{
+        struct u_aligned_header h = *header_of(ptr);
+        size_t mapped = round_up(size + U_ALIGNMENT,
+                                 h.huge ? U_HUGE_PAGE_SIZE : U_PAGE_SIZE);
+        char *base = mremap(h.base, h.mapped, mapped, MREMAP_MAYMOVE);
+        if (base == MAP_FAILED)
+                return NULL;
+        ptr = base + U_ALIGNMENT;
+        header_of(ptr)->base = base;
+        header_of(ptr)->mapped = mapped;
+        header_of(ptr)->size = size;
+        return ptr;
+}
+#else
+static void *map_alloc(size_t size)
+{
+        (void)size;
+        errno = ENOMEM;
+        return NULL;
+}
+
+static void *map_realloc(void *ptr, size_t size)
+{
+        (void)ptr;
+        (void)size;
+        errno = ENOMEM;
+        return NULL;
+}
+#endif
+
+/**
+   Allocates memory aligned to U_ALIGNMENT bytes. Allocations of at least
+   U_HUGE_PAGE_THRESHOLD bytes are backed by huge pages where possible.
+
+   @param size Number of bytes to allocate
+
+   @return Pointer to the memory, or NULL (with errno set) on failure. Free it
+   with u_aligned_free().
+ */
+
+void *u_aligned_alloc(size_t size)
+{
+        if (size >= U_HUGE_PAGE_THRESHOLD) {
+                void *ptr = map_alloc(size);
+                if (ptr != NULL)
+                        return ptr;
+        }
+        return heap_alloc(size);
+}
+
+/**
+   Resizes memory obtained from u_aligned_alloc(), keeping its alignment and
+   contents up to the smaller of the old and new sizes. Huge mappings are
+   grown in place or remapped rather than copied.
+
+   @param ptr Memory to resize. If NULL this behaves like u_aligned_alloc().
+   @param size New size in bytes
+
+   @return Pointer to the resized memory, or NULL (with errno set) on failure,
+   in which case ptr is left untouched.
+ */
+
+void *u_aligned_realloc(void *ptr, size_t size)
+{
+        if (ptr == NULL)
+                return u_aligned_alloc(size);
+
+        struct u_aligned_header *h = header_of(ptr);
+
+        if (h->mapped) {
+                if (size + U_ALIGNMENT <= h->mapped &&
+                    size >= U_HUGE_PAGE_THRESHOLD / 2) {
+                        h->size = size;
+                        return ptr;
+                }
+                if (size >= U_HUGE_PAGE_THRESHOLD) {
+                        void *p = map_realloc(ptr, size);
+                        if (p != NULL)
+                                return p;
+                }
+        } else if (size < U_HUGE_PAGE_THRESHOLD) {
+                size_t offset = (char *)ptr - (char *)h->base;
+                size_t old_size = h->size;
+                char *base = u_realloc(h->base,
+                                       size + sizeof(struct u_aligned_header) +
+                                       U_ALIGNMENT);
+                if (base == NULL)
+                        return NULL;
+                char *p = align_up(base);
+                if ((size_t) (p - base) != offset)
+                        memmove(p, base + offset,
+                                old_size < size ? old_size : size);
+                *header_of(p) = (struct u_aligned_header) {
+                        .base = base,.size = size,.mapped = 0,.huge = 0
+                };
+                return p;
+        }
+
+        void *p = u_aligned_alloc(size);
+        if (p == NULL)
+                return NULL;
+        memcpy(p, ptr, h->size < size ? h->size : size);
+        u_aligned_free(ptr);
+        return p;
+}
+
+/**
+   Frees memory obtained from u_aligned_alloc() or u_aligned_realloc().
+
+   @param ptr Memory to free. Does nothing if NULL.
+ */
+
+void u_aligned_free(void *ptr)
+{
+        if (ptr == NULL)
+                return;
+        struct u_aligned_header *h = header_of(ptr);
+#ifdef __linux__
+        if (h->mapped) {
+                munmap(h->base, h->mapped);
+                return;
+        }
+#endif
+        u_free(h->base);
+}
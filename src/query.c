@@ -0,0 +1,409 @@
+/**
+   \file
+
+   \brief Definitions of lazy query functions
+
+*/
+#include <errno.h>
+#include <error.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "useful/query.h"
+
+/**
+   Array of cell pointers. Each row in a batch is a span of it.
+ */
+struct view {
+        size_t len;
+        size_t capacity;
+        const char **ptrs;
+};
+
+/**
+   Position and width of a row in a view.
+ */
+struct span {
+        size_t start;
+        size_t n;
+};
+
+static inline void push_ptr(struct view *v, const char *p)
+{
+        U_ARRAY_PUSH(*v, ptrs, p);
+        if (v->capacity == 0)
+                error(EXIT_FAILURE, errno,
+                      "Failed to allocate space for query batch.");
+}
+
+static struct u_query_stage *add_stage(struct u_query *q,
+                                       enum u_query_stage_type type)
+{
+        struct u_query_stage stage = {.type = type };
+        U_ARRAY_PUSH(*q, stages, stage);
+        if (q->capacity == 0)
+                error(EXIT_FAILURE, errno,
+                      "Failed to allocate space for query stage.");
+        return &q->stages[q->len - 1];
+}
+
+/**
+   Starts a query over a CSV file. Nothing is read until u_query_run().
+
+   @param f Already opened file to read from
+   @param header Whether the CSV file has a header. The header is skipped.
+   @param delim The CSV file delimiter, usually a comma
+
+   @return Query with no stages. Free it with u_query_free().
+ */
+
+struct u_query u_query_csv(FILE * f, bool header, char delim)
+{
+        struct u_query q;
+        q.f = f;
+        q.header = header;
+        q.delim = delim;
+        U_ARRAY(q, stages);
+        if (q.capacity == 0)
+                error(EXIT_FAILURE, errno,
+                      "Failed to allocate space for query.");
+        return q;
+}
+
+/**
+   Adds a filter to a query. Only rows for which pred returns true reach the
+   following stages.
+
+   @param q Query to add to
+   @param pred Predicate called with the cells of each row
+   @param data Passed unchanged to pred
+ */
+
+void u_query_filter(struct u_query *q, u_query_pred pred, void *data)
+{
+        struct u_query_stage *stage = add_stage(q, u_query_filter_stage);
+        stage->pred = pred;
+        stage->data = data;
+}
+
+/**
+   Adds a projection to a query. Following stages see only the given columns,
+   in the given order. Columns past the end of a short row are empty.
+
+   @param q Query to add to
+   @param cols Indices of the columns to keep
+   @param n Number of columns to keep
+ */
+
+void u_query_project(struct u_query *q, const size_t cols[], size_t n)
+{
+        struct u_query_stage *stage = add_stage(q, u_query_project_stage);
+        if (NULL == (stage->cols = u_alloc(n * sizeof(*cols))) && n > 0)
+                error(EXIT_FAILURE, errno,
+                      "Failed to allocate space for query projection.");
+        memcpy(stage->cols, cols, n * sizeof(*cols));
+        stage->ncols = n;
+}
+
+/**
+   Adds a derived column to a query. The new column is appended after the
+   existing ones.
+
+   @param q Query to add to
+   @param derive Function that writes the value of the new column for a row
+   @param data Passed unchanged to derive
+ */
+
+void u_query_derive(struct u_query *q, u_query_derive_func derive, void *data)
+{
+        struct u_query_stage *stage = add_stage(q, u_query_derive_stage);
+        stage->derive = derive;
+        stage->data = data;
+}
+
+/**
+   Adds a sink to a query. Rows pass through a sink unchanged, so further
+   stages may follow it.
+
+   @param q Query to add to
+   @param sink Function called with the cells of each row
+   @param data Passed unchanged to sink
+ */
+
+void u_query_sink(struct u_query *q, u_query_sink_func sink, void *data)
+{
+        struct u_query_stage *stage = add_stage(q, u_query_sink_stage);
+        stage->sink = sink;
+        stage->data = data;
+}
+
+/**
+   Adds a sink that writes rows to a file in CSV format.
+
+   @param q Query to add to
+   @param f Already opened file to write to
+ */
+
+void u_query_write(struct u_query *q, FILE * f)
+{
+        struct u_query_stage *stage = add_stage(q, u_query_write_stage);
+        stage->f = f;
+}
+
+/**
+   Adds an aggregate to a query. Rows pass through an aggregate unchanged.
+
+   @param q Query to add to
+   @param col Column to aggregate
+   @param agg Reduction to compute
+   @param result Where u_query_run() stores the result. The sum and count of
+   no values are 0, the min, max and mean are NAN.
+ */
+
+void u_query_aggregate(struct u_query *q, size_t col, enum u_aggregate agg,
+                       double *result)
+{
+        struct u_query_stage *stage = add_stage(q, u_query_aggregate_stage);
+        if (NULL == (stage->cols = u_alloc(sizeof(col))))
+                error(EXIT_FAILURE, errno,
+                      "Failed to allocate space for query aggregate.");
+        stage->cols[0] = col;
+        stage->ncols = 1;
+        stage->agg = agg;
+        stage->result = result;
+}
+
+static void aggregate_start(struct u_query_stage *stage)
+{
+        stage->n = 0;
+        stage->acc = stage->agg == u_min ? INFINITY
+            : stage->agg == u_max ? -INFINITY : 0.0;
+}
+
+static void aggregate_end(struct u_query_stage *stage)
+{
+        switch (stage->agg) {
+        case u_count:
+                *stage->result = stage->n;
+                break;
+        case u_sum:
+                *stage->result = stage->acc;
+                break;
+        case u_min:
+        case u_max:
+                *stage->result = stage->n ? stage->acc : NAN;
+                break;
+        case u_mean:
+                *stage->result = stage->n ? stage->acc / stage->n : NAN;
+                break;
+        }
+}
+
+static void aggregate(struct u_query_stage *stage, const char *cells[],
+                      size_t n)
+{
+        size_t col = stage->cols[0];
+        double d;
+        if (col >= n || !u_csv_parse_dbl(cells[col], &d))
+                return;
+        ++stage->n;
+        switch (stage->agg) {
+        case u_min:
+                if (d < stage->acc)
+                        stage->acc = d;
+                break;
+        case u_max:
+                if (d > stage->acc)
+                        stage->acc = d;
+                break;
+        default:
+                stage->acc += d;
+        }
+}
+
+static void write_row(FILE * f, const char *cells[], size_t n)
+{
+        for (size_t i = 0; i < n && (i == 0 || fputc(',', f)); ++i)
+                fputs(cells[i], f);
+        fputc('\n', f);
+}
+
+/**
+   Runs a query, making a single streaming pass over its source.
+
+   @param q Query to run
+
+   @return Number of rows that made it through every stage
+ */
+
+size_t u_query_run(struct u_query *q)
+{
+        struct u_csv_cells cells = u_csv_cells_new();
+        struct u_csv_cells derived[q->len + 1];
+        struct view view, next;
+        struct span *spans = u_alloc(U_QUERY_BATCH * sizeof(*spans));
+        size_t *sel = u_alloc(U_QUERY_BATCH * sizeof(*sel));
+        size_t total = 0;
+        bool more = true;
+
+        if (NULL == spans || NULL == sel)
+                error(EXIT_FAILURE, errno,
+                      "Failed to allocate space for query batch.");
+        U_ARRAY(view, ptrs);
+        U_ARRAY(next, ptrs);
+        U_STRING(out);
+        for (size_t s = 0; s < q->len; ++s) {
+                if (q->stages[s].type == u_query_derive_stage)
+                        derived[s] = u_csv_cells_new();
+                else if (q->stages[s].type == u_query_aggregate_stage)
+                        aggregate_start(&q->stages[s]);
+        }
+
+        if (q->header)
+                u_csv_read_cells(q->f, q->delim, &cells);
+
+        while (more) {
+                size_t rows = 0, nsel;
+
+                u_csv_cells_clear(&cells);
+                while (rows < U_QUERY_BATCH) {
+                        size_t start = cells.index.len;
+                        size_t n = u_csv_read_cells(q->f, q->delim, &cells);
+                        if (n == 0) {
+                                more = false;
+                                break;
+                        }
+                        spans[rows].start = start;
+                        spans[rows].n = n;
+                        sel[rows] = rows;
+                        ++rows;
+                }
+                view.len = 0;
+                for (size_t i = 0; i < cells.index.len; ++i)
+                        push_ptr(&view, u_csv_cells_at(&cells, i));
+                nsel = rows;
+
+                for (size_t s = 0; s < q->len && nsel > 0; ++s) {
+                        struct u_query_stage *stage = &q->stages[s];
+                        struct view t;
+                        size_t k = 0;
+
+                        switch (stage->type) {
+                        case u_query_filter_stage:
+                                for (size_t i = 0; i < nsel; ++i) {
+                                        struct span sp = spans[sel[i]];
+                                        if (stage->pred(view.ptrs + sp.start,
+                                                        sp.n, stage->data))
+                                                sel[k++] = sel[i];
+                                }
+                                nsel = k;
+                                break;
+                        case u_query_project_stage:
+                                next.len = 0;
+                                for (size_t i = 0; i < nsel; ++i) {
+                                        struct span *sp = &spans[sel[i]];
+                                        size_t start = next.len;
+                                        for (size_t j = 0; j < stage->ncols;
+                                             ++j) {
+                                                size_t c = stage->cols[j];
+                                                push_ptr(&next, c < sp->n
+                                                         ? view.ptrs[sp->start
+                                                                     + c]
+                                                         : "");
+                                        }
+                                        sp->start = start;
+                                        sp->n = stage->ncols;
+                                }
+                                t = view, view = next, next = t;
+                                break;
+                        case u_query_derive_stage:
+                                u_csv_cells_clear(&derived[s]);
+                                for (size_t i = 0; i < nsel; ++i) {
+                                        struct span sp = spans[sel[i]];
+                                        struct u_csv_cells *d = &derived[s];
+                                        size_t offset = d->text.len;
+                                        U_STRING_EMPTY(out);
+                                        stage->derive(view.ptrs + sp.start,
+                                                      sp.n, &out, stage->data);
+                                        for (size_t j = 0; j < out.len; ++j)
+                                                U_ARRAY_PUSH(d->text, chars,
+                                                             out.str[j]);
+                                        U_ARRAY_PUSH(d->index, offsets, offset);
+                                        if (d->text.capacity == 0 ||
+                                            d->index.capacity == 0)
+                                                error(EXIT_FAILURE, errno,
+                                                      "Failed to allocate "
+                                                      "space for derived "
+                                                      "column.");
+                                }
+                                next.len = 0;
+                                for (size_t i = 0; i < nsel; ++i) {
+                                        struct span *sp = &spans[sel[i]];
+                                        size_t start = next.len;
+                                        for (size_t j = 0; j < sp->n; ++j)
+                                                push_ptr(&next,
+                                                         view.ptrs[sp->start +
+                                                                   j]);
+                                        push_ptr(&next,
+                                                 u_csv_cells_at(&derived[s],
+                                                                i));
+                                        sp->start = start;
+                                        sp->n++;
+                                }
+                                t = view, view = next, next = t;
+                                break;
+                        case u_query_sink_stage:
+                                for (size_t i = 0; i < nsel; ++i) {
+                                        struct span sp = spans[sel[i]];
+                                        stage->sink(view.ptrs + sp.start, sp.n,
+                                                    stage->data);
+                                }
+                                break;
+                        case u_query_write_stage:
+                                for (size_t i = 0; i < nsel; ++i) {
+                                        struct span sp = spans[sel[i]];
+                                        write_row(stage->f,
+                                                  view.ptrs + sp.start, sp.n);
+                                }
+                                break;
+                        case u_query_aggregate_stage:
+                                for (size_t i = 0; i < nsel; ++i) {
+                                        struct span sp = spans[sel[i]];
+                                        aggregate(stage, view.ptrs + sp.start,
+                                                  sp.n);
+                                }
+                                break;
+                        }
+                }
+                total += nsel;
+        }
+
+        for (size_t s = 0; s < q->len; ++s) {
+                if (q->stages[s].type == u_query_derive_stage)
+                        u_csv_cells_free(&derived[s]);
+                else if (q->stages[s].type == u_query_aggregate_stage)
+                        aggregate_end(&q->stages[s]);
+        }
+        U_STRING_FREE(out);
+        U_ARRAY_FREE(view, ptrs);
+        U_ARRAY_FREE(next, ptrs);
+        u_free(spans);
+        u_free(sel);
+        u_csv_cells_free(&cells);
+
+        return total;
+}
+
+/**
+   Frees a query. This doesn't close its file.
+
+   @param q Query to free
+ */
+
+void u_query_free(struct u_query *q)
+{
+        for (size_t s = 0; s < q->len; ++s)
+                u_free(q->stages[s].cols);
+        U_ARRAY_FREE(*q, stages);
+}
@@ -0,0 +1,193 @@
+/**
+   \file
+
+   \brief Definitions of pseudorandom number functions
+
+*/
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "useful/algorithms.h"
+#include "useful/random.h"
+
+/**
+   Number of threads whose default generator has been seeded.
+ */
+static atomic_uint_least64_t streams;
+
+static _Thread_local struct u_rng thread_rng;
+static _Thread_local bool thread_seeded;
+
+/**
+   Steps a SplitMix64 generator, which turns any seed, even 0, into well
+   mixed state.
+ */
+
+static uint64_t splitmix64(uint64_t *x)
+{
+        uint64_t z = (*x += UINT64_C(0x9e3779b97f4a7c15));
+        z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+        z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+        return z ^ (z >> 31);
+}
+
+/**
+   Seeds a generator. The same seed always gives the same numbers.
+
+   @param rng Generator to seed
+   @param seed Any number
+ */
+
+void u_rng_seed(struct u_rng *rng, uint64_t seed)
+{
+        for (size_t i = 0; i < 4; ++i)
+                rng->s[i] = splitmix64(&seed);
+}
+
+/**
+   Moves a generator ahead by the polynomial in poly, i.e. XORs together the
+   states it passes through where poly has a set bit.
+ */
+
+static void jump(struct u_rng *rng, const uint64_t poly[4])
+{
+        uint64_t s[4] = { 0, 0, 0, 0 };
+
+        for (size_t i = 0; i < 4; ++i)
+                for (int b = 0; b < 64; ++b) {
+                        if (poly[i] & UINT64_C(1) << b)
+                                for (size_t k = 0; k < 4; ++k)
+                                        s[k] ^= rng->s[k];
+                        u_rng_next(rng);
+                }
+        memcpy(rng->s, s, sizeof(s));
+}
+
+/**
+   Moves a generator 2^128 numbers ahead, as if u_rng_next() had been
+   called that many times. Use it to give threads streams that don't
+   overlap.
+
+   @param rng Generator to move
+ */
+
+void u_rng_jump(struct u_rng *rng)
+{
+        static const uint64_t j[4] = {
+                UINT64_C(0x180ec6d33cfd0aba), UINT64_C(0xd5a61266f0c9392c),
+                UINT64_C(0xa9582618e03fc9aa), UINT64_C(0x39abdc4529b1661c)
+        };
+        jump(rng, j);
+}
+
+/**
+   Moves a generator 2^192 numbers ahead, e.g. to give each machine a range
+   of streams that u_rng_jump() then splits between its threads.
+
+   @param rng Generator to move
+ */
+
+void u_rng_long_jump(struct u_rng *rng)
+{
+        static const uint64_t j[4] = {
+                UINT64_C(0x76e15d3efefdcbbf), UINT64_C(0xc5004e441c522fb3),
+                UINT64_C(0x77710069854ee241), UINT64_C(0x39109bb02acbe635)
+        };
+        jump(rng, j);
+}
+
+/**
+   Gets the calling thread's own generator, seeding it the first time. The
+   first thread to call this gets seed U_RNG_SEED, the next U_RNG_SEED + 1
+   and so on; call u_rng_seed() on it to choose another.
+
+   @return The generator, which only the calling thread may use
+ */
+
+struct u_rng *u_rng_default(void)
+{
+        if (!thread_seeded) {
+                uint64_t n = atomic_fetch_add_explicit(&streams, 1,
+                                                       memory_order_relaxed);
+                u_rng_seed(&thread_rng, U_RNG_SEED + n);
+                thread_seeded = true;
+        }
+        return &thread_rng;
+}
+
+/**
+   Fills an array with random 64-bit numbers.
+
+   @param rng Generator to draw from
+   @param out Array to fill
+   @param n Number of elements
+ */
+
+void u_rng_fill(struct u_rng *rng, uint64_t *out, size_t n)
+{
+        struct u_rng r = *rng;
+
+        for (size_t i = 0; i < n; ++i)
+                out[i] = u_rng_next(&r);
+        *rng = r;
+}
+
+/**
+   Fills an array with doubles drawn uniformly from [0, 1).
+
+   @param rng Generator to draw from
+   @param out Array to fill
+   @param n Number of elements
+ */
+
+void u_rng_fill_doubles(struct u_rng *rng, double *out, size_t n)
+{
+        struct u_rng r = *rng;
+
+        for (size_t i = 0; i < n; ++i)
+                out[i] = u_rng_double(&r);
+        *rng = r;
+}
+
+/**
+   Fills memory with random bytes.
+
+   @param rng Generator to draw from
+   @param out Memory to fill
+   @param n Number of bytes
+ */
+
+void u_rng_fill_bytes(struct u_rng *rng, void *out, size_t n)
+{
+        struct u_rng r = *rng;
+        unsigned char *p = out;
+        uint64_t x;
+
+        for (; n >= sizeof(x); n -= sizeof(x), p += sizeof(x)) {
+                x = u_rng_next(&r);
+                memcpy(p, &x, sizeof(x));
+        }
+        if (n) {
+                x = u_rng_next(&r);
+                memcpy(p, &x, n);
+        }
+        *rng = r;
+}
+
+/**
+   Shuffles an array so that every order is equally likely (Fisher-Yates).
+
+   @param rng Generator to draw from
+   @param data Array to shuffle
+   @param nmemb Number of elements in the array
+   @param size Size of an element in chars (or bytes)
+ */
+
+void u_rng_shuffle(struct u_rng *rng, void *data, size_t nmemb, size_t size)
+{
+        for (size_t i = nmemb; i-- > 1;) {
+                size_t j = u_rng_below(rng, i + 1);
+                u_swap(U_VOS(data, i, size), U_VOS(data, j, size), size);
+        }
+}
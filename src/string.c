@@ -1,19 +1,158 @@
 #include <stdarg.h>
 #include <errno.h>
+#include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include "useful/string.h"
 
 /**
- * Copies src string to dest.
+ * Makes room in a string for n chars, including the null terminator, growing
+ * its capacity by at least U_GROWTH so that repeated appends are cheap.
+ *
+ * \param dest String to grow
+ * \param n Number of chars
+ *
+ * \return true, or false with errno set if memory runs out, leaving dest
+ * unchanged
+ */
+bool u_string_reserve(struct u_string *dest, size_t n)
+{
+        if (n <= dest->capacity)
+                return true;
+        size_t capacity = u_array_next_capacity(dest->capacity, n, 1);
+        if (dest->allocator == NULL)
+                dest->allocator = u_allocator_get();
+        char *s = capacity ? u_realloc_with(dest->allocator, dest->str,
+                                            capacity) : NULL;
+        if (s == NULL) {
+                errno = ENOMEM;
+                return false;
+        }
+        dest->str = s;
+        dest->capacity = capacity;
+        return true;
+}
+
+/**
+ * Checks if p points into the buffer of a string.
+ */
+static inline bool inside(const struct u_string *string, const char *p)
+{
+        uintptr_t b = (uintptr_t) string->str, q = (uintptr_t) p;
+        return string->str != NULL && q >= b && q < b + string->capacity;
+}
+
+/**
+ * Appends n chars to a string, growing it at most once.
+ *
+ * \param dest String to append to
+ * \param src Chars to append. They may be part of dest itself.
+ * \param n Number of chars to append
+ *
+ * \return true, or false with errno set if memory runs out, leaving dest
+ * unchanged
+ */
+bool u_string_append(struct u_string *dest, const char *src, size_t n)
+{
+        size_t end = dest->len ? dest->len - 1 : 0;
+        if (n >= SIZE_MAX - end) {
+                errno = ENOMEM;
+                return false;
+        }
+        if (inside(dest, src)) {
+                size_t offset = src - dest->str;
+                if (!u_string_reserve(dest, end + n + 1))
+                        return false;
+                src = dest->str + offset;
+        } else if (!u_string_reserve(dest, end + n + 1)) {
+                return false;
+        }
+        memmove(dest->str + end, src, n);
+        dest->str[end + n] = '\0';
+        dest->len = end + n + 1;
+        return true;
+}
+
+/**
+ * Appends one string to another.
+ *
+ * \param dest String to append to
+ * \param src String to append. It may be dest itself.
+ *
+ * \return true, or false with errno set if memory runs out, leaving dest
+ * unchanged
  */
-static inline void copy(struct u_string *dest, const char *src)
+bool u_string_append_string(struct u_string *dest, const struct u_string *src)
 {
-        const char *s = src;
-        do {
-                U_ARRAY_PUSH(*dest, str, *s);
-        } while (errno == 0 && *s++ != 0);
+        return u_string_append(dest, src->str, src->len ? src->len - 1 : 0);
+}
+
+/**
+ * Replaces n chars of a string, starting at index, with m other chars,
+ * moving the rest of the string once.
+ *
+ * \param dest String to change
+ * \param index Index of the first char to replace, at most the length of
+ * the string (not counting the null terminator)
+ * \param n Number of chars to replace. The replaced range stops at the end
+ * of the string.
+ * \param src Chars to put in their place. They may be part of dest itself.
+ * \param m Number of chars to put in their place
+ *
+ * \return true, or false with errno set if memory runs out, leaving dest
+ * unchanged
+ */
+bool u_string_replace(struct u_string *dest, size_t index, size_t n,
+                      const char *src, size_t m)
+{
+        size_t end = dest->len ? dest->len - 1 : 0;
+        assert(index <= end);
+        if (n > end - index)
+                n = end - index;
+        if (m > n && m - n >= SIZE_MAX - end) {
+                errno = ENOMEM;
+                return false;
+        }
+        if (m > 0 && inside(dest, src)) {
+                /* src would move under our feet, so work from a copy */
+                char *copy = u_alloc(m);
+                if (copy == NULL)
+                        return false;
+                memcpy(copy, src, m);
+                bool ok = u_string_replace(dest, index, n, copy, m);
+                u_free(copy);
+                return ok;
+        }
+        size_t len = end - n + m + 1;
+        if (!u_string_reserve(dest, len))
+                return false;
+        memmove(dest->str + index + m, dest->str + index + n,
+                end - index - n);
+        if (m > 0)
+                memcpy(dest->str + index, src, m);
+        dest->str[len - 1] = '\0';
+        dest->len = len;
+        return true;
+}
+
+/**
+ * Inserts n chars into a string.
+ *
+ * \param dest String to insert into
+ * \param index Index at which to insert, at most the length of the string
+ * (not counting the null terminator)
+ * \param src Chars to insert. They may be part of dest itself.
+ * \param n Number of chars to insert
+ *
+ * \return true, or false with errno set if memory runs out, leaving dest
+ * unchanged
+ */
+bool u_string_insert(struct u_string *dest, size_t index, const char *src,
+                     size_t n)
+{
+        return u_string_replace(dest, index, 0, src, n);
 }
 
 /**
@@ -24,8 +163,7 @@ static inline void copy(struct u_string *dest, const char *src)
  */
 void u_strcat(struct u_string *dest, const char *src)
 {
-        --dest->len;            // pop the end of string marker
-        copy(dest, src);
+        u_string_append(dest, src, strlen(src));
 }
 
 /**
@@ -36,55 +174,137 @@ void u_strcat(struct u_string *dest, const char *src)
  */
 void u_strcpy(struct u_string *dest, const char *src)
 {
-        dest->len = 0;          // empty the string
-        copy(dest, src);
+        size_t n = strlen(src) + 1;
+        if (u_string_reserve(dest, n)) {
+                memmove(dest->str, src, n);
+                dest->len = n;
+        }
+}
+
+/**
+ * Most chars read by one call of fgets() in u_fgets(), which bounds the
+ * memory filled before each call however large dest has grown.
+ */
+#define FGETS_CHUNK 4096
+
+/**
+ * Reads with fgets() into buf, which holds size chars, and returns the
+ * number of chars read, null chars included, or 0 at end of file. fgets()
+ * doesn't say how many it read, so buf is first filled with newlines: the
+ * first newline left in buf is either the last char read, followed by the
+ * null fgets() adds, or the one after that null.
+ */
+static size_t fgets_len(char *buf, size_t size, FILE *file, bool *newline)
+{
+        memset(buf, '\n', size);
+        *newline = false;
+        if (fgets(buf, (int)size, file) == NULL)
+                return 0;
+        char *p = memchr(buf, '\n', size);
+        if (p == NULL)
+                return size - 1;
+        if (p + 1 < buf + size && p[1] == '\0') {
+                *newline = true;
+                return p + 1 - buf;
+        }
+        return p - 1 - buf;
 }
 
 /**
  * Implements the stdlib fgets function, in addition taking care of memory.
+ * The line is read with fgets() straight into the free capacity of dest,
+ * which grows until the whole line fits. The line may hold null chars, so
+ * its length is dest->len - 1. To read large files a line at a time,
+ * struct u_lines (see lines.h) is faster still.
  *
- * \param dest String in which to store line from file
+ * \param dest String whose contents are replaced by the line from file,
+ * including its newline if it has one
  * \param file File to read next line from
  *
- * \return Upon success the null-terminated string, dest->str else NULL
+ * \return Upon success the null-terminated string, dest->str, else NULL if
+ * there are no more lines, reading fails or memory runs out
  */
 char *u_fgets(struct u_string *dest, FILE * file)
 {
-        char c;
-        size_t i = 0;
-        while ((c = getc(file)) != EOF && errno == 0) {
-                U_ARRAY_PUSH(*dest, str, c);
-                i++;
-                if (c == '\n')
+        size_t len = 0;
+        bool newline = false;
+        while (!newline) {
+                if (!u_string_reserve(dest, len + 2))
+                        return NULL;
+                size_t room = dest->capacity - len;
+                if (room > FGETS_CHUNK)
+                        room = FGETS_CHUNK;
+                size_t n = fgets_len(dest->str + len, room, file, &newline);
+                if (n == 0)
                         break;
+                len += n;
         }
-        if (errno == 0) {
-                U_ARRAY_PUSH(*dest, str, '\0');
-                if (i > 0) {
-                        return dest->str;
-                } else {
-                        return NULL;
-                }
+        dest->str[len] = '\0';
+        dest->len = len + 1;
+        return len && !ferror(file) ? dest->str : NULL;
+}
+
+/**
+ * Formats onto the end of a string. The output goes straight into the free
+ * capacity of dest, and only if it doesn't fit is dest grown and the output
+ * formatted again. The arguments mustn't point into dest, so this is only
+ * for the typed appenders below.
+ */
+static int print_tail(struct u_string *dest, const char *fmt, ...)
+{
+        size_t at = dest->len ? dest->len - 1 : 0;
+        va_list ap, ap2;
+        va_start(ap, fmt);
+        va_copy(ap2, ap);
+        size_t room = dest->capacity > at ? dest->capacity - at : 0;
+        int n = vsnprintf(room ? dest->str + at : NULL, room, fmt, ap);
+        if (n >= 0 && (size_t)n >= room) {
+                if (!u_string_reserve(dest, at + n + 1))
+                        n = -1;
+                else
+                        vsnprintf(dest->str + at, n + 1, fmt, ap2);
+        }
+        va_end(ap2);
+        va_end(ap);
+        if (n < 0) {
+                if (room)
+                        dest->str[at] = '\0';
+                return -1;
         }
-        return NULL;
+        dest->len = at + n + 1;
+        return n;
 }
 
-static int u_vsprintf(struct u_string *dest, const char *fmt, va_list ap)
+/**
+ * Formats into a string from index at on, replacing whatever follows. Short
+ * output is formatted into a buffer on the stack and long output into a
+ * temporary one, and only then copied into dest, so the arguments may point
+ * into dest. On failure dest is left unchanged.
+ */
+static int vprint_at(struct u_string *dest, size_t at, const char *fmt,
+                     va_list ap)
 {
+        char buf[256], *out = buf;
         va_list ap2;
         va_copy(ap2, ap);
-        int i = vsnprintf(NULL, 0, fmt, ap) + 1;
-        if (i >= dest->capacity) {
-                size_t j =
-                    u_array_grow((void *)&dest->str, i * sizeof(*dest->str), i);
-                if (j == 0)
-                        return -1;
-                dest->capacity = j;
-        }
-        i = vsnprintf(dest->str, dest->capacity - 1, fmt, ap2);
-        dest->len = strlen(dest->str) + 1;
+        int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+        if (n >= 0 && (size_t)n >= sizeof(buf)) {
+                out = u_alloc((size_t)n + 1);
+                if (out == NULL)
+                        n = -1;
+                else
+                        vsnprintf(out, (size_t)n + 1, fmt, ap2);
+        }
         va_end(ap2);
-        return i;
+        if (n >= 0 && !u_string_reserve(dest, at + n + 1))
+                n = -1;
+        if (n >= 0) {
+                memcpy(dest->str + at, out, (size_t)n + 1);
+                dest->len = at + n + 1;
+        }
+        if (out != buf)
+                u_free(out);
+        return n;
 }
 
 /**
@@ -101,14 +321,15 @@ int u_sprintf(struct u_string *dest, const char *fmt, ...)
 {
         va_list ap;
         va_start(ap, fmt);
-        int i = u_vsprintf(dest, fmt, ap);
+        int i = vprint_at(dest, 0, fmt, ap);
         va_end(ap);
         return i;
 }
 
 /**
  * Combines sprinttf and concat operations, taking care of memory. This function
- * prints a string to the end of another string.
+ * prints a string to the end of another string. Output that fits in a small
+ * buffer on the stack needs no allocation unless dest must grow.
  *
  * \param dest String in which to place output
  * \param fmt String that specifies format - see sprintf for details
@@ -121,17 +342,99 @@ int u_sprintf_cat(struct u_string *dest, const char *fmt, ...)
 {
         va_list ap;
         va_start(ap, fmt);
-
-        U_STRING(t);
-        int i = u_vsprintf(&t, fmt, ap);
-        if (errno == 0)
-                u_strcat(dest, t.str);
-        else
-                i = -1;
-        U_STRING_FREE(t);
+        int i = vprint_at(dest, dest->len ? dest->len - 1 : 0, fmt, ap);
+        va_end(ap);
         return i;
 }
 
+/**
+ * Writes the digits of x backwards, two at a time, ending just before end.
+ *
+ * \return Pointer to the first digit
+ */
+static char *utoa_rev(unsigned long long x, char *end)
+{
+        static const char pairs[] =
+            "00010203040506070809101112131415161718192021222324252627282930"
+            "31323334353637383940414243444546474849505152535455565758596061"
+            "62636465666768697071727374757677787980818283848586878889909192"
+            "93949596979899";
+        while (x >= 100) {
+                unsigned k = 2 * (x % 100);
+                x /= 100;
+                *--end = pairs[k + 1];
+                *--end = pairs[k];
+        }
+        if (x >= 10) {
+                *--end = pairs[2 * x + 1];
+                *--end = pairs[2 * x];
+        } else {
+                *--end = '0' + x;
+        }
+        return end;
+}
+
+/**
+ * Appends an unsigned integer in decimal, like u_sprintf_cat(dest, "%llu",
+ * x) but without parsing a format.
+ *
+ * \param dest String to append to
+ * \param x Integer to append
+ *
+ * \return true, or false with errno set if memory runs out
+ */
+bool u_string_append_uint(struct u_string *dest, unsigned long long x)
+{
+        char buf[24], *end = buf + sizeof(buf);
+        char *s = utoa_rev(x, end);
+        return u_string_append(dest, s, end - s);
+}
+
+/**
+ * Appends an integer in decimal, like u_sprintf_cat(dest, "%lld", x) but
+ * without parsing a format.
+ *
+ * \param dest String to append to
+ * \param x Integer to append
+ *
+ * \return true, or false with errno set if memory runs out
+ */
+bool u_string_append_int(struct u_string *dest, long long x)
+{
+        char buf[24], *end = buf + sizeof(buf);
+        unsigned long long u = x;
+        char *s = utoa_rev(x < 0 ? -u : u, end);
+        if (x < 0)
+                *--s = '-';
+        return u_string_append(dest, s, end - s);
+}
+
+/**
+ * Appends a double like u_sprintf_cat(dest, "%.*g", precision, x). Whole
+ * numbers with at most precision digits, the usual case for counts and ids
+ * read from CSV files, are converted as integers without calling printf.
+ *
+ * \param dest String to append to
+ * \param x Number to append
+ * \param precision Number of significant digits, as for %g
+ *
+ * \return true, or false with errno set if memory runs out
+ */
+bool u_string_append_double(struct u_string *dest, double x, int precision)
+{
+        static const double limits[] = {
+                1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                1e11, 1e12, 1e13, 1e14, 1e15
+        };
+        int p = precision < 0 ? 6 : precision == 0 ? 1 : precision;
+        if (p > 15)
+                p = 15;
+        if (fabs(x) < limits[p] && x == (long long)x &&
+            !(x == 0 && signbit(x)))
+                return u_string_append_int(dest, (long long)x);
+        return print_tail(dest, "%.*g", precision, x) >= 0;
+}
+
 /**
  * Appends a character to the end of a string, taking care of memory.
  *
@@ -140,9 +443,8 @@ int u_sprintf_cat(struct u_string *dest, const char *fmt, ...)
  */
 void u_pushchar(struct u_string *dest, char c)
 {
-        dest->str[dest->len - 1] = c;
         if (c != '\0')
-                U_ARRAY_PUSH(*dest, str, '\0');
+                u_string_append(dest, &c, 1);
 }
 
 /**
@@ -158,23 +460,122 @@ void u_pushchar(struct u_string *dest, char c)
 struct u_string u_substr(const struct u_string *string, size_t index, size_t n)
 {
         U_STRING(result);
-        for (size_t i = index; i < string->len && i < index + n && errno == 0;
-             i++)
-                u_pushchar(&result, string->str[i]);
-        if (result.str[result.len - 1] != '\0' && errno == 0)
-                u_pushchar(&result, '\0');
+        if (index < string->len && result.capacity) {
+                const char *s = string->str + index;
+                size_t max = string->len - index;
+                if (n > max)
+                        n = max;
+                const char *z = memchr(s, '\0', n);
+                u_string_append(&result, s, z ? (size_t)(z - s) : n);
+        }
         return result;
 }
 
 /**
- * Checks if a character is in a set of delimiters.
+ * Makes a view of a whole null-terminated string.
+ *
+ * \param s String to view
+ *
+ * \return View of the chars of s, without the null terminator
+ */
+struct u_string_view u_string_view_of(const char *s)
+{
+        struct u_string_view v = { s, strlen(s) };
+        return v;
+}
+
+/**
+ * Makes a view of the contents of a struct u_string.
+ *
+ * \param s String to view
+ *
+ * \return View of the chars of s, without the null terminator
+ */
+struct u_string_view u_string_view_of_string(const struct u_string *s)
+{
+        struct u_string_view v = { s->str, s->len ? s->len - 1 : 0 };
+        return v;
+}
+
+/**
+ * Checks if two views hold the same chars.
+ *
+ * \param a View to compare
+ * \param b View to compare
+ *
+ * \return true if they are equal, else false
  */
-static inline bool in(const char *delims, char c)
+bool u_string_view_equal(struct u_string_view a, struct u_string_view b)
 {
-        for (const char *s = delims; *s != '\0'; s++)
-                if (c == *s)
-                        return true;
-        return false;
+        return a.len == b.len && (a.len == 0 || !memcmp(a.str, b.str, a.len));
+}
+
+/**
+ * Makes a set of delimiters.
+ *
+ * \param d Set to initialize
+ * \param delims Null-terminated string of the delimiter chars
+ */
+void u_delims_init(struct u_delims *d, const char *delims)
+{
+        memset(d->bits, 0, sizeof(d->bits));
+        for (const unsigned char *s = (const unsigned char *)delims; *s; ++s)
+                d->bits[*s >> 6] |= UINT64_C(1) << (*s & 63);
+}
+
+/**
+ * Starts iterating over the tokens of a string: the runs of chars that
+ * aren't delimiters. Tokens are never empty. Neither the string nor the
+ * delimiters are copied, so the string must outlive the iteration.
+ *
+ * \param it Iterator to initialize
+ * \param str String to split. It needn't be null terminated.
+ * \param len Number of chars of str to split
+ * \param delims Null-terminated string of the chars that separate tokens
+ */
+void u_split_init(struct u_split *it, const char *str, size_t len,
+                  const char *delims)
+{
+        it->pos = str;
+        it->end = str + len;
+        it->single = delims[0] != '\0' && delims[1] == '\0' ?
+            (unsigned char)delims[0] : -1;
+        u_delims_init(&it->delims, delims);
+}
+
+/**
+ * Gets the next token of a string. With a single delimiter the end of the
+ * token is found with memchr(), otherwise each char is looked up in the
+ * delimiter set.
+ *
+ * \param it Iterator from u_split_init()
+ * \param token Where to store a view of the token
+ *
+ * \return true if there was a token, false at the end of the string
+ */
+bool u_split_next(struct u_split *it, struct u_string_view *token)
+{
+        const char *p = it->pos, *end = it->end;
+        while (p < end && u_delims_has(&it->delims, *p))
+                ++p;
+        if (p == end) {
+                it->pos = p;
+                return false;
+        }
+        const char *q;
+        if (it->single >= 0) {
+                q = memchr(p, it->single, end - p);
+                if (q == NULL)
+                        q = end;
+        } else {
+                q = p + 1;
+                while (q < end && !u_delims_has(&it->delims, *q))
+                        ++q;
+        }
+        token->str = p;
+        token->len = q - p;
+        it->pos = q;
+        return true;
 }
 
 /**
@@ -190,28 +591,32 @@ struct u_string_array u_string_split(const char *string_to_split,
                                      const char *delims)
 {
         struct u_string_array result;
+        struct u_split it;
+        struct u_string_view tok;
+
         U_ARRAY(result, strings);
-        U_STRING(string);
-        for (const char *s = string_to_split; errno == 0; s++) {
-                if (in(delims, *s) || *s == '\0') {
-                        if (strlen(string.str) > 0) {
-                                U_STRING(new_elem);
-                                u_strcpy(&new_elem, string.str);
-                                U_ARRAY_PUSH(result, strings, new_elem);
-                                U_STRING_EMPTY(string);
-                        }
-                        if (*s == '\0')
-                                break;
-                } else {
-                        u_pushchar(&string, *s);
-                }
+        u_split_init(&it, string_to_split, strlen(string_to_split), delims);
+        while (errno == 0 && u_split_next(&it, &tok)) {
+                struct u_string new_elem = { 0, 0, NULL, NULL };
+                if (!u_string_append(&new_elem, tok.str, tok.len))
+                        break;
+                U_ARRAY_PUSH(result, strings, new_elem);
         }
-        U_STRING_FREE(string);
         return result;
 }
 
 /**
- * Concatenates an array of strings into a single string.
+ * Length of a string, not counting its null terminator.
+ */
+static inline size_t length(const struct u_string *string)
+{
+        return string->len ? string->len - 1 : 0;
+}
+
+/**
+ * Concatenates an array of strings into a single string. The length of the
+ * result is worked out first, so it is allocated once and each member is
+ * copied once with memcpy.
 
  * \param array Array of strings to join
  * \param delim Delimiter to between each concatenated string
@@ -220,26 +625,153 @@ struct u_string_array u_string_split(const char *string_to_split,
  */
 struct u_string u_join(const struct u_string_array *array, const char *delim)
 {
-        U_STRING(result);
+        struct u_string result = { 0, 0, NULL, NULL };
+        size_t d = strlen(delim), total = 1;
+
         for (size_t i = 0; i < array->len; ++i) {
-                u_strcat(&result, array->strings[i].str);
-                if (i + 1 < array->len)
-                        u_strcat(&result, delim);
+                size_t add = length(&array->strings[i]) + (i ? d : 0);
+                if (add > SIZE_MAX - total) {
+                        errno = ENOMEM;
+                        return result;
+                }
+                total += add;
         }
+        if (!u_string_reserve(&result, total))
+                return result;
+        char *p = result.str;
+        for (size_t i = 0; i < array->len; ++i) {
+                if (i) {
+                        memcpy(p, delim, d);
+                        p += d;
+                }
+                size_t len = length(&array->strings[i]);
+                memcpy(p, array->strings[i].str, len);
+                p += len;
+        }
+        *p = '\0';
+        result.len = total;
         return result;
 }
 
+/**
+ * Converts the elements of an array to strings with conv and joins them.
+ * The converted strings are kept until the length of the result is known,
+ * so the result is allocated once. Use u_join_write() to join without
+ * allocating a string per element.
+ *
+ * \param n Number of elements
+ * \param bytes Size of each element
+ * \param array Elements to join
+ * \param delim Delimiter to put between each converted element
+ * \param conv Function converting a pointer to an element to a string
+ * \param free_str Whether to free() the strings returned by conv, which must
+ * then come from malloc() or strdup() whatever the thread's allocator is
+ *
+ * \return A u_string with the converted elements
+ */
 struct u_string u_join_conv(size_t n, size_t bytes, const void *array,
                             const char *delim, char *(*conv)(const void *), bool free_str)
+{
+        struct u_string_array strs = { n, n, NULL };
+        struct u_string result = { 0, 0, NULL, NULL };
+        const char *a = array;
+
+        if (n > SIZE_MAX / sizeof(*strs.strings)) {
+                errno = ENOMEM;
+                return result;
+        }
+        strs.strings = u_alloc(n ? n * sizeof(*strs.strings) : 1);
+        if (strs.strings == NULL)
+                return result;
+        for (size_t i = 0; i < n; ++i) {
+                strs.strings[i].str = conv(a + i * bytes);
+                strs.strings[i].len = strlen(strs.strings[i].str) + 1;
+        }
+        result = u_join(&strs, delim);
+        if (free_str)
+                for (size_t i = 0; i < n; ++i)
+                        free(strs.strings[i].str);
+        u_free(strs.strings);
+        return result;
+}
+
+/**
+ * Converts the elements of an array straight into the result and joins them,
+ * allocating nothing but the result. conv works like snprintf(): it writes
+ * at most size chars, including a null terminator, to buf and returns the
+ * length of the whole conversion. If that didn't fit, the result is grown
+ * and conv is called again. u_write_int() and u_write_double() are ready
+ * made converters.
+ *
+ * \param n Number of elements
+ * \param bytes Size of each element
+ * \param array Elements to join
+ * \param delim Delimiter to put between each converted element
+ * \param conv Function converting an element into a buffer
+ *
+ * \return A u_string with the converted elements
+ */
+struct u_string u_join_write(size_t n, size_t bytes, const void *array,
+                             const char *delim,
+                             size_t (*conv)(char *buf, size_t size,
+                                            const void *elem))
 {
         U_STRING(result);
-        size_t e = n * bytes;
-        for (size_t i = 0; i < e; i += bytes) {
-                char *s = conv(array + i);
-                u_strcat(&result, s);
-                if (i + bytes < e)
-                        u_strcat(&result, delim);
-                if (free_str) free(s);
+        const char *a = array;
+        size_t d = strlen(delim);
+
+        for (size_t i = 0; i < n && result.capacity; ++i) {
+                if (i && !u_string_append(&result, delim, d))
+                        break;
+                size_t end = result.len - 1;
+                size_t room = result.capacity - end;
+                size_t len = conv(result.str + end, room, a + i * bytes);
+                if (len >= room) {
+                        if (len >= SIZE_MAX - end) {
+                                errno = ENOMEM;
+                                break;
+                        }
+                        if (!u_string_reserve(&result, end + len + 1))
+                                break;
+                        conv(result.str + end, len + 1, a + i * bytes);
+                }
+                result.len = end + len + 1;
         }
+        if (result.capacity)
+                result.str[result.len - 1] = '\0';
         return result;
 }
+
+/**
+ * Converter for u_join_write() that writes an int in decimal.
+ */
+size_t u_write_int(char *buf, size_t size, const void *elem)
+{
+        char tmp[24], *end = tmp + sizeof(tmp);
+        int x = *(const int *)elem;
+        unsigned long long u = x;
+        char *s = utoa_rev(x < 0 ? -u : u, end);
+        if (x < 0)
+                *--s = '-';
+        size_t len = end - s;
+        if (len < size) {
+                memcpy(buf, s, len);
+                buf[len] = '\0';
+        }
+        return len;
+}
+
+/**
+ * Converter for u_join_write() that writes a double like "%g" would, with
+ * whole numbers converted as integers.
+ */
+size_t u_write_double(char *buf, size_t size, const void *elem)
+{
+        double x = *(const double *)elem;
+        if (fabs(x) < 1e6 && x == (long long)x && !(x == 0 && signbit(x))) {
+                int i = x;
+                return u_write_int(buf, size, &i);
+        }
+        int len = snprintf(buf, size, "%g", x);
+        return len < 0 ? 0 : len;
+}
@@ -0,0 +1,396 @@
+/**
+   \file
+
+   \brief Definitions of functions for following growing CSV files
+
+*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "useful/tail.h"
+
+/**
+   Receives each complete row parsed by parse().
+ */
+typedef void (*add_func) (void *dest, const struct u_csv_cells * cells,
+                          size_t n, bool header);
+
+/**
+   Events of the followed file that wake u_csv_tail_wait().
+ */
+#define FILE_EVENTS (IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF)
+
+/**
+   Events of its directory that wake u_csv_tail_wait(): a file being created
+   or moved there, as when a log is rotated.
+ */
+#define DIR_EVENTS (IN_CREATE | IN_MOVED_TO)
+
+/**
+   Starts watching the file and its directory with inotify, leaving
+   watch_fd -1 if it can't.
+ */
+
+static void watch(struct u_csv_tail *tail)
+{
+#ifdef __linux__
+        const char *slash = strrchr(tail->path, '/');
+        size_t n = slash == NULL || slash == tail->path ? 1 :
+            (size_t)(slash - tail->path);
+        char dir[n + 1];
+
+        if (slash == NULL)
+                dir[0] = '.';
+        else
+                memcpy(dir, tail->path, n);
+        dir[n] = '\0';
+        tail->watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (tail->watch_fd < 0)
+                return;
+        if (inotify_add_watch(tail->watch_fd, dir, DIR_EVENTS) < 0) {
+                close(tail->watch_fd);
+                tail->watch_fd = -1;
+                return;
+        }
+        tail->file_wd = inotify_add_watch(tail->watch_fd, tail->path,
+                                          FILE_EVENTS);
+#else
+        (void)tail;
+#endif
+}
+
+/**
+   Opens a CSV file to follow.
+
+   @param path Name of the file
+   @param header Whether the file starts with a header
+   @param delim The CSV file delimiter, usually a comma
+   @param offset Byte offset to start reading from, e.g. ftell() of a stream
+   that has already been read by u_csv_read(). If it isn't 0 the header, if
+   any, is assumed to have been read already.
+
+   @return Structure to pass to u_csv_tail_poll(). If the file can't be opened
+   its fd is -1 and errno is set, and polls open it once it exists. Close it
+   with u_csv_tail_close().
+ */
+
+struct u_csv_tail u_csv_tail_open(const char *path, bool header, char delim,
+                                  off_t offset)
+{
+        struct u_csv_tail tail = {
+                .watch_fd = -1,
+                .file_wd = -1,
+                .offset = offset,
+                .header = header,
+                .skip_header = header && offset == 0,
+                .delim = delim,
+        };
+        if (NULL == (tail.path = u_strdup(path)))
+                error(EXIT_FAILURE, errno,
+                      "Failed to allocate space for file name.");
+        // Watch before opening, so that no change after the open is missed
+        watch(&tail);
+        tail.fd = open(path, O_RDONLY | O_CLOEXEC);
+        return tail;
+}
+
+/**
+   Forgets everything read, to read the file again from the start.
+ */
+
+static void restart(struct u_csv_tail *tail)
+{
+        tail->offset = 0;
+        tail->len = tail->scanned = tail->complete = 0;
+        tail->inquote = false;
+        tail->skip_header = tail->header;
+}
+
+/**
+   Checks if the file's name now belongs to another file than the one being
+   read, e.g. because it was rotated, or to a file at all if none was open.
+ */
+
+static bool replaced(const struct u_csv_tail *tail)
+{
+        struct stat now, st;
+
+        if (stat(tail->path, &now))
+                return false;
+        return tail->fd < 0 || fstat(tail->fd, &st) ||
+            st.st_dev != now.st_dev || st.st_ino != now.st_ino;
+}
+
+/**
+   Switches to the file that now has the name, reading it from the start.
+ */
+
+static void reopen(struct u_csv_tail *tail)
+{
+        int fd = open(tail->path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+                return;
+        if (tail->fd >= 0)
+                close(tail->fd);
+        tail->fd = fd;
+        restart(tail);
+#ifdef __linux__
+        if (tail->watch_fd >= 0) {
+                if (tail->file_wd >= 0)
+                        inotify_rm_watch(tail->watch_fd, tail->file_wd);
+                tail->file_wd = inotify_add_watch(tail->watch_fd, tail->path,
+                                                  FILE_EVENTS);
+        }
+#endif
+}
+
+/**
+   Reads everything appended to the file since the last call and finds the
+   end of the last complete row. A newline only ends a row outside quotes; a
+   doubled quote inside quotes toggles the state twice, leaving it unchanged.
+ */
+
+static bool read_new(struct u_csv_tail *tail)
+{
+        struct stat st;
+
+        if (fstat(tail->fd, &st))
+                return false;
+        if (st.st_size < tail->offset)
+                restart(tail);
+
+        for (;;) {
+                while (tail->capacity - tail->len < U_TAIL_CHUNK) {
+                        tail->capacity = u_array_grow((void **)&tail->pending,
+                                                      tail->capacity, 1);
+                        if (tail->capacity == 0)
+                                error(EXIT_FAILURE, errno,
+                                      "Failed to allocate space for "
+                                      "file contents.");
+                }
+                ssize_t n = pread(tail->fd, tail->pending + tail->len,
+                                  tail->capacity - tail->len, tail->offset);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n < 0)
+                        return false;
+                if (n == 0)
+                        break;
+                tail->len += n;
+                tail->offset += n;
+        }
+
+        for (; tail->scanned < tail->len; ++tail->scanned) {
+                char c = tail->pending[tail->scanned];
+                if (c == '"')
+                        tail->inquote = !tail->inquote;
+                else if (c == '\n' && !tail->inquote)
+                        tail->complete = tail->scanned + 1;
+        }
+        return true;
+}
+
+/**
+   Parses the complete rows in the pending buffer, passes them to add, and
+   keeps only the incomplete remainder.
+ */
+
+static size_t parse(struct u_csv_tail *tail, add_func add, void *dest)
+{
+        struct u_csv_cells cells;
+        size_t rows = 0;
+        FILE *f;
+
+        if (tail->complete == 0)
+                return 0;
+        if (NULL == (f = fmemopen(tail->pending, tail->complete, "r")))
+                error(EXIT_FAILURE, errno, "Failed to open row buffer.");
+
+        cells = u_csv_cells_new();
+        for (;;) {
+                u_csv_cells_clear(&cells);
+                size_t n = u_csv_read_cells(f, tail->delim, &cells);
+                if (n == 0) {
+                        if (feof(f))
+                                break;
+                        continue;       // blank line
+                }
+                add(dest, &cells, n, tail->skip_header);
+                if (tail->skip_header)
+                        tail->skip_header = false;
+                else
+                        ++rows;
+        }
+        u_csv_cells_free(&cells);
+        fclose(f);
+
+        memmove(tail->pending, tail->pending + tail->complete,
+                tail->len - tail->complete);
+        tail->len -= tail->complete;
+        tail->scanned -= tail->complete;
+        tail->complete = 0;
+        return rows;
+}
+
+static void add_csv(void *dest, const struct u_csv_cells *cells, size_t n,
+                    bool header)
+{
+        struct u_csv *cs = dest;
+        const char *strings[n];
+
+        if (header && cs->header.len > 0)
+                return;
+        for (size_t i = 0; i < n; ++i)
+                strings[i] = u_csv_cells_at(cells, i);
+        u_csv_append(cs, strings, n);
+        if (header) {
+                u_free_with(cs->allocator, cs->header.cells);
+                cs->header = cs->rows[--cs->len];
+        }
+}
+
+static void add_dataframe(void *dest, const struct u_csv_cells *cells,
+                          size_t n, bool header)
+{
+        struct u_dataframe *df = dest;
+        union u_str_dbl vals[df->cols];
+        bool na[df->cols];
+
+        if (header)
+                return;
+        for (size_t i = 0; i < df->cols; ++i) {
+                const char *s = i < n ? u_csv_cells_at(cells, i) : NULL;
+                na[i] = false;
+                if (df->type[i] == str)
+                        vals[i].str = (char *)s;
+                else
+                        na[i] = !u_csv_parse_dbl(s, &vals[i].dbl);
+        }
+        u_dataframe_append(df, vals);
+        for (size_t i = 0; i < df->cols; ++i)
+                if (na[i])
+                        u_dataframe_set_na(df, df->rows - 1, i);
+}
+
+/**
+   Passes the rows added to the file since the last poll to add. If another
+   file has taken its name, the rest of the old file is read first, and any
+   incomplete row at its end is dropped.
+ */
+
+static size_t poll_rows(struct u_csv_tail *tail, add_func add, void *dest)
+{
+        size_t rows = 0;
+
+        if (tail->fd >= 0) {
+                read_new(tail);
+                rows = parse(tail, add, dest);
+        }
+        if (replaced(tail)) {
+                reopen(tail);
+                read_new(tail);
+                rows += parse(tail, add, dest);
+        }
+        return rows;
+}
+
+/**
+   Appends the rows added to a file since the last poll to a csv structure.
+   If the file has a header and cs has none, the header is stored in cs.
+
+   @param tail File being followed
+   @param cs Structure to append to
+
+   @return Number of rows appended. On a read error errno is set.
+ */
+
+size_t u_csv_tail_poll(struct u_csv_tail *tail, struct u_csv *cs)
+{
+        return poll_rows(tail, add_csv, cs);
+}
+
+/**
+   Appends the rows added to a file since the last poll to a dataframe.
+   Missing cells and cells of dbl columns that aren't numbers are NA.
+
+   @param tail File being followed
+   @param df Dataframe to append to, e.g. from u_dataframe_new()
+
+   @return Number of rows appended. On a read error errno is set.
+ */
+
+size_t u_csv_tail_poll_dataframe(struct u_csv_tail *tail,
+                                 struct u_dataframe *df)
+{
+        return poll_rows(tail, add_dataframe, df);
+}
+
+/**
+   Checks if there is anything for a poll to read.
+ */
+
+static bool changed(const struct u_csv_tail *tail)
+{
+        struct stat st;
+
+        return (tail->fd >= 0 && fstat(tail->fd, &st) == 0 &&
+                st.st_size != tail->offset) || replaced(tail);
+}
+
+/**
+   Waits until the file being followed changes, or another file takes its
+   name.
+
+   @param tail File being followed
+   @param timeout_ms Longest time to wait in milliseconds, -1 for no limit
+
+   @return true if the file may have changed, false on timeout
+ */
+
+bool u_csv_tail_wait(struct u_csv_tail *tail, int timeout_ms)
+{
+#ifdef __linux__
+        if (tail->watch_fd >= 0) {
+                // Events before the check below are covered by it
+                char buf[4096];
+                while (read(tail->watch_fd, buf, sizeof(buf)) > 0) ;
+                if (changed(tail))
+                        return true;
+                struct pollfd p = {.fd = tail->watch_fd,.events = POLLIN };
+                return poll(&p, 1, timeout_ms) > 0;
+        }
+#endif
+        if (changed(tail))
+                return true;
+        poll(NULL, 0, timeout_ms);
+        return changed(tail);
+}
+
+/**
+   Stops following a file and frees its state.
+
+   @param tail File being followed
+ */
+
+void u_csv_tail_close(struct u_csv_tail *tail)
+{
+        if (tail->fd >= 0)
+                close(tail->fd);
+        if (tail->watch_fd >= 0)
+                close(tail->watch_fd);
+        U_ARRAY_FREE(*tail, pending);
+        u_free(tail->path);
+        tail->fd = tail->watch_fd = tail->file_wd = -1;
+        tail->pending = tail->path = NULL;
+        tail->len = tail->capacity = 0;
+}
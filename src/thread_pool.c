@@ -0,0 +1,497 @@
+/**
+   \file
+
+   \brief Definitions of the work-stealing thread pool
+
+*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <error.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "useful/allocator.h"
+#include "useful/queue.h"
+#include "useful/thread_pool.h"
+
+/**
+   Times an idle worker looks for work before going to sleep.
+ */
+#define SPINS 64
+
+/**
+   A task: a function to run, its argument and the group it belongs to.
+   Larger structures, e.g. the ranges of u_parallel_for(), start with one.
+ */
+struct u_task {
+        void (*func) (void *arg);
+        void *arg;
+        struct u_task_group *group;
+};
+
+U_MPMC_DEFINE(task_queue, struct u_task *)
+
+/**
+   A Chase-Lev work-stealing deque of fixed size. Its owner pushes and takes
+   at the bottom; other threads steal from the top. This is the C11
+   formulation of Lê, Pop, Cohen and Zappa Nardelli, "Correct and Efficient
+   Work-Stealing for Weak Memory Models" (PPoPP 2013).
+ */
+struct deque {
+        alignas(U_CACHE_LINE) atomic_llong top;
+        alignas(U_CACHE_LINE) atomic_llong bottom;
+        _Atomic(struct u_task *) tasks[U_THREAD_POOL_DEQUE_SIZE];
+};
+
+struct worker {
+        struct deque deque;
+        struct u_thread_pool *pool;
+        pthread_t tid;
+        uint64_t seed;          // For picking workers to steal from
+};
+
+struct u_thread_pool {
+        unsigned n;
+        struct worker *workers;
+        struct task_queue queue;        // Tasks from outside the pool
+        alignas(U_CACHE_LINE) atomic_size_t pending;    // Tasks not yet taken
+        atomic_uint sleepers;
+        atomic_bool stop;
+        pthread_mutex_t lock;
+        pthread_cond_t wake;
+};
+
+/**
+   The worker the calling thread is, if any.
+ */
+static _Thread_local struct worker *self;
+
+static struct u_thread_pool *default_pool;
+static pthread_once_t default_once = PTHREAD_ONCE_INIT;
+
+static bool deque_push(struct deque *d, struct u_task *task)
+{
+        long long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+        long long t = atomic_load_explicit(&d->top, memory_order_acquire);
+
+        if (b - t >= U_THREAD_POOL_DEQUE_SIZE)
+                return false;
+        atomic_store_explicit(&d->tasks[b % U_THREAD_POOL_DEQUE_SIZE], task,
+                              memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return true;
+}
+
+static struct u_task *deque_take(struct deque *d)
+{
+        long long b = atomic_load_explicit(&d->bottom,
+                                           memory_order_relaxed) - 1;
+        struct u_task *task = NULL;
+
+        atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        long long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+        if (t <= b) {
+                size_t i = b % U_THREAD_POOL_DEQUE_SIZE;
+                task = atomic_load_explicit(&d->tasks[i],
+                                            memory_order_relaxed);
+                if (t == b) {
+                        // Last task: race stealers for it
+                        if (!atomic_compare_exchange_strong_explicit
+                            (&d->top, &t, t + 1, memory_order_seq_cst,
+                             memory_order_relaxed))
+                                task = NULL;
+                        atomic_store_explicit(&d->bottom, b + 1,
+                                              memory_order_relaxed);
+                }
+        } else {
+                atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        }
+        return task;
+}
+
+static struct u_task *deque_steal(struct deque *d)
+{
+        long long t = atomic_load_explicit(&d->top, memory_order_acquire);
+        atomic_thread_fence(memory_order_seq_cst);
+        long long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+
+        if (t >= b)
+                return NULL;
+        struct u_task *task =
+            atomic_load_explicit(&d->tasks[t % U_THREAD_POOL_DEQUE_SIZE],
+                                 memory_order_relaxed);
+        if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                                     memory_order_seq_cst,
+                                                     memory_order_relaxed))
+                return NULL;
+        return task;
+}
+
+/**
+   Finds a task for a thread of the pool (w is its worker, or NULL if it is
+   a thread waiting for a group): its own newest task, else the oldest task
+   from outside the pool, else one stolen from another worker.
+ */
+
+static struct u_task *find_task(struct u_thread_pool *pool, struct worker *w)
+{
+        struct u_task *task = NULL;
+
+        if (w)
+                task = deque_take(&w->deque);
+        if (task == NULL)
+                task_queue_pop(&pool->queue, &task);
+        if (task == NULL && pool->n > 0) {
+                unsigned start = 0;
+                if (w) {
+                        w->seed ^= w->seed << 13;
+                        w->seed ^= w->seed >> 7;
+                        w->seed ^= w->seed << 17;
+                        start = w->seed % pool->n;
+                }
+                for (unsigned i = 0; i < pool->n && task == NULL; ++i) {
+                        struct worker *victim =
+                            &pool->workers[(start + i) % pool->n];
+                        if (victim != w)
+                                task = deque_steal(&victim->deque);
+                }
+        }
+        if (task)
+                atomic_fetch_sub(&pool->pending, 1);
+        return task;
+}
+
+static void run_task(struct u_task *task)
+{
+        struct u_task_group *group = task->group;
+
+        task->func(task->arg);
+        u_free_with(&u_malloc_allocator, task);
+        if (group)
+                atomic_fetch_sub_explicit(&group->pending, 1,
+                                          memory_order_release);
+}
+
+/**
+   Queues a task, or runs it at once if there's no room for it.
+ */
+
+static void submit(struct u_thread_pool *pool, struct u_task *task)
+{
+        atomic_fetch_add(&pool->pending, 1);
+        if (self && self->pool == pool ? deque_push(&self->deque, task)
+            : task_queue_push(&pool->queue, task)) {
+                if (atomic_load(&pool->sleepers) > 0) {
+                        pthread_mutex_lock(&pool->lock);
+                        pthread_cond_signal(&pool->wake);
+                        pthread_mutex_unlock(&pool->lock);
+                }
+                return;
+        }
+        atomic_fetch_sub(&pool->pending, 1);
+        run_task(task);
+}
+
+static void *worker_main(void *arg)
+{
+        struct worker *w = arg;
+        struct u_thread_pool *pool = w->pool;
+        unsigned idle = 0;
+
+        self = w;
+        for (;;) {
+                struct u_task *task = find_task(pool, w);
+                if (task) {
+                        run_task(task);
+                        idle = 0;
+                        continue;
+                }
+                if (atomic_load(&pool->stop) &&
+                    atomic_load(&pool->pending) == 0)
+                        break;
+                if (++idle < SPINS) {
+                        sched_yield();
+                        continue;
+                }
+                pthread_mutex_lock(&pool->lock);
+                atomic_fetch_add(&pool->sleepers, 1);
+                while (atomic_load(&pool->pending) == 0 &&
+                       !atomic_load(&pool->stop))
+                        pthread_cond_wait(&pool->wake, &pool->lock);
+                atomic_fetch_sub(&pool->sleepers, 1);
+                pthread_mutex_unlock(&pool->lock);
+                idle = 0;
+        }
+        return NULL;
+}
+
+/**
+   Stops the first n workers of a pool once the tasks already queued have run.
+ */
+
+static void stop_workers(struct u_thread_pool *pool, unsigned n)
+{
+        pthread_mutex_lock(&pool->lock);
+        atomic_store(&pool->stop, true);
+        pthread_cond_broadcast(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+        for (unsigned i = 0; i < n; ++i)
+                pthread_join(pool->workers[i].tid, NULL);
+}
+
+/**
+   Frees a pool whose workers have stopped.
+ */
+
+static void destroy(struct u_thread_pool *pool)
+{
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->wake);
+        task_queue_free(&pool->queue);
+        u_aligned_free(pool->workers);
+        u_aligned_free(pool);
+}
+
+/**
+   Creates a thread pool.
+
+   @param threads Number of worker threads, 0 for one per online CPU
+
+   @return The pool, or NULL (with errno set) if it can't be created. Free it
+   with u_thread_pool_free().
+ */
+
+struct u_thread_pool *u_thread_pool_new(unsigned threads)
+{
+        const struct u_allocator *old = u_allocator_set(NULL);
+        struct u_thread_pool *pool;
+
+        if (threads == 0) {
+                long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                threads = cpus > 0 ? cpus : 1;
+        }
+        if (NULL == (pool = u_aligned_alloc(sizeof(*pool)))) {
+                u_allocator_set(old);
+                return NULL;
+        }
+        pool->workers = u_aligned_alloc(threads * sizeof(*pool->workers));
+        if (pool->workers == NULL ||
+            !task_queue_init(&pool->queue, U_THREAD_POOL_QUEUE_SIZE)) {
+                u_aligned_free(pool->workers);
+                u_aligned_free(pool);
+                u_allocator_set(old);
+                return NULL;
+        }
+        atomic_init(&pool->pending, 0);
+        atomic_init(&pool->sleepers, 0);
+        atomic_init(&pool->stop, false);
+        pthread_mutex_init(&pool->lock, NULL);
+        pthread_cond_init(&pool->wake, NULL);
+
+        for (unsigned i = 0; i < threads; ++i) {
+                struct worker *w = &pool->workers[i];
+                atomic_init(&w->deque.top, 0);
+                atomic_init(&w->deque.bottom, 0);
+                w->pool = pool;
+                w->seed = 0x9e3779b97f4a7c15ull * (i + 1);
+        }
+        pool->n = threads;
+        for (unsigned i = 0; i < threads; ++i) {
+                struct worker *w = &pool->workers[i];
+                int err = pthread_create(&w->tid, NULL, worker_main, w);
+                if (err) {
+                        stop_workers(pool, i);
+                        destroy(pool);
+                        u_allocator_set(old);
+                        errno = err;
+                        return NULL;
+                }
+        }
+        u_allocator_set(old);
+        return pool;
+}
+
+static void default_new(void)
+{
+        if (NULL == (default_pool = u_thread_pool_new(0)))
+                error(EXIT_FAILURE, errno, "Failed to create thread pool.");
+}
+
+/**
+   Gets the pool shared by the whole program, creating it on first use with
+   a worker per online CPU. It is never freed.
+ */
+
+struct u_thread_pool *u_thread_pool_default(void)
+{
+        pthread_once(&default_once, default_new);
+        return default_pool;
+}
+
+/**
+   Gets the number of worker threads of a pool.
+
+   @param pool Pool, or NULL for the default pool
+ */
+
+unsigned u_thread_pool_size(const struct u_thread_pool *pool)
+{
+        return (pool ? pool : u_thread_pool_default())->n;
+}
+
+/**
+   Runs every task already queued, then stops the workers and frees a pool.
+   Don't free the default pool.
+
+   @param pool Pool to free
+ */
+
+void u_thread_pool_free(struct u_thread_pool *pool)
+{
+        const struct u_allocator *old = u_allocator_set(NULL);
+
+        stop_workers(pool, pool->n);
+        destroy(pool);
+        u_allocator_set(old);
+}
+
+/**
+   Initializes an empty task group.
+
+   @param group Group to initialize
+   @param pool Pool to run the group's tasks on, or NULL for the default pool
+ */
+
+void u_task_group_init(struct u_task_group *group, struct u_thread_pool *pool)
+{
+        group->pool = pool ? pool : u_thread_pool_default();
+        atomic_init(&group->pending, 0);
+}
+
+static struct u_task *task_new(size_t size, void (*func) (void *arg),
+                               void *arg, struct u_task_group *group)
+{
+        struct u_task *task = u_alloc_with(&u_malloc_allocator, size);
+        if (task == NULL)
+                error(EXIT_FAILURE, errno, "Failed to allocate task.");
+        task->func = func;
+        task->arg = arg;
+        task->group = group;
+        atomic_fetch_add_explicit(&group->pending, 1, memory_order_relaxed);
+        return task;
+}
+
+/**
+   Runs func(arg) on the group's pool. It may run at once on the calling
+   thread if the pool's queues are full.
+
+   @param group Group the task belongs to
+   @param func Function to run
+   @param arg Argument to pass to func
+ */
+
+void u_task_group_run(struct u_task_group *group, void (*func) (void *arg),
+                      void *arg)
+{
+        submit(group->pool, task_new(sizeof(struct u_task), func, arg, group));
+}
+
+/**
+   Waits until every task run in a group has finished, running tasks of the
+   pool on the calling thread meanwhile. The group can be reused afterwards.
+
+   @param group Group to wait for
+ */
+
+void u_task_group_wait(struct u_task_group *group)
+{
+        struct u_thread_pool *pool = group->pool;
+        struct worker *w = self && self->pool == pool ? self : NULL;
+
+        while (atomic_load_explicit(&group->pending, memory_order_acquire)) {
+                struct u_task *task = find_task(pool, w);
+                if (task)
+                        run_task(task);
+                else
+                        sched_yield();
+        }
+}
+
+/**
+   A part of the range of a u_parallel_for() still to be run.
+ */
+
+struct range {
+        struct u_task task;
+        size_t begin;
+        size_t end;
+        size_t grain;
+        void (*body) (size_t begin, size_t end, void *arg);
+        void *arg;
+};
+
+/**
+   Hands the upper halves of a range to the pool until what is left is no
+   larger than the grain, then runs that.
+ */
+
+static void run_range(void *p)
+{
+        struct range *r = p;
+        size_t begin = r->begin, end = r->end;
+
+        while (end - begin > r->grain) {
+                size_t mid = begin + (end - begin) / 2;
+                struct range *half = (struct range *)
+                    task_new(sizeof(*half), run_range, NULL, r->task.group);
+                half->begin = mid;
+                half->end = end;
+                half->grain = r->grain;
+                half->body = r->body;
+                half->arg = r->arg;
+                half->task.arg = half;
+                submit(r->task.group->pool, &half->task);
+                end = mid;
+        }
+        r->body(begin, end, r->arg);
+}
+
+/**
+   Calls body(b, e, arg) for chunks [b, e) that together cover [begin, end),
+   in parallel, and waits for all of them.
+
+   @param pool Pool to run on, or NULL for the default pool
+   @param begin First index
+   @param end One past the last index
+   @param grain Smallest chunk worth running as a task; 0 is taken as 1
+   @param body Function to run for each chunk
+   @param arg Argument passed to body
+ */
+
+void u_parallel_for(struct u_thread_pool *pool, size_t begin, size_t end,
+                    size_t grain, void (*body) (size_t begin, size_t end,
+                                                void *arg), void *arg)
+{
+        struct u_task_group group;
+        struct range r = {
+                .task = {.group = &group },
+                .begin = begin,
+                .end = end,
+                .grain = grain ? grain : 1,
+                .body = body,
+                .arg = arg
+        };
+
+        if (begin >= end)
+                return;
+        u_task_group_init(&group, pool);
+        run_range(&r);
+        u_task_group_wait(&group);
+}
@@ -21,6 +21,35 @@
      memory allocation
    - <a href="check_8h.html">Macros to do make C error checking a touch more
      convenient
+   - <a href="memory_8h.html">Aligned, huge-page-aware allocation for large
+     numeric buffers</a>: memory.h
+   - <a href="query_8h.html">Lazy, single-pass queries over CSV files</a>:
+     query.h
+   - <a href="tail_8h.html">Incremental reading of CSV files that are being
+     appended to</a>: tail.h
+   - <a href="allocator_8h.html">Pluggable allocators: arena, pool and
+     counting</a>: allocator.h
+   - <a href="hash_8h.html">Typed hash maps and sets, and fast hash
+     functions</a>: hash.h
+   - <a href="sorted_8h.html">Branchless and Eytzinger layout searches of
+     sorted arrays</a>: sorted.h
+   - <a href="heap_8h.html">Typed d-ary heaps, plain and indexed</a>: heap.h
+   - <a href="queue_8h.html">Bounded lock-free SPSC and MPMC queues</a>:
+     queue.h
+   - <a href="thread__pool_8h.html">Work-stealing thread pool and parallel
+     for loops</a>: thread_pool.h
+   - <a href="segmented_8h.html">Segmented arrays with stable element
+     addresses</a>: segmented.h
+   - <a href="bitset_8h.html">Bitsets with fast counting and set
+     operations</a>: bitset.h
+   - <a href="intern_8h.html">Thread-safe string interning</a>: intern.h
+   - <a href="lines_8h.html">Fast reading of files a line at a time</a>:
+     lines.h
+   - <a href="match_8h.html">Searching text for one or many patterns</a>:
+     match.h
+   - <a href="utf8_8h.html">UTF-8 validation and transcoding</a>: utf8.h
+   - <a href="random_8h.html">Fast, seedable pseudorandom numbers</a>:
+     random.h
 
    @section install_sec Installation
 
@@ -70,10 +99,26 @@
  */
 
 #include "useful/test.h"
+#include "useful/allocator.h"
 #include "useful/array.h"
 #include "useful/algorithms.h"
 #include "useful/csv.h"
 #include "useful/string.h"
 #include "useful/check.h"
+#include "useful/memory.h"
+#include "useful/query.h"
+#include "useful/tail.h"
+#include "useful/hash.h"
+#include "useful/sorted.h"
+#include "useful/heap.h"
+#include "useful/queue.h"
+#include "useful/thread_pool.h"
+#include "useful/segmented.h"
+#include "useful/bitset.h"
+#include "useful/intern.h"
+#include "useful/lines.h"
+#include "useful/match.h"
+#include "useful/utf8.h"
+#include "useful/random.h"
 
 #endif
@@ -8,12 +8,6 @@
 #ifndef USEFUL_ALGORITHMS_H
 #define USEFUL_ALGORITHMS_H
 
-// Define this above the include of algorithms.h or useful.h if
-// you want to use a different random number generator
-#ifndef U_RANDOM
-#define U_RANDOM rand()
-#endif
-
 #include <float.h>
 #include <stdbool.h>
 #include <stdint.h>
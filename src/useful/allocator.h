@@ -0,0 +1,194 @@
+/**
+   @file
+
+   @brief Pluggable memory allocators.
+
+   Every allocation *Useful* makes for its own containers (arrays, strings,
+   csv structures, dataframes, matrices and so on) goes through a struct
+   u_allocator. By default that is u_malloc_allocator, which simply calls
+   malloc, realloc and free. A thread can route its allocations elsewhere
+   with u_allocator_set(), and arrays defined with U_ARRAY_DEFINE() can be
+   given their own allocator.
+
+   Three allocators are provided besides the default:
+
+   - a bump arena (struct u_arena), which makes freeing individual objects a
+     no-op and releases everything at once with u_arena_free(). Use it to
+     give a whole request or report its own memory and throw it away in one
+     step.
+   - a pool of fixed-size blocks (struct u_pool) for many objects of one size.
+   - a counting allocator (struct u_alloc_stats) that wraps another allocator,
+     keeps counts of allocations and bytes in use, and fills freed memory with
+     U_FREED_BYTE to expose use after free.
+
+   Memory must be freed by the allocator that allocated it. Strings, csv
+   structures, dataframes, matrices and matchers remember the allocator they
+   were created with, and typed and small arrays, hash tables, heaps,
+   segmented arrays and bitsets the one they first allocated with (unless
+   given one), and always use it, so the thread's allocator may change while
+   they live. Arrays managed with the U_ARRAY macros don't: switch back
+   before growing or freeing them. None of the provided allocators is thread
+   safe; give each thread its own.
+
+   @verbatim
+   struct u_arena arena;
+   u_arena_init(&arena, 1 << 20);
+   struct u_allocator a = u_arena_allocator(&arena);
+   const struct u_allocator *old = u_allocator_set(&a);
+
+   struct u_csv cs = u_csv_read(f, true, ',');
+   // ... work with cs; no need to call u_csv_free() ...
+
+   u_allocator_set(old);
+   u_arena_free(&arena);
+   @endverbatim
+*/
+
+#ifndef USEFUL_ALLOCATOR_H
+#define USEFUL_ALLOCATOR_H
+
+#include <stddef.h>
+
+/**
+   Byte written over memory freed through a counting allocator.
+ */
+#ifndef U_FREED_BYTE
+#define U_FREED_BYTE 0xdd
+#endif
+
+/**
+   An allocator: functions with the semantics of malloc, realloc and free,
+   plus a context pointer passed to each of them.
+ */
+struct u_allocator {
+        void *(*alloc) (void *ctx, size_t size);
+        void *(*realloc) (void *ctx, void *ptr, size_t size);
+        void (*free) (void *ctx, void *ptr);
+        void *ctx;
+};
+
+/**
+   A bump allocator. Memory is carved sequentially out of large blocks and is
+   only returned when the whole arena is reset or freed.
+ */
+struct u_arena {
+        struct u_arena_block *head;
+        size_t block_size;
+        void *last;             // Most recent allocation, which can grow
+                                // in place
+};
+
+/**
+   A pool of equally sized blocks.
+ */
+struct u_pool {
+        size_t block_size;
+        size_t blocks_per_chunk;
+        void *free_list;
+        void *chunks;
+};
+
+/**
+   Statistics gathered by a counting allocator.
+ */
+struct u_alloc_stats {
+        const struct u_allocator *parent;
+        size_t allocs;
+        size_t reallocs;
+        size_t frees;
+        size_t bytes;           // Bytes currently allocated
+        size_t peak_bytes;
+};
+
+extern const struct u_allocator u_malloc_allocator;
+
+/**
+   The calling thread's current allocator, or NULL for u_malloc_allocator.
+   Use u_allocator_get() and u_allocator_set() rather than this.
+ */
+extern _Thread_local const struct u_allocator *u_thread_allocator;
+
+/**
+   Gets the calling thread's current allocator.
+ */
+static inline const struct u_allocator *u_allocator_get(void)
+{
+        return u_thread_allocator ? u_thread_allocator : &u_malloc_allocator;
+}
+
+/**
+   Allocates size bytes with an allocator, or with the thread's current
+   allocator if a is NULL.
+ */
+static inline void *u_alloc_with(const struct u_allocator *a, size_t size)
+{
+        if (a == NULL)
+                a = u_allocator_get();
+        return a->alloc(a->ctx, size);
+}
+
+/**
+   Resizes memory with an allocator, or with the thread's current allocator
+   if a is NULL.
+ */
+static inline void *u_realloc_with(const struct u_allocator *a, void *ptr,
+                                   size_t size)
+{
+        if (a == NULL)
+                a = u_allocator_get();
+        return a->realloc(a->ctx, ptr, size);
+}
+
+/**
+   Frees memory with an allocator, or with the thread's current allocator if
+   a is NULL.
+ */
+static inline void u_free_with(const struct u_allocator *a, void *ptr)
+{
+        if (a == NULL)
+                a = u_allocator_get();
+        a->free(a->ctx, ptr);
+}
+
+/**
+   Allocates memory with the thread's current allocator.
+ */
+static inline void *u_alloc(size_t size)
+{
+        return u_alloc_with(NULL, size);
+}
+
+/**
+   Resizes memory with the thread's current allocator.
+ */
+static inline void *u_realloc(void *ptr, size_t size)
+{
+        return u_realloc_with(NULL, ptr, size);
+}
+
+/**
+   Frees memory with the thread's current allocator.
+ */
+static inline void u_free(void *ptr)
+{
+        u_free_with(NULL, ptr);
+}
+
+const struct u_allocator *u_allocator_set(const struct u_allocator *a);
+void *u_calloc(size_t nmemb, size_t size);
+
+void u_arena_init(struct u_arena *arena, size_t block_size);
+struct u_allocator u_arena_allocator(struct u_arena *arena);
+void u_arena_reset(struct u_arena *arena);
+void u_arena_free(struct u_arena *arena);
+
+void u_pool_init(struct u_pool *pool, size_t block_size,
+                 size_t blocks_per_chunk);
+struct u_allocator u_pool_allocator(struct u_pool *pool);
+void u_pool_free(struct u_pool *pool);
+
+void u_counting_init(struct u_alloc_stats *stats,
+                     const struct u_allocator *parent);
+struct u_allocator u_counting_allocator(struct u_alloc_stats *stats);
+
+#endif
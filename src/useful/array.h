@@ -26,6 +26,13 @@ the capacity of the array if it is full by calling realloc.
 Note: The programmer is responsible for allocating and freeing elements of the
 array if these contain dynamically allocated memory.
 
+On Linux, arrays that reach U_ARRAY_MAP_THRESHOLD bytes with the default
+allocator are moved to an anonymous mapping, and from then on grow with
+mremap, which remaps pages instead of copying the elements. Each mapping is
+recorded, so such an array must be freed with U_ARRAY_FREE (or name_free()
+for typed arrays, see U_ARRAY_DEFINE below), never with free(), but may be
+freed after the thread has switched allocators. Strings are never mapped.
+
 Here is an example:
 #include <stdlib.h>
 #include <string.h>
@@ -45,11 +52,41 @@ void u_strcat(char *dest, const char *src)
 
 @include arrays.c
 
+For arrays of a single known type, U_ARRAY_DEFINE(name, type) generates a
+struct name (with members len, capacity and vals) and a family of static
+inline functions name_push(), name_push_n(), name_pop(), name_reserve(),
+name_resize(), name_insert(), name_erase(), name_shrink_to_fit() and
+name_free(). These arrays start empty without allocating (initialize them with
+U_ARRAY_EMPTY or name_init()), grow by U_GROWTH with overflow checks, and move
+elements in bulk with memcpy and memmove. E.g.
+
+@verbatim
+U_ARRAY_DEFINE(dbl_array, double)
+
+struct dbl_array a = U_ARRAY_EMPTY;
+dbl_array_push_n(&a, values, 1000);
+dbl_array_erase(&a, 10, 5);
+dbl_array_free(&a);
+@endverbatim
+
+U_SMALL_ARRAY_DEFINE(name, type, n) generates a similar array that stores up
+to n elements inside the struct itself and only moves them to the heap when
+it grows past n. It has name_push(), name_push_n(), name_pop(),
+name_reserve(), name_data() and name_free(). Use it for the many short
+arrays whose elements would otherwise each cost a malloc.
+
 */
 #ifndef USEFUL_ARRAY_H
 #define USEFUL_ARRAY_H
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <string.h>
+
+#include "useful/allocator.h"
 
 /**
   Initial capacity of the array.
@@ -63,7 +100,36 @@ void u_strcat(char *dest, const char *src)
 #ifndef U_GROWTH
 #define U_GROWTH 3 / 2
 #endif
+/**
+  Array buffers of at least this many bytes are anonymous mappings grown with
+  mremap (Linux and the default allocator only).
+  */
+#ifndef U_ARRAY_MAP_THRESHOLD
+#define U_ARRAY_MAP_THRESHOLD (4 * 1024 * 1024)
+#endif
 size_t u_array_grow(void **array, size_t current_capacity, size_t object_size);
+void *u_array_resize(const struct u_allocator *a, void *ptr, size_t old_size,
+                     size_t new_size);
+void u_array_release(const struct u_allocator *a, void *ptr, size_t size);
+
+/**
+  Calculates the capacity an array must grow to in order to hold at least
+  needed elements: the larger of needed and the current capacity grown by
+  U_GROWTH, and at least U_INIT_CAPACITY.
+
+  @return the new capacity, or 0 if its size in bytes would overflow size_t
+  */
+static inline size_t u_array_next_capacity(size_t capacity, size_t needed,
+                                           size_t object_size)
+{
+    size_t grown = capacity < SIZE_MAX / 2 ? capacity * U_GROWTH : needed;
+    size_t result = grown > needed ? grown : needed;
+    if (result < U_INIT_CAPACITY)
+        result = U_INIT_CAPACITY;
+    if (object_size && result > SIZE_MAX / object_size)
+        return 0;
+    return result;
+}
 
 /**
   Creates a new array.
@@ -120,25 +186,29 @@ size_t u_array_grow(void **array, size_t current_capacity, size_t object_size);
   @param array Struct variable containing the array
   @param element Struct pointer element that represents the array
   @param key value to find
-  @return index in array of the element or array.len if not found
+  @return index in array of the first such element or array.len if not found
   */
 #define U_ARRAY_FIND(array, element, key, index)				\
     do {								\
         index = (array).len;					\
         for (size_t i = 0; i < (array).len; ++i)		\
-        if ((array).element[i] == (key))		\
-        index = i;				\
+        if ((array).element[i] == (key)) {		\
+            index = i;				\
+            break;				\
+        }				\
     } while(0)
 
 /**
-  Frees an array. Note it doesn't free the elements of the array.
+  Frees an array with the thread's current allocator (see allocator.h), or
+  unmaps it if it is mapped. Note it doesn't free the elements of the array.
   Either do that manually or use U_ARRAY_FREE_ELEM
 
   @param array Struct variable containing the array
   @param element Struct pointer element that represents the array
   */
 #define U_ARRAY_FREE(array, element) do {		\
-    free((array).element);		\
+    u_array_release(NULL, (array).element,		\
+            (array).capacity * sizeof(*(array).element));	\
 } while(0)
 
 /**
@@ -148,9 +218,10 @@ size_t u_array_grow(void **array, size_t current_capacity, size_t object_size);
 #define U_ONE_PARM_CUSTOM_FREE_FUNC(func, x, _) func( (x) )
 
 /**
-  Converts two parameter function to standard free.
+  Converts two parameter function to u_free, which frees with the thread's
+  current allocator.
   */
-#define U_ONE_PARM_FREE_FUNC(x, y) U_ONE_PARM_CUSTOM_FREE_FUNC(free, x, y)
+#define U_ONE_PARM_FREE_FUNC(x, y) U_ONE_PARM_CUSTOM_FREE_FUNC(u_free, x, y)
 
 /**
   Frees an array and its elements, using a custom user-provided free function.
@@ -177,4 +248,249 @@ size_t u_array_grow(void **array, size_t current_capacity, size_t object_size);
             U_ONE_PARM_FREE_FUNC, NULL);		\
 } while(0)
 
+/**
+  Initializer for an empty array. Nothing is allocated until the first
+  element is added.
+  */
+#define U_ARRAY_EMPTY { 0 }
+
+/**
+  Defines a typed dynamic array, struct name, and static inline functions to
+  manage it. All functions that allocate return false, leaving the array
+  unchanged, if memory runs out. The array's memory comes from its allocator
+  member, set with name_init_allocator(). If that is NULL the array takes the
+  thread's current allocator (see allocator.h) when it first allocates, and
+  keeps it.
+
+  @param name Name of the struct and prefix of the functions
+  @param type Type of the elements
+  */
+#define U_ARRAY_DEFINE(name, type)                                          \
+struct name {                                                               \
+    size_t len;                                                             \
+    size_t capacity;                                                        \
+    type *vals;                                                             \
+    const struct u_allocator *allocator;                                    \
+};                                                                          \
+                                                                            \
+static inline void name##_init_allocator(struct name *a,                    \
+                                         const struct u_allocator *alloc)   \
+{                                                                           \
+    a->len = a->capacity = 0;                                               \
+    a->vals = NULL;                                                         \
+    a->allocator = alloc;                                                   \
+}                                                                           \
+                                                                            \
+static inline void name##_init(struct name *a)                              \
+{                                                                           \
+    name##_init_allocator(a, NULL);                                         \
+}                                                                           \
+                                                                            \
+static inline bool name##_realloc(struct name *a, size_t capacity)          \
+{                                                                           \
+    if (a->allocator == NULL)                                               \
+        a->allocator = u_allocator_get();                                   \
+    type *t = u_array_resize(a->allocator, a->vals,                         \
+                             a->capacity * sizeof(type),                    \
+                             capacity * sizeof(type));                      \
+    if (t == NULL && capacity > 0)                                          \
+        return false;                                                       \
+    a->vals = t;                                                            \
+    a->capacity = capacity;                                                 \
+    return true;                                                            \
+}                                                                           \
+                                                                            \
+static inline bool name##_reserve(struct name *a, size_t n)                 \
+{                                                                           \
+    if (n <= a->capacity)                                                   \
+        return true;                                                        \
+    size_t capacity = u_array_next_capacity(a->capacity, n, sizeof(type));  \
+    if (capacity == 0) {                                                    \
+        errno = ENOMEM;                                                     \
+        return false;                                                       \
+    }                                                                       \
+    return name##_realloc(a, capacity);                                     \
+}                                                                           \
+                                                                            \
+static inline bool name##_push(struct name *a, type object)                 \
+{                                                                           \
+    if (a->len == a->capacity && !name##_reserve(a, a->len + 1))            \
+        return false;                                                       \
+    a->vals[a->len++] = object;                                             \
+    return true;                                                            \
+}                                                                           \
+                                                                            \
+static inline bool name##_push_n(struct name *a, type const *objects,       \
+                                 size_t n)                                  \
+{                                                                           \
+    if (n > SIZE_MAX - a->len || !name##_reserve(a, a->len + n))            \
+        return false;                                                       \
+    if (n)                                                                  \
+        memcpy(a->vals + a->len, objects, n * sizeof(type));                \
+    a->len += n;                                                            \
+    return true;                                                            \
+}                                                                           \
+                                                                            \
+static inline type name##_pop(struct name *a)                               \
+{                                                                           \
+    assert(a->len);                                                         \
+    return a->vals[--a->len];                                               \
+}                                                                           \
+                                                                            \
+static inline bool name##_insert(struct name *a, size_t index,              \
+                                 type const *objects, size_t n)             \
+{                                                                           \
+    assert(index <= a->len);                                                \
+    if (n > SIZE_MAX - a->len || !name##_reserve(a, a->len + n))            \
+        return false;                                                       \
+    if (n) {                                                                \
+        memmove(a->vals + index + n, a->vals + index,                       \
+                (a->len - index) * sizeof(type));                           \
+        memcpy(a->vals + index, objects, n * sizeof(type));                 \
+    }                                                                       \
+    a->len += n;                                                            \
+    return true;                                                            \
+}                                                                           \
+                                                                            \
+static inline void name##_erase(struct name *a, size_t index, size_t n)     \
+{                                                                           \
+    assert(index <= a->len && n <= a->len - index);                         \
+    memmove(a->vals + index, a->vals + index + n,                           \
+            (a->len - index - n) * sizeof(type));                           \
+    a->len -= n;                                                            \
+}                                                                           \
+                                                                            \
+static inline bool name##_resize(struct name *a, size_t n)                  \
+{                                                                           \
+    if (!name##_reserve(a, n))                                              \
+        return false;                                                       \
+    if (n > a->len)                                                         \
+        memset(a->vals + a->len, 0, (n - a->len) * sizeof(type));           \
+    a->len = n;                                                             \
+    return true;                                                            \
+}                                                                           \
+                                                                            \
+static inline void name##_free(struct name *a)                              \
+{                                                                           \
+    u_array_release(a->allocator, a->vals, a->capacity * sizeof(type));     \
+    name##_init_allocator(a, a->allocator);                                 \
+}                                                                           \
+                                                                            \
+static inline bool name##_shrink_to_fit(struct name *a)                     \
+{                                                                           \
+    if (a->len == 0)                                                        \
+        name##_free(a);                                                     \
+    return a->len == a->capacity || name##_realloc(a, a->len);              \
+}
+
+/**
+  Defines a typed dynamic array, struct name, that keeps up to n elements
+  inline and spills to the heap beyond that, and static inline functions to
+  manage it. Elements must be accessed through name_data(), since their
+  address changes when the array spills. Initialize arrays with name_init(),
+  which spills to the thread's allocator at the time of the first spill and
+  keeps it, or name_init_allocator() to spill to a particular allocator.
+  All functions that allocate return false, leaving the array unchanged, if
+  memory runs out.
+
+  @param name Name of the struct and prefix of the functions
+  @param type Type of the elements
+  @param n Number of elements stored inline (at least 1)
+  */
+#define U_SMALL_ARRAY_DEFINE(name, type, n)                                 \
+struct name {                                                               \
+    size_t len;                                                             \
+    size_t capacity;                                                        \
+    const struct u_allocator *allocator;                                    \
+    union {                                                                 \
+        type *heap;                                                         \
+        type small[n];                                                      \
+    };                                                                      \
+};                                                                          \
+                                                                            \
+static inline void name##_init_allocator(struct name *a,                    \
+                                         const struct u_allocator *alloc)   \
+{                                                                           \
+    a->len = 0;                                                             \
+    a->capacity = (n);                                                      \
+    a->allocator = alloc;                                                   \
+}                                                                           \
+                                                                            \
+static inline void name##_init(struct name *a)                              \
+{                                                                           \
+    name##_init_allocator(a, NULL);                                         \
+}                                                                           \
+                                                                            \
+static inline bool name##_is_small(const struct name *a)                    \
+{                                                                           \
+    return a->capacity <= (n);                                              \
+}                                                                           \
+                                                                            \
+static inline type *name##_data(const struct name *a)                       \
+{                                                                           \
+    return name##_is_small(a) ? (type *)a->small : a->heap;                 \
+}                                                                           \
+                                                                            \
+static inline bool name##_reserve(struct name *a, size_t m)                 \
+{                                                                           \
+    type *t;                                                                \
+    if (m <= a->capacity)                                                   \
+        return true;                                                        \
+    size_t capacity = u_array_next_capacity(a->capacity, m, sizeof(type));  \
+    if (capacity == 0) {                                                    \
+        errno = ENOMEM;                                                     \
+        return false;                                                       \
+    }                                                                       \
+    if (a->allocator == NULL)                                               \
+        a->allocator = u_allocator_get();                                   \
+    if (name##_is_small(a)) {                                               \
+        t = u_array_resize(a->allocator, NULL, 0, capacity * sizeof(type)); \
+        if (t == NULL)                                                      \
+            return false;                                                   \
+        memcpy(t, a->small, a->len * sizeof(type));                         \
+    } else {                                                                \
+        t = u_array_resize(a->allocator, a->heap,                           \
+                           a->capacity * sizeof(type),                      \
+                           capacity * sizeof(type));                        \
+        if (t == NULL)                                                      \
+            return false;                                                   \
+    }                                                                       \
+    a->heap = t;                                                            \
+    a->capacity = capacity;                                                 \
+    return true;                                                            \
+}                                                                           \
+                                                                            \
+static inline bool name##_push(struct name *a, type object)                 \
+{                                                                           \
+    if (a->len == a->capacity && !name##_reserve(a, a->len + 1))            \
+        return false;                                                       \
+    name##_data(a)[a->len++] = object;                                      \
+    return true;                                                            \
+}                                                                           \
+                                                                            \
+static inline bool name##_push_n(struct name *a, type const *objects,       \
+                                 size_t m)                                  \
+{                                                                           \
+    if (m > SIZE_MAX - a->len || !name##_reserve(a, a->len + m))            \
+        return false;                                                       \
+    if (m)                                                                  \
+        memcpy(name##_data(a) + a->len, objects, m * sizeof(type));         \
+    a->len += m;                                                            \
+    return true;                                                            \
+}                                                                           \
+                                                                            \
+static inline type name##_pop(struct name *a)                               \
+{                                                                           \
+    assert(a->len);                                                         \
+    return name##_data(a)[--a->len];                                        \
+}                                                                           \
+                                                                            \
+static inline void name##_free(struct name *a)                              \
+{                                                                           \
+    if (!name##_is_small(a))                                                \
+        u_array_release(a->allocator, a->heap,                              \
+                        a->capacity * sizeof(type));                        \
+    name##_init_allocator(a, a->allocator);                                 \
+}
+
 #endif
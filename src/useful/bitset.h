@@ -0,0 +1,114 @@
+/**
+  @file
+
+  @brief Dynamically sized bitsets, e.g. for row selection masks.
+
+  A struct u_bitset holds len bits in 64-bit words, bit i being bit i % 64 of
+  words[i / 64]. Like the arrays of array.h it starts empty without
+  allocating (initialize it with U_ARRAY_EMPTY or u_bitset_init()), grows by
+  U_GROWTH, can use any allocator (see allocator.h), and functions that
+  allocate return false, leaving the bitset unchanged, if memory runs out.
+  Bits past len in the last word are always clear, so whole words can be
+  combined and counted.
+
+  u_bitset_and(), u_bitset_or(), u_bitset_xor() and u_bitset_andnot()
+  combine two bitsets of the same length a word at a time. u_bitset_count()
+  and u_bitset_and_count() count set bits with AVX2 on CPUs that have it
+  (checked at run time), so combining and counting filters over many rows
+  runs at memory speed. u_bitset_next() finds set bits for iteration, and
+  u_bitset_from_indices() and u_bitset_to_indices() convert to and from
+  lists of row indices.
+
+  @verbatim
+  struct u_bitset big = U_ARRAY_EMPTY, recent = U_ARRAY_EMPTY;
+  u_bitset_resize(&big, df.rows);
+  u_bitset_resize(&recent, df.rows);
+  for (size_t i = 0; i < df.rows; ++i) {
+          u_bitset_assign(&big, i, u_dataframe_at(&df, i, 1).dbl > 1000);
+          u_bitset_assign(&recent, i, u_dataframe_at(&df, i, 2).dbl > 2019);
+  }
+  size_t n = u_bitset_and_count(&big, &recent);
+  u_bitset_and(&big, &recent);
+  for (size_t i = u_bitset_next(&big, 0); i < big.len;
+       i = u_bitset_next(&big, i + 1))
+          printf("%s\n", u_dataframe_at(&df, i, 0).str);
+  u_bitset_free(&big);
+  u_bitset_free(&recent);
+  @endverbatim
+*/
+
+#ifndef USEFUL_BITSET_H
+#define USEFUL_BITSET_H
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "useful/array.h"
+
+/**
+  A dynamically sized set of bits.
+  */
+struct u_bitset {
+        size_t len;             // Bits
+        size_t capacity;        // Words allocated
+        uint64_t *words;
+        const struct u_allocator *allocator;
+};
+
+/**
+  Number of words holding n bits.
+  */
+#define U_BITSET_WORDS(n) ( ((n) + 63) / 64 )
+
+static inline bool u_bitset_test(const struct u_bitset *b, size_t i)
+{
+        assert(i < b->len);
+        return (b->words[i / 64] >> (i % 64)) & 1;
+}
+
+static inline void u_bitset_set(struct u_bitset *b, size_t i)
+{
+        assert(i < b->len);
+        b->words[i / 64] |= UINT64_C(1) << (i % 64);
+}
+
+static inline void u_bitset_clear(struct u_bitset *b, size_t i)
+{
+        assert(i < b->len);
+        b->words[i / 64] &= ~(UINT64_C(1) << (i % 64));
+}
+
+/**
+  Sets bit i to x without branching.
+  */
+static inline void u_bitset_assign(struct u_bitset *b, size_t i, bool x)
+{
+        assert(i < b->len);
+        uint64_t bit = UINT64_C(1) << (i % 64);
+        b->words[i / 64] = (b->words[i / 64] & ~bit) | (-(uint64_t) x & bit);
+}
+
+void u_bitset_init(struct u_bitset *b);
+void u_bitset_init_allocator(struct u_bitset *b,
+                             const struct u_allocator *alloc);
+bool u_bitset_reserve(struct u_bitset *b, size_t n);
+bool u_bitset_resize(struct u_bitset *b, size_t len);
+bool u_bitset_push(struct u_bitset *b, bool x);
+void u_bitset_fill(struct u_bitset *b, bool x);
+void u_bitset_and(struct u_bitset *dest, const struct u_bitset *src);
+void u_bitset_or(struct u_bitset *dest, const struct u_bitset *src);
+void u_bitset_xor(struct u_bitset *dest, const struct u_bitset *src);
+void u_bitset_andnot(struct u_bitset *dest, const struct u_bitset *src);
+void u_bitset_not(struct u_bitset *b);
+size_t u_bitset_popcount(const uint64_t *words, size_t n);
+size_t u_bitset_count(const struct u_bitset *b);
+size_t u_bitset_and_count(const struct u_bitset *a, const struct u_bitset *b);
+size_t u_bitset_next(const struct u_bitset *b, size_t i);
+bool u_bitset_from_indices(struct u_bitset *b, size_t len,
+                           const size_t *indices, size_t n);
+size_t u_bitset_to_indices(const struct u_bitset *b, size_t *indices);
+void u_bitset_free(struct u_bitset *b);
+
+#endif
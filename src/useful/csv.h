@@ -5,15 +5,33 @@
 
    Most of the time you will want to use the u_csv_read() function to read a CSV
    file into a 2-d array structure of strings (struct u_csv). Then when you're
-   done with it, call u_csv_free().
+   done with it, call u_csv_free(). To read a set of files with the same
+   header in parallel into a single struct u_csv, use u_csv_read_files() or
+   u_csv_read_glob().
 
    To create a csv structure and then csv files use u_csv_new(), u_csv_append()
    and u_csv_write().
 
+   struct u_csv_chunked holds the same data with its rows in fixed-size
+   chunks, so rows never move once stored. Use it through u_csv_chunked_read(),
+   u_csv_chunked_new(), u_csv_chunked_append() and the other u_csv_chunked_
+   functions when pointers to rows must stay valid, or for very large files.
+
    Use u_csv_at() to get the string value of a particular cell.
    Use u_csv_to_matrix() to convert a csv consisting of numbers to a matrix of
    doubles. Remember to free your matrix when done with it using matrix_free().
 
+   Missing cells and cells that don't parse as numbers become NA (not
+   available) in matrices and dataframes rather than errors. Each column keeps
+   a validity bitmap in which bit i is set if row i holds a value. Use
+   u_matrix_isna() and u_dataframe_isna() to test a cell, and the _count(),
+   _sum() and _mean() reductions, which skip NAs, to summarise a column.
+
+   Columns of categorical data repeat the same few strings many times. To
+   store each distinct string once, read with u_csv_read_interned(), or
+   convert with u_csv_to_dataframe_interned(), passing an interner (see
+   intern.h).
+
    Everything else provided here is just cute, or perhaps occasionally useful.
 */
 
@@ -23,13 +41,19 @@
 #include <assert.h>
 #include <error.h>
 #include <errno.h>
+#include <math.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
+#include "useful/allocator.h"
 #include "useful/array.h"
+#include "useful/intern.h"
+#include "useful/memory.h"
+#include "useful/segmented.h"
 #include "useful/test.h"
 #include "useful/algorithms.h"
 
@@ -43,6 +67,26 @@ struct u_csv_row {
         char **cells;
 };
 
+/**
+   Holds the cells of one or more rows as consecutive null-terminated strings
+   in a single buffer that can be reused from row to row. Cell i starts at
+   text.chars + index.offsets[i]. Use it with u_csv_read_cells() to stream
+   through a CSV file without allocating a string per cell.
+ */
+
+struct u_csv_cells {
+        struct {
+                size_t len;
+                size_t capacity;
+                char *chars;
+        } text;
+        struct {
+                size_t len;
+                size_t capacity;
+                size_t *offsets;
+        } index;
+};
+
 /**
    Holds an entire csv file, either after reading it in, or for writing it out.
  */
@@ -52,16 +96,52 @@ struct u_csv {
         size_t len;
         size_t capacity;
         struct u_csv_row *rows;
+        struct u_interner *interner;    // Holds the cells, if not NULL
+        const struct u_allocator *allocator;    // Of the rows and cells
+};
+
+/**
+   Base 2 logarithm of the number of rows in each chunk of a struct
+   u_csv_chunked.
+ */
+
+#ifndef U_CSV_CHUNK_SHIFT
+#define U_CSV_CHUNK_SHIFT 10
+#endif
+
+U_SEGMENTED_DEFINE(u_csv_row_chunks, struct u_csv_row, U_CSV_CHUNK_SHIFT)
+
+/**
+   Holds an entire csv file like struct u_csv, but keeps the rows in chunks
+   (see segmented.h) instead of one array. Appending a row never moves the
+   rows already stored, so pointers to them stay valid, and reading a large
+   file doesn't copy every row each time the array grows.
+ */
+
+struct u_csv_chunked {
+        struct u_csv_row header;
+        struct u_csv_row_chunks rows;
+        const struct u_allocator *allocator;    // Of the rows and cells
 };
 
 /**
-   Hold a matrix of real-valued numbers.
+   Number of 64-bit words in a validity bitmap of a column with rows rows.
+ */
+
+#define U_NA_WORDS(rows) ( ((rows) + 63) / 64 )
+
+/**
+   Hold a matrix of real-valued numbers. The values are aligned to
+   U_ALIGNMENT bytes (see memory.h). NA cells hold NAN and have their bit
+   clear in valid.
  */
 
 struct u_matrix {
         size_t rows;
         size_t cols;
         double *vals;
+        uint64_t **valid;
+        const struct u_allocator *allocator;    // Of vals and valid
 };
 
 /**
@@ -92,21 +172,57 @@ struct u_dataframe {
         size_t cols;
         enum u_val_type *type;
         union u_str_dbl *vals;
+        uint64_t **valid;
+        struct u_interner *interner;    // Holds the strings, if not NULL
+        const struct u_allocator *allocator;    // Of everything else
 };
 
+struct u_csv u_csv_new(bool header, const char *strings[], size_t n);
+void u_csv_append(struct u_csv *cs, const char *strings[], size_t n);
 struct u_csv u_csv_read(FILE * f, bool header, char delim);
+struct u_csv u_csv_read_interned(FILE * f, bool header, char delim,
+                                 struct u_interner *in);
+struct u_csv u_csv_read_files(const char *paths[], size_t n, bool header,
+                              char delim, unsigned threads);
+struct u_csv u_csv_read_glob(const char *pattern, bool header, char delim,
+                             unsigned threads);
+struct u_csv_cells u_csv_cells_new(void);
+size_t u_csv_read_cells(FILE * f, char delim, struct u_csv_cells *cells);
+const char *u_csv_cells_at(const struct u_csv_cells *cells, size_t i);
+void u_csv_cells_clear(struct u_csv_cells *cells);
+bool u_csv_cells_valid_utf8(const struct u_csv_cells *cells);
+void u_csv_cells_free(struct u_csv_cells *cells);
 const char *u_csv_at(const struct u_csv *cs, size_t row, size_t col);
+bool u_csv_parse_dbl(const char *s, double *d);
 void u_csv_write(FILE * f, const struct u_csv *cs);
 bool u_csv_isvalid(const struct u_csv *cs, bool verbose);
 void u_csv_free(struct u_csv *cs);
+struct u_csv_chunked u_csv_chunked_new(bool header, const char *strings[],
+                                       size_t n);
+struct u_csv_row *u_csv_chunked_append(struct u_csv_chunked *cs,
+                                       const char *strings[], size_t n);
+struct u_csv_chunked u_csv_chunked_read(FILE * f, bool header, char delim);
+const char *u_csv_chunked_at(const struct u_csv_chunked *cs, size_t row,
+                             size_t col);
+void u_csv_chunked_write(FILE * f, const struct u_csv_chunked *cs);
+void u_csv_chunked_free(struct u_csv_chunked *cs);
 struct u_dataframe u_csv_to_dataframe(const struct u_csv *cs,
                                   const enum u_val_type col_types[]);
+struct u_dataframe u_csv_to_dataframe_interned(const struct u_csv *cs,
+                                               const enum u_val_type
+                                               col_types[],
+                                               struct u_interner *in);
 struct u_dataframe u_dataframe_new(size_t cols, const char *strings[],
                                const enum u_val_type types[]);
 union u_str_dbl u_dataframe_at(const struct u_dataframe *df, size_t row, size_t col);
 void u_dataframe_append(struct u_dataframe *df, const union u_str_dbl vals[]);
 void u_dataframe_append_var(struct u_dataframe *df, ...);
 enum u_val_type u_dataframe_col_type(struct u_dataframe *df, size_t col);
+bool u_dataframe_isna(const struct u_dataframe *df, size_t row, size_t col);
+void u_dataframe_set_na(struct u_dataframe *df, size_t row, size_t col);
+size_t u_dataframe_count(const struct u_dataframe *df, size_t col);
+double u_dataframe_sum(const struct u_dataframe *df, size_t col);
+double u_dataframe_mean(const struct u_dataframe *df, size_t col);
 void u_dataframe_write(FILE * f, const struct u_dataframe *df);
 struct u_csv u_dataframe_to_csv(const struct u_dataframe *df);
 struct u_matrix u_dataframe_to_matrix(const struct u_dataframe *df);
@@ -114,6 +230,11 @@ void u_dataframe_free(struct u_dataframe *df);
 struct u_matrix u_csv_to_matrix(const struct u_csv *cs);
 double u_matrix_at(const struct u_matrix *mat, size_t row, size_t col);
 void u_matrix_set(struct u_matrix *mat, size_t row, size_t col, double val);
+bool u_matrix_isna(const struct u_matrix *mat, size_t row, size_t col);
+void u_matrix_set_na(struct u_matrix *mat, size_t row, size_t col);
+size_t u_matrix_count(const struct u_matrix *mat, size_t col);
+double u_matrix_sum(const struct u_matrix *mat, size_t col);
+double u_matrix_mean(const struct u_matrix *mat, size_t col);
 void u_matrix_free(struct u_matrix *matrix);
 
 #endif
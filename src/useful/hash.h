@@ -0,0 +1,528 @@
+/**
+  @file
+
+  @brief Typed open-addressing hash maps and sets, and fast hash functions.
+
+  U_HASH_MAP_DEFINE(name, key_type, val_type, hash, eq) generates struct name
+  and static inline functions to manage a hash map from key_type to val_type.
+  U_HASH_SET_DEFINE(name, key_type, hash, eq) does the same for a set. hash
+  is a function taking a key and returning a uint64_t, and eq a function
+  taking two keys and returning true if they are equal. Hash functions for
+  strings (u_hash_str() and u_hash_string()) and integers (u_hash_u64()) are
+  provided, with matching equality functions.
+
+  The tables store a control byte per slot: U_HASH_EMPTY, or the top 7 bits
+  of the hash of the key in the slot. Lookups compare U_HASH_GROUP control
+  bytes at a time, with SSE2 where available, and only compare the keys whose
+  control byte matches. Slots are probed linearly, which allows entries to be
+  removed by shifting the ones after them back, so there are no tombstones
+  and lookups never slow down after many removals. Tables grow when they are
+  7/8 full and their capacity is always a power of two.
+
+  Keys and values are stored by value. A table never frees what they point
+  to, so e.g. the strings of a map with char * keys must outlive it. Its own
+  memory comes from the allocator given to name_init_allocator() or, after
+  name_init(), from the thread's allocator when it first allocates, which
+  it keeps (see allocator.h).
+
+  @verbatim
+  U_HASH_MAP_DEFINE(counts, const char *, size_t, u_hash_str, u_str_equal)
+
+  struct counts c;
+  counts_init(&c);
+  for (size_t i = 0; i < cs.len; ++i)
+          ++*counts_get_or_put(&c, u_csv_at(&cs, i, 0), 0);
+  for (size_t i = counts_next(&c, 0); i < c.capacity;
+       i = counts_next(&c, i + 1))
+          printf("%s %zu\n", c.keys[i], c.vals[i]);
+  counts_free(&c);
+  @endverbatim
+*/
+
+#ifndef USEFUL_HASH_H
+#define USEFUL_HASH_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "useful/allocator.h"
+#include "useful/string.h"
+
+/**
+  Number of control bytes compared at a time.
+  */
+#define U_HASH_GROUP 16
+
+/**
+  Control byte of an empty slot. Full slots have their top bit clear.
+  */
+#define U_HASH_EMPTY 0x80
+
+/**
+  Smallest capacity of a table that holds anything.
+  */
+#define U_HASH_MIN_CAPACITY 16
+
+uint64_t u_hash_bytes(const void *data, size_t len, uint64_t seed);
+
+/**
+  Multiplies *a by *b into 128 bits, leaving the low half in *a and the high
+  half in *b.
+  */
+static inline void u_hash_mul128(uint64_t *a, uint64_t *b)
+{
+#ifdef __SIZEOF_INT128__
+        __uint128_t r = (__uint128_t) *a * *b;
+        *a = (uint64_t) r;
+        *b = (uint64_t) (r >> 64);
+#else
+        uint64_t ha = *a >> 32, la = (uint32_t) *a;
+        uint64_t hb = *b >> 32, lb = (uint32_t) *b;
+        uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+        uint64_t t = rl + (rm0 << 32), c = t < rl;
+        uint64_t lo = t + (rm1 << 32);
+        c += lo < t;
+        *a = lo;
+        *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+/**
+  Mixes two 64-bit values into one by multiplying them into 128 bits and
+  folding the halves together.
+  */
+static inline uint64_t u_hash_mix(uint64_t a, uint64_t b)
+{
+        u_hash_mul128(&a, &b);
+        return a ^ b;
+}
+
+/**
+  Hashes an integer.
+  */
+static inline uint64_t u_hash_u64(uint64_t x)
+{
+        return u_hash_mix(x ^ 0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull);
+}
+
+/**
+  Hashes a null terminated string.
+  */
+static inline uint64_t u_hash_str(const char *s)
+{
+        return u_hash_bytes(s, strlen(s), 0);
+}
+
+/**
+  Hashes a struct u_string.
+  */
+static inline uint64_t u_hash_string(struct u_string s)
+{
+        return u_hash_bytes(s.str, s.len ? s.len - 1 : 0, 0);
+}
+
+static inline bool u_u64_equal(uint64_t a, uint64_t b)
+{
+        return a == b;
+}
+
+static inline bool u_str_equal(const char *a, const char *b)
+{
+        return strcmp(a, b) == 0;
+}
+
+static inline bool u_string_equal(struct u_string a, struct u_string b)
+{
+        return a.len == b.len && memcmp(a.str, b.str, a.len) == 0;
+}
+
+/**
+  Control byte of a key with hash h.
+  */
+static inline uint8_t u_hash_h2(uint64_t h)
+{
+        return h >> 57;
+}
+
+/**
+  Returns a mask with bit i set if ctrl[i] == c, for i < U_HASH_GROUP.
+  */
+static inline uint32_t u_hash_match(const uint8_t *ctrl, uint8_t c)
+{
+#ifdef __SSE2__
+        __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(c)));
+#else
+        uint32_t mask = 0;
+        for (int i = 0; i < U_HASH_GROUP; ++i)
+                mask |= (uint32_t) (ctrl[i] == c) << i;
+        return mask;
+#endif
+}
+
+/**
+  Allocates the control bytes of a table of the given capacity, all empty.
+  The first U_HASH_GROUP - 1 bytes are mirrored after the end so that a group
+  can be loaded from any slot.
+  */
+static inline uint8_t *u_hash_ctrl_new(const struct u_allocator *a,
+                                       size_t capacity)
+{
+        uint8_t *ctrl = u_alloc_with(a, capacity + U_HASH_GROUP - 1);
+        if (ctrl)
+                memset(ctrl, U_HASH_EMPTY, capacity + U_HASH_GROUP - 1);
+        return ctrl;
+}
+
+/**
+  Sets the control byte of slot i, and its mirror if it has one.
+  */
+static inline void u_hash_ctrl_set(uint8_t *ctrl, size_t capacity, size_t i,
+                                   uint8_t c)
+{
+        ctrl[i] = c;
+        if (i < U_HASH_GROUP - 1)
+                ctrl[capacity + i] = c;
+}
+
+/**
+  Calculates the capacity a table needs to hold n entries, or 0 if it would
+  overflow.
+  */
+static inline size_t u_hash_capacity(size_t n)
+{
+        size_t capacity = U_HASH_MIN_CAPACITY;
+        while (capacity / 8 * 7 < n) {
+                if (capacity > SIZE_MAX / 2)
+                        return 0;
+                capacity *= 2;
+        }
+        return capacity;
+}
+
+/**
+  Defines the functions shared by maps and sets. name_vals_new_(),
+  name_vals_free_() and name_val_move_() must already be defined.
+  */
+#define U_HASH_TABLE_FUNCS_(name, key_type, hash, eq)                       \
+static inline void name##_init_allocator(struct name *m,                    \
+                                         const struct u_allocator *alloc)   \
+{                                                                           \
+    m->len = m->capacity = 0;                                               \
+    m->ctrl = NULL;                                                         \
+    m->keys = NULL;                                                         \
+    name##_vals_free_(m);                                                   \
+    m->allocator = alloc;                                                   \
+}                                                                           \
+                                                                            \
+static inline void name##_init(struct name *m)                              \
+{                                                                           \
+    name##_init_allocator(m, NULL);                                         \
+}                                                                           \
+                                                                            \
+/* Finds key, or failing that the first empty slot it would go in. */       \
+static inline bool name##_probe_(const struct name *m, key_type key,        \
+                                 uint64_t h, size_t *slot)                  \
+{                                                                           \
+    size_t mask = m->capacity - 1;                                          \
+    uint8_t h2 = u_hash_h2(h);                                              \
+    for (size_t pos = h & mask;; pos = (pos + U_HASH_GROUP) & mask) {       \
+        uint32_t match = u_hash_match(m->ctrl + pos, h2);                   \
+        for (; match; match &= match - 1) {                                 \
+            size_t i = (pos + __builtin_ctz(match)) & mask;                 \
+            if (eq(m->keys[i], key)) {                                      \
+                *slot = i;                                                  \
+                return true;                                                \
+            }                                                               \
+        }                                                                   \
+        uint32_t empty = u_hash_match(m->ctrl + pos, U_HASH_EMPTY);         \
+        if (empty) {                                                        \
+            *slot = (pos + __builtin_ctz(empty)) & mask;                    \
+            return false;                                                   \
+        }                                                                   \
+    }                                                                       \
+}                                                                           \
+                                                                            \
+static inline size_t name##_empty_slot_(const struct name *m, uint64_t h)   \
+{                                                                           \
+    size_t mask = m->capacity - 1;                                          \
+    for (size_t pos = h & mask;; pos = (pos + U_HASH_GROUP) & mask) {       \
+        uint32_t empty = u_hash_match(m->ctrl + pos, U_HASH_EMPTY);         \
+        if (empty)                                                          \
+            return (pos + __builtin_ctz(empty)) & mask;                     \
+    }                                                                       \
+}                                                                           \
+                                                                            \
+static inline bool name##_rehash_(struct name *m, size_t capacity)          \
+{                                                                           \
+    struct name t;                                                          \
+    if (m->allocator == NULL)                                               \
+        m->allocator = u_allocator_get();                                   \
+    name##_init_allocator(&t, m->allocator);                                \
+    t.capacity = capacity;                                                  \
+    if (capacity > SIZE_MAX / sizeof(key_type)) {                           \
+        errno = ENOMEM;                                                     \
+        return false;                                                       \
+    }                                                                       \
+    t.ctrl = u_hash_ctrl_new(t.allocator, capacity);                        \
+    t.keys = u_alloc_with(t.allocator, capacity * sizeof(key_type));        \
+    if (t.ctrl == NULL || t.keys == NULL || !name##_vals_new_(&t)) {        \
+        u_free_with(t.allocator, t.ctrl);                                   \
+        u_free_with(t.allocator, t.keys);                                   \
+        return false;                                                       \
+    }                                                                       \
+    for (size_t i = 0; i < m->capacity; ++i) {                              \
+        if (m->ctrl[i] == U_HASH_EMPTY)                                     \
+            continue;                                                       \
+        uint64_t h = hash(m->keys[i]);                                      \
+        size_t j = name##_empty_slot_(&t, h);                               \
+        u_hash_ctrl_set(t.ctrl, capacity, j, u_hash_h2(h));                 \
+        t.keys[j] = m->keys[i];                                             \
+        name##_val_move_(&t, j, m, i);                                      \
+    }                                                                       \
+    t.len = m->len;                                                         \
+    u_free_with(m->allocator, m->ctrl);                                     \
+    u_free_with(m->allocator, m->keys);                                     \
+    name##_vals_free_(m);                                                   \
+    *m = t;                                                                 \
+    return true;                                                            \
+}                                                                           \
+                                                                            \
+/* Makes room for n entries without growing. */                             \
+static inline bool name##_reserve(struct name *m, size_t n)                 \
+{                                                                           \
+    if (n <= m->capacity / 8 * 7)                                           \
+        return true;                                                        \
+    size_t capacity = u_hash_capacity(n);                                   \
+    if (capacity == 0) {                                                    \
+        errno = ENOMEM;                                                     \
+        return false;                                                       \
+    }                                                                       \
+    return name##_rehash_(m, capacity);                                     \
+}                                                                           \
+                                                                            \
+/* Returns the slot of key, or m->capacity if it isn't there. */            \
+static inline size_t name##_find(const struct name *m, key_type key)        \
+{                                                                           \
+    size_t i;                                                               \
+    if (m->len == 0 || !name##_probe_(m, key, hash(key), &i))               \
+        return m->capacity;                                                 \
+    return i;                                                               \
+}                                                                           \
+                                                                            \
+static inline bool name##_contains(const struct name *m, key_type key)      \
+{                                                                           \
+    return name##_find(m, key) != m->capacity;                              \
+}                                                                           \
+                                                                            \
+/* Finds key, or adds it to a new slot (without setting its value). */      \
+static inline size_t name##_slot_(struct name *m, key_type key,             \
+                                  bool *added)                              \
+{                                                                           \
+    uint64_t h = hash(key);                                                 \
+    size_t i;                                                               \
+    *added = false;                                                         \
+    if (m->capacity && name##_probe_(m, key, h, &i))                        \
+        return i;                                                           \
+    if (m->len >= m->capacity / 8 * 7) {                                    \
+        if (!name##_reserve(m, m->len + 1))                                 \
+            return SIZE_MAX;                                                \
+        i = name##_empty_slot_(m, h);                                       \
+    }                                                                       \
+    u_hash_ctrl_set(m->ctrl, m->capacity, i, u_hash_h2(h));                 \
+    m->keys[i] = key;                                                       \
+    ++m->len;                                                               \
+    *added = true;                                                          \
+    return i;                                                               \
+}                                                                           \
+                                                                            \
+/* Returns the first full slot at or after i, or m->capacity. */            \
+static inline size_t name##_next(const struct name *m, size_t i)            \
+{                                                                           \
+    while (i < m->capacity && m->ctrl[i] == U_HASH_EMPTY)                   \
+        ++i;                                                                \
+    return i;                                                               \
+}                                                                           \
+                                                                            \
+/* Removes the entry in slot i, shifting back the entries after it. */      \
+static inline void name##_remove_at(struct name *m, size_t i)               \
+{                                                                           \
+    size_t mask = m->capacity - 1;                                          \
+    for (size_t j = (i + 1) & mask; m->ctrl[j] != U_HASH_EMPTY;             \
+         j = (j + 1) & mask) {                                              \
+        size_t home = hash(m->keys[j]) & mask;                              \
+        if (((j - home) & mask) >= ((j - i) & mask)) {                      \
+            u_hash_ctrl_set(m->ctrl, m->capacity, i, m->ctrl[j]);           \
+            m->keys[i] = m->keys[j];                                        \
+            name##_val_move_(m, i, m, j);                                   \
+            i = j;                                                          \
+        }                                                                   \
+    }                                                                       \
+    u_hash_ctrl_set(m->ctrl, m->capacity, i, U_HASH_EMPTY);                 \
+    --m->len;                                                               \
+}                                                                           \
+                                                                            \
+static inline bool name##_remove(struct name *m, key_type key)              \
+{                                                                           \
+    size_t i = name##_find(m, key);                                         \
+    if (i == m->capacity)                                                   \
+        return false;                                                       \
+    name##_remove_at(m, i);                                                 \
+    return true;                                                            \
+}                                                                           \
+                                                                            \
+static inline void name##_clear(struct name *m)                             \
+{                                                                           \
+    if (m->ctrl)                                                            \
+        memset(m->ctrl, U_HASH_EMPTY, m->capacity + U_HASH_GROUP - 1);      \
+    m->len = 0;                                                             \
+}                                                                           \
+                                                                            \
+static inline void name##_free(struct name *m)                              \
+{                                                                           \
+    u_free_with(m->allocator, m->ctrl);                                     \
+    u_free_with(m->allocator, m->keys);                                     \
+    name##_vals_free_(m);                                                   \
+    name##_init_allocator(m, m->allocator);                                 \
+}
+
+/**
+  Defines a hash map, struct name, and static inline functions to manage it:
+  name_init(), name_init_allocator(), name_reserve(), name_put(), name_get(),
+  name_get_or_put(), name_find(), name_contains(), name_next(),
+  name_remove(), name_remove_at(), name_clear() and name_free(). Slot i is in
+  use if name_next(m, i) == i, in which case its key and value are
+  m->keys[i] and m->vals[i]. Adding entries may move every entry to a new
+  slot. All functions that allocate return false or NULL if memory runs out,
+  leaving the map unchanged.
+
+  @param name Name of the struct and prefix of the functions
+  @param key_type Type of the keys
+  @param val_type Type of the values
+  @param hash Function returning the uint64_t hash of a key
+  @param eq Function returning true if two keys are equal
+  */
+#define U_HASH_MAP_DEFINE(name, key_type, val_type, hash, eq)               \
+struct name {                                                               \
+    size_t len;                                                             \
+    size_t capacity;                                                        \
+    uint8_t *ctrl;                                                          \
+    key_type *keys;                                                         \
+    val_type *vals;                                                         \
+    const struct u_allocator *allocator;                                    \
+};                                                                          \
+                                                                            \
+static inline bool name##_vals_new_(struct name *m)                         \
+{                                                                           \
+    if (m->capacity > SIZE_MAX / sizeof(val_type)) {                        \
+        errno = ENOMEM;                                                     \
+        return false;                                                       \
+    }                                                                       \
+    m->vals = u_alloc_with(m->allocator, m->capacity * sizeof(val_type));   \
+    return m->vals != NULL;                                                 \
+}                                                                           \
+                                                                            \
+static inline void name##_vals_free_(struct name *m)                        \
+{                                                                           \
+    if (m->capacity)                                                        \
+        u_free_with(m->allocator, m->vals);                                 \
+    m->vals = NULL;                                                         \
+}                                                                           \
+                                                                            \
+static inline void name##_val_move_(struct name *dst, size_t i,             \
+                                    const struct name *src, size_t j)       \
+{                                                                           \
+    dst->vals[i] = src->vals[j];                                            \
+}                                                                           \
+                                                                            \
+U_HASH_TABLE_FUNCS_(name, key_type, hash, eq)                               \
+                                                                            \
+/* Sets the value of key, adding it if it isn't there. */                   \
+static inline bool name##_put(struct name *m, key_type key, val_type val)   \
+{                                                                           \
+    bool added;                                                             \
+    size_t i = name##_slot_(m, key, &added);                                \
+    if (i == SIZE_MAX)                                                      \
+        return false;                                                       \
+    m->vals[i] = val;                                                       \
+    return true;                                                            \
+}                                                                           \
+                                                                            \
+/* Returns a pointer to the value of key, or NULL if it isn't there. */     \
+static inline val_type *name##_get(const struct name *m, key_type key)      \
+{                                                                           \
+    size_t i = name##_find(m, key);                                         \
+    return i == m->capacity ? NULL : m->vals + i;                           \
+}                                                                           \
+                                                                            \
+/* Returns a pointer to the value of key, adding it with value val first if \
+   it isn't there. */                                                       \
+static inline val_type *name##_get_or_put(struct name *m, key_type key,     \
+                                          val_type val)                     \
+{                                                                           \
+    bool added;                                                             \
+    size_t i = name##_slot_(m, key, &added);                                \
+    if (i == SIZE_MAX)                                                      \
+        return NULL;                                                        \
+    if (added)                                                              \
+        m->vals[i] = val;                                                   \
+    return m->vals + i;                                                     \
+}
+
+/**
+  Defines a hash set, struct name, and static inline functions to manage it:
+  name_init(), name_init_allocator(), name_reserve(), name_add(),
+  name_find(), name_contains(), name_next(), name_remove(),
+  name_remove_at(), name_clear() and name_free(). Slot i is in use if
+  name_next(s, i) == i, in which case its key is s->keys[i]. All functions
+  that allocate return false if memory runs out, leaving the set unchanged.
+
+  @param name Name of the struct and prefix of the functions
+  @param key_type Type of the keys
+  @param hash Function returning the uint64_t hash of a key
+  @param eq Function returning true if two keys are equal
+  */
+#define U_HASH_SET_DEFINE(name, key_type, hash, eq)                         \
+struct name {                                                               \
+    size_t len;                                                             \
+    size_t capacity;                                                        \
+    uint8_t *ctrl;                                                          \
+    key_type *keys;                                                         \
+    const struct u_allocator *allocator;                                    \
+};                                                                          \
+                                                                            \
+static inline bool name##_vals_new_(struct name *s)                         \
+{                                                                           \
+    (void)s;                                                                \
+    return true;                                                            \
+}                                                                           \
+                                                                            \
+static inline void name##_vals_free_(struct name *s)                        \
+{                                                                           \
+    (void)s;                                                                \
+}                                                                           \
+                                                                            \
+static inline void name##_val_move_(struct name *dst, size_t i,             \
+                                    const struct name *src, size_t j)       \
+{                                                                           \
+    (void)dst;                                                              \
+    (void)i;                                                                \
+    (void)src;                                                              \
+    (void)j;                                                                \
+}                                                                           \
+                                                                            \
+U_HASH_TABLE_FUNCS_(name, key_type, hash, eq)                               \
+                                                                            \
+/* Adds key if it isn't there. s->len grows by one if it wasn't. */         \
+static inline bool name##_add(struct name *s, key_type key)                 \
+{                                                                           \
+    bool added;                                                             \
+    return name##_slot_(s, key, &added) != SIZE_MAX;                        \
+}
+
+#endif
@@ -0,0 +1,396 @@
+/**
+  @file
+
+  @brief Typed d-ary heaps (priority queues), plain and indexed.
+
+  U_HEAP_DEFINE(name, type, less, d) generates struct name, an array of type
+  kept in heap order, and static inline functions to manage it. The top of
+  the heap is an element that no other element is less than, so with
+  u_less() (see sorted.h) it is the smallest. Each node has d children, and
+  the d children of a node sit next to each other in memory, so a heap with
+  d = 4 or 8 takes about half or a third of the levels of a binary heap and
+  compares children within one or two cache lines.
+
+  U_INDEXED_HEAP_DEFINE(name, type, less, d) generates a heap of integer ids,
+  each with a key of type, that also knows where each id is. It can change
+  the key of an id already in the heap (e.g. decrease-key in Dijkstra's
+  algorithm or rescheduling an event) and remove any id.
+
+  Both heaps grow like arrays from U_ARRAY_DEFINE(), taking the thread's
+  allocator on their first allocation unless name_init_allocator() gave them
+  one, and never allocate once name_reserve() has made room for the elements
+  (or ids) used. Functions that allocate return false, leaving the heap
+  unchanged, if memory runs out.
+
+  @verbatim
+  // The 10 largest values of column 2
+  U_HEAP_DEFINE(min_heap, double, u_less, 4)
+
+  struct min_heap h;
+  min_heap_init(&h);
+  min_heap_reserve(&h, 10);
+  for (size_t i = 0; i < df.rows; ++i) {
+          double x = u_dataframe_at(&df, i, 2).dbl;
+          if (h.len < 10)
+                  min_heap_push(&h, x);
+          else if (x > min_heap_top(&h))
+                  min_heap_replace_top(&h, x);
+  }
+  @endverbatim
+*/
+
+#ifndef USEFUL_HEAP_H
+#define USEFUL_HEAP_H
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "useful/array.h"
+
+/**
+  Defines a d-ary heap, struct name, and static inline functions to manage
+  it: name_init(), name_init_allocator(), name_reserve(), name_push(),
+  name_top(), name_pop(), name_replace_top(), name_heapify(), name_clear()
+  and name_free(). The elements are vals[0] to vals[len - 1], in heap order.
+
+  @param name Name of the struct and prefix of the functions
+  @param type Type of the elements
+  @param less Function or macro returning true if its first argument must
+  come out of the heap before its second
+  @param d Number of children of each node, at least 2
+  */
+#define U_HEAP_DEFINE(name, type, less, d)                                  \
+struct name {                                                               \
+    size_t len;                                                             \
+    size_t capacity;                                                        \
+    type *vals;                                                             \
+    const struct u_allocator *allocator;                                    \
+};                                                                          \
+                                                                            \
+static inline void name##_init_allocator(struct name *h,                    \
+                                         const struct u_allocator *alloc)   \
+{                                                                           \
+    h->len = h->capacity = 0;                                               \
+    h->vals = NULL;                                                         \
+    h->allocator = alloc;                                                   \
+}                                                                           \
+                                                                            \
+static inline void name##_init(struct name *h)                              \
+{                                                                           \
+    name##_init_allocator(h, NULL);                                         \
+}                                                                           \
+                                                                            \
+static inline bool name##_reserve(struct name *h, size_t n)                 \
+{                                                                           \
+    if (n <= h->capacity)                                                   \
+        return true;                                                        \
+    size_t capacity = u_array_next_capacity(h->capacity, n, sizeof(type));  \
+    if (capacity == 0) {                                                    \
+        errno = ENOMEM;                                                     \
+        return false;                                                       \
+    }                                                                       \
+    if (h->allocator == NULL)                                               \
+        h->allocator = u_allocator_get();                                   \
+    type *t = u_array_resize(h->allocator, h->vals,                         \
+                             h->capacity * sizeof(type),                    \
+                             capacity * sizeof(type));                      \
+    if (t == NULL)                                                          \
+        return false;                                                       \
+    h->vals = t;                                                            \
+    h->capacity = capacity;                                                 \
+    return true;                                                            \
+}                                                                           \
+                                                                            \
+static inline void name##_sift_up_(struct name *h, size_t i, type x)        \
+{                                                                           \
+    while (i > 0) {                                                         \
+        size_t parent = (i - 1) / (d);                                      \
+        if (!less(x, h->vals[parent]))                                      \
+            break;                                                          \
+        h->vals[i] = h->vals[parent];                                       \
+        i = parent;                                                         \
+    }                                                                       \
+    h->vals[i] = x;                                                         \
+}                                                                           \
+                                                                            \
+static inline void name##_sift_down_(struct name *h, size_t i, type x)      \
+{                                                                           \
+    for (;;) {                                                              \
+        size_t first = (d) * i + 1;                                         \
+        if (first >= h->len)                                                \
+            break;                                                          \
+        size_t last = first + (d) < h->len ? first + (d) : h->len;          \
+        size_t best = first;                                                \
+        for (size_t c = first + 1; c < last; ++c)                           \
+            if (less(h->vals[c], h->vals[best]))                            \
+                best = c;                                                   \
+        if (!less(h->vals[best], x))                                        \
+            break;                                                          \
+        h->vals[i] = h->vals[best];                                         \
+        i = best;                                                           \
+    }                                                                       \
+    h->vals[i] = x;                                                         \
+}                                                                           \
+                                                                            \
+static inline bool name##_push(struct name *h, type x)                      \
+{                                                                           \
+    if (h->len == h->capacity && !name##_reserve(h, h->len + 1))            \
+        return false;                                                       \
+    name##_sift_up_(h, h->len++, x);                                        \
+    return true;                                                            \
+}                                                                           \
+                                                                            \
+static inline type name##_top(const struct name *h)                         \
+{                                                                           \
+    assert(h->len);                                                         \
+    return h->vals[0];                                                      \
+}                                                                           \
+                                                                            \
+static inline type name##_pop(struct name *h)                               \
+{                                                                           \
+    assert(h->len);                                                         \
+    type top = h->vals[0];                                                  \
+    if (--h->len)                                                           \
+        name##_sift_down_(h, 0, h->vals[h->len]);                           \
+    return top;                                                             \
+}                                                                           \
+                                                                            \
+/* Pops the top and pushes x in one pass, returning the old top. */         \
+static inline type name##_replace_top(struct name *h, type x)               \
+{                                                                           \
+    assert(h->len);                                                         \
+    type top = h->vals[0];                                                  \
+    name##_sift_down_(h, 0, x);                                             \
+    return top;                                                             \
+}                                                                           \
+                                                                            \
+/* Adds n elements at once, in O(len + n) time. */                          \
+static inline bool name##_heapify(struct name *h, type const *vals,         \
+                                  size_t n)                                 \
+{                                                                           \
+    if (n > SIZE_MAX - h->len || !name##_reserve(h, h->len + n))            \
+        return false;                                                       \
+    if (n)                                                                  \
+        memcpy(h->vals + h->len, vals, n * sizeof(type));                   \
+    h->len += n;                                                            \
+    for (size_t i = h->len > 1 ? (h->len - 2) / (d) + 1 : 0; i-- > 0;)      \
+        name##_sift_down_(h, i, h->vals[i]);                                \
+    return true;                                                            \
+}                                                                           \
+                                                                            \
+static inline void name##_clear(struct name *h)                             \
+{                                                                           \
+    h->len = 0;                                                             \
+}                                                                           \
+                                                                            \
+static inline void name##_free(struct name *h)                              \
+{                                                                           \
+    u_array_release(h->allocator, h->vals, h->capacity * sizeof(type));     \
+    name##_init_allocator(h, h->allocator);                                 \
+}
+
+/**
+  Id not in an indexed heap.
+  */
+#define U_HEAP_ABSENT SIZE_MAX
+
+/**
+  Defines an indexed d-ary heap, struct name, and static inline functions to
+  manage it: name_init(), name_init_allocator(), name_reserve(), name_push(),
+  name_contains(), name_key(), name_top(), name_pop(), name_update(),
+  name_remove(), name_clear() and name_free(). Ids are integers from 0 up;
+  the memory used grows with the largest id pushed.
+
+  @param name Name of the struct and prefix of the functions
+  @param type Type of the keys
+  @param less Function or macro returning true if its first argument must
+  come out of the heap before its second
+  @param d Number of children of each node, at least 2
+  */
+#define U_INDEXED_HEAP_DEFINE(name, type, less, d)                          \
+struct name {                                                               \
+    size_t len;                                                             \
+    size_t capacity;   /* Ids that fit */                                   \
+    size_t *ids;       /* Ids in heap order */                              \
+    size_t *pos;       /* Index in ids of each id, or U_HEAP_ABSENT */      \
+    type *keys;        /* Key of each id */                                 \
+    const struct u_allocator *allocator;                                    \
+};                                                                          \
+                                                                            \
+static inline void name##_init_allocator(struct name *h,                    \
+                                         const struct u_allocator *alloc)   \
+{                                                                           \
+    h->len = h->capacity = 0;                                               \
+    h->ids = h->pos = NULL;                                                 \
+    h->keys = NULL;                                                         \
+    h->allocator = alloc;                                                   \
+}                                                                           \
+                                                                            \
+static inline void name##_init(struct name *h)                              \
+{                                                                           \
+    name##_init_allocator(h, NULL);                                         \
+}                                                                           \
+                                                                            \
+static inline void name##_free(struct name *h)                              \
+{                                                                           \
+    size_t n = h->capacity;                                                 \
+    u_array_release(h->allocator, h->ids, n * sizeof(size_t));              \
+    u_array_release(h->allocator, h->pos, n * sizeof(size_t));              \
+    u_array_release(h->allocator, h->keys, n * sizeof(type));               \
+    name##_init_allocator(h, h->allocator);                                 \
+}                                                                           \
+                                                                            \
+/* Makes room for ids below n. */                                           \
+static inline bool name##_reserve(struct name *h, size_t n)                 \
+{                                                                           \
+    if (n <= h->capacity)                                                   \
+        return true;                                                        \
+    size_t size = sizeof(type) > sizeof(size_t) ? sizeof(type)              \
+        : sizeof(size_t);                                                   \
+    size_t capacity = u_array_next_capacity(h->capacity, n, size);          \
+    if (capacity == 0) {                                                    \
+        errno = ENOMEM;                                                     \
+        return false;                                                       \
+    }                                                                       \
+    if (h->allocator == NULL)                                               \
+        h->allocator = u_allocator_get();                                   \
+    size_t *ids = u_array_resize(h->allocator, NULL, 0,                     \
+                                 capacity * sizeof(size_t));                \
+    size_t *pos = u_array_resize(h->allocator, NULL, 0,                     \
+                                 capacity * sizeof(size_t));                \
+    type *keys = u_array_resize(h->allocator, NULL, 0,                      \
+                                capacity * sizeof(type));                   \
+    if (ids == NULL || pos == NULL || keys == NULL) {                       \
+        u_array_release(h->allocator, ids, capacity * sizeof(size_t));      \
+        u_array_release(h->allocator, pos, capacity * sizeof(size_t));      \
+        u_array_release(h->allocator, keys, capacity * sizeof(type));       \
+        return false;                                                       \
+    }                                                                       \
+    if (h->capacity) {                                                      \
+        memcpy(ids, h->ids, h->len * sizeof(size_t));                       \
+        memcpy(pos, h->pos, h->capacity * sizeof(size_t));                  \
+        memcpy(keys, h->keys, h->capacity * sizeof(type));                  \
+    }                                                                       \
+    for (size_t i = h->capacity; i < capacity; ++i)                         \
+        pos[i] = U_HEAP_ABSENT;                                             \
+    size_t len = h->len;                                                    \
+    name##_free(h);                                                         \
+    h->len = len;                                                           \
+    h->capacity = capacity;                                                 \
+    h->ids = ids;                                                           \
+    h->pos = pos;                                                           \
+    h->keys = keys;                                                         \
+    return true;                                                            \
+}                                                                           \
+                                                                            \
+static inline void name##_place_(struct name *h, size_t i, size_t id)       \
+{                                                                           \
+    h->ids[i] = id;                                                         \
+    h->pos[id] = i;                                                         \
+}                                                                           \
+                                                                            \
+static inline void name##_sift_up_(struct name *h, size_t i, size_t id)     \
+{                                                                           \
+    while (i > 0) {                                                         \
+        size_t parent = (i - 1) / (d);                                      \
+        if (!less(h->keys[id], h->keys[h->ids[parent]]))                    \
+            break;                                                          \
+        name##_place_(h, i, h->ids[parent]);                                \
+        i = parent;                                                         \
+    }                                                                       \
+    name##_place_(h, i, id);                                                \
+}                                                                           \
+                                                                            \
+static inline void name##_sift_down_(struct name *h, size_t i, size_t id)   \
+{                                                                           \
+    for (;;) {                                                              \
+        size_t first = (d) * i + 1;                                         \
+        if (first >= h->len)                                                \
+            break;                                                          \
+        size_t last = first + (d) < h->len ? first + (d) : h->len;          \
+        size_t best = first;                                                \
+        for (size_t c = first + 1; c < last; ++c)                           \
+            if (less(h->keys[h->ids[c]], h->keys[h->ids[best]]))            \
+                best = c;                                                   \
+        if (!less(h->keys[h->ids[best]], h->keys[id]))                      \
+            break;                                                          \
+        name##_place_(h, i, h->ids[best]);                                  \
+        i = best;                                                           \
+    }                                                                       \
+    name##_place_(h, i, id);                                                \
+}                                                                           \
+                                                                            \
+static inline bool name##_contains(const struct name *h, size_t id)         \
+{                                                                           \
+    return id < h->capacity && h->pos[id] != U_HEAP_ABSENT;                 \
+}                                                                           \
+                                                                            \
+static inline type name##_key(const struct name *h, size_t id)              \
+{                                                                           \
+    assert(name##_contains(h, id));                                         \
+    return h->keys[id];                                                     \
+}                                                                           \
+                                                                            \
+/* Sets the key of id, adding id if it isn't in the heap. */                \
+static inline bool name##_update(struct name *h, size_t id, type key)       \
+{                                                                           \
+    if (id == SIZE_MAX || !name##_reserve(h, id + 1))                       \
+        return false;                                                       \
+    size_t i = h->pos[id];                                                  \
+    if (i == U_HEAP_ABSENT) {                                               \
+        h->keys[id] = key;                                                  \
+        name##_sift_up_(h, h->len++, id);                                   \
+    } else if (less(key, h->keys[id])) {                                    \
+        h->keys[id] = key;                                                  \
+        name##_sift_up_(h, i, id);                                          \
+    } else {                                                                \
+        h->keys[id] = key;                                                  \
+        name##_sift_down_(h, i, id);                                        \
+    }                                                                       \
+    return true;                                                            \
+}                                                                           \
+                                                                            \
+/* Adds id, which mustn't be in the heap, with key. */                      \
+static inline bool name##_push(struct name *h, size_t id, type key)         \
+{                                                                           \
+    assert(!name##_contains(h, id));                                        \
+    return name##_update(h, id, key);                                       \
+}                                                                           \
+                                                                            \
+static inline size_t name##_top(const struct name *h)                       \
+{                                                                           \
+    assert(h->len);                                                         \
+    return h->ids[0];                                                       \
+}                                                                           \
+                                                                            \
+static inline void name##_remove(struct name *h, size_t id)                 \
+{                                                                           \
+    assert(name##_contains(h, id));                                         \
+    size_t i = h->pos[id];                                                  \
+    h->pos[id] = U_HEAP_ABSENT;                                             \
+    if (i == --h->len)                                                      \
+        return;                                                             \
+    size_t last = h->ids[h->len];                                           \
+    if (i > 0 && less(h->keys[last], h->keys[h->ids[(i - 1) / (d)]]))       \
+        name##_sift_up_(h, i, last);                                        \
+    else                                                                    \
+        name##_sift_down_(h, i, last);                                      \
+}                                                                           \
+                                                                            \
+static inline size_t name##_pop(struct name *h)                             \
+{                                                                           \
+    size_t id = name##_top(h);                                              \
+    name##_remove(h, id);                                                   \
+    return id;                                                              \
+}                                                                           \
+                                                                            \
+static inline void name##_clear(struct name *h)                             \
+{                                                                           \
+    for (size_t i = 0; i < h->len; ++i)                                     \
+        h->pos[h->ids[i]] = U_HEAP_ABSENT;                                  \
+    h->len = 0;                                                             \
+}
+
+#endif
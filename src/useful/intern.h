@@ -0,0 +1,77 @@
+/**
+   @file
+
+   @brief A thread-safe string interner.
+
+   A struct u_interner keeps one copy of each distinct string given to it.
+   u_intern() returns that copy, so two strings interned in the same
+   interner are equal exactly when their pointers are, and u_intern_handle()
+   returns a small integer handle for it, numbered from 0 in the order the
+   strings were first seen. Interned strings live until the interner is
+   freed and must not be changed.
+
+   Any number of threads may intern strings at once. The table is split
+   into U_INTERN_SHARDS shards by hash, each with its own lock, open
+   addressing hash table (see hash.h) and arena (see allocator.h) holding its
+   strings, so threads rarely wait for each other and interning a new string
+   costs one copy into an arena, not a malloc. Turning a handle back into a
+   string with u_intern_str() takes no lock.
+
+   The CSV reader can intern every cell (see u_csv_read_interned()), which
+   saves a great deal of memory when the same values repeat down a column.
+
+   @verbatim
+   struct u_interner *in = u_interner_new();
+   uint32_t a = u_intern_handle(in, "red");
+   uint32_t b = u_intern_handle(in, "green");
+   assert(u_intern_handle(in, "red") == a);
+   assert(!strcmp(u_intern_str(in, b), "green"));
+   u_interner_free(in);
+   @endverbatim
+*/
+
+#ifndef USEFUL_INTERN_H
+#define USEFUL_INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+   Number of independently locked shards of an interner.
+ */
+#ifndef U_INTERN_SHARDS
+#define U_INTERN_SHARDS 64
+#endif
+
+/**
+   Handle meaning no string: returned when a string isn't found or can't be
+   interned.
+ */
+#define U_INTERN_NONE UINT32_MAX
+
+struct u_interner;
+
+/**
+   Gets the handle of a string returned by u_intern() without looking it up.
+
+   @param interned String returned by u_intern() or u_intern_str()
+ */
+static inline uint32_t u_interned_handle(const char *interned)
+{
+        uint32_t h;
+        memcpy(&h, interned - sizeof(h), sizeof(h));
+        return h;
+}
+
+struct u_interner *u_interner_new(void);
+void u_interner_free(struct u_interner *in);
+size_t u_interner_len(const struct u_interner *in);
+const char *u_intern(struct u_interner *in, const char *s);
+const char *u_intern_n(struct u_interner *in, const char *s, size_t len);
+uint32_t u_intern_handle(struct u_interner *in, const char *s);
+uint32_t u_intern_handle_n(struct u_interner *in, const char *s, size_t len);
+uint32_t u_intern_find(struct u_interner *in, const char *s);
+const char *u_intern_str(const struct u_interner *in, uint32_t handle);
+
+#endif
@@ -0,0 +1,67 @@
+/**
+   @file
+
+   @brief Fast reading of text files a line at a time.
+
+   A struct u_lines reads a file in large blocks (U_LINES_BUFFER bytes) into
+   a buffer of its own and finds the newlines in it with memchr(), which
+   libc vectorizes, instead of going through stdio a char at a time.
+   u_lines_next() hands back each line as a view into that buffer, without
+   copying it, and u_lines_read() copies it into a struct u_string with one
+   memcpy(). Lines longer than the buffer make it grow.
+
+   Opened with map set, a regular file is mapped into memory instead, so
+   lines are views straight into the page cache: nothing is copied at all,
+   and views stay valid until the file is closed. Don't map files that
+   something else may truncate while they are being read.
+
+   @verbatim
+   struct u_lines lines = u_lines_open("service.log", true);
+   struct u_string_view line;
+   size_t errors = 0;
+   while (u_lines_next(&lines, &line))
+           errors += line.len >= 5 && !memcmp(line.str, "ERROR", 5);
+   if (lines.error)
+           perror("service.log");
+   u_lines_close(&lines);
+   @endverbatim
+*/
+
+#ifndef USEFUL_LINES_H
+#define USEFUL_LINES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "useful/string.h"
+
+/**
+   Number of bytes read from the file at a time.
+ */
+#ifndef U_LINES_BUFFER
+#define U_LINES_BUFFER (1 << 20)
+#endif
+
+/**
+   Holds the state of a file being read a line at a time.
+ */
+struct u_lines {
+        int fd;
+        bool own_fd;            // fd is closed by u_lines_close()
+        bool mapped;            // buf is the whole file, mapped into memory
+        bool eof;               // Everything has been read into buf
+        int error;              // errno of a failed read, or 0
+        // Bytes read but not yet returned are buf[start] to buf[len - 1]
+        size_t start;
+        size_t len;
+        size_t capacity;
+        char *buf;
+};
+
+struct u_lines u_lines_open(const char *path, bool map);
+struct u_lines u_lines_fdopen(int fd);
+bool u_lines_next(struct u_lines *lines, struct u_string_view *line);
+char *u_lines_read(struct u_lines *lines, struct u_string *dest);
+void u_lines_close(struct u_lines *lines);
+
+#endif
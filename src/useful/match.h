@@ -0,0 +1,84 @@
+/**
+   @file
+
+   @brief Searching text for one or many patterns.
+
+   u_find() finds the first occurrence of a pattern. On x86-64 it compares
+   the first and last chars of the pattern against 16 or, on CPUs with AVX2
+   (checked at run time), 32 positions of the text at once and only compares
+   the rest of the pattern where both match, so it rarely looks at a
+   position twice. u_view_find() and u_string_find() do the same for string
+   views and struct u_string (see string.h).
+
+   To look for many patterns at once, build a struct u_matcher from them
+   with u_matcher_new(). It is an Aho-Corasick automaton, compiled into a
+   table with one transition per state and class of chars, so that finding
+   every occurrence of every pattern takes one table lookup per char of the
+   text, however many patterns there are. Patterns that are prefixes or
+   suffixes of each other, or overlap in the text, are all found. A matcher
+   never changes once built, so any number of threads may use it at once.
+
+   @verbatim
+   struct u_string_view words[] = {
+           { "timeout", 7 }, { "refused", 7 }, { "reset", 5 },
+   };
+   struct u_matcher *m = u_matcher_new(words, 3);
+   struct u_match found[16];
+   for (size_t i = 0; i < cs.len; ++i) {
+           const char *cell = cs.rows[i].cells[3];
+           size_t n = u_matcher_find(m, u_string_view_of(cell), found, 16);
+           for (size_t k = 0; k < n && k < 16; ++k)
+                   printf("%zu: %s at %zu\n", i, words[found[k].pattern].str,
+                          found[k].offset);
+   }
+   u_matcher_free(m);
+   @endverbatim
+*/
+
+#ifndef USEFUL_MATCH_H
+#define USEFUL_MATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "useful/string.h"
+
+/**
+   Offset returned when a pattern isn't found.
+ */
+#define U_NOT_FOUND SIZE_MAX
+
+/**
+   An occurrence of one of the patterns of a struct u_matcher.
+ */
+struct u_match {
+        size_t pattern;         // Index of the pattern
+        size_t offset;          // Offset of its first char in the text
+};
+
+struct u_matcher;
+
+size_t u_find(const char *text, size_t n, const char *pattern, size_t m);
+
+/**
+   Finds the first occurrence of a pattern in a view.
+
+   @return Offset of the occurrence, or U_NOT_FOUND
+ */
+static inline size_t u_view_find(struct u_string_view text,
+                                 struct u_string_view pattern)
+{
+        return u_find(text.str, text.len, pattern.str, pattern.len);
+}
+
+size_t u_string_find(const struct u_string *s, size_t from,
+                     const char *pattern);
+struct u_matcher *u_matcher_new(const struct u_string_view *patterns,
+                                size_t n);
+size_t u_matcher_find(const struct u_matcher *m, struct u_string_view text,
+                      struct u_match *matches, size_t max);
+bool u_matcher_any(const struct u_matcher *m, struct u_string_view text);
+void u_matcher_free(struct u_matcher *m);
+
+#endif
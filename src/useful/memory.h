@@ -0,0 +1,43 @@
+/**
+   @file
+
+   @brief Aligned allocation for large numeric buffers.
+
+   u_aligned_alloc() returns memory aligned to U_ALIGNMENT bytes (a cache line
+   by default) so that vector loads of doubles never straddle cache lines.
+   Requests of at least U_HUGE_PAGE_THRESHOLD bytes are served directly by
+   mmap, first trying explicit huge pages (MAP_HUGETLB) and falling back to
+   ordinary pages with a madvise(MADV_HUGEPAGE) hint. Smaller requests, and
+   every request on systems without mmap, come from the calling thread's
+   allocator (see allocator.h).
+
+   Memory from these functions must be resized with u_aligned_realloc() and
+   returned with u_aligned_free(), never with realloc() or free().
+*/
+
+#ifndef USEFUL_MEMORY_H
+#define USEFUL_MEMORY_H
+
+#include <stddef.h>
+
+/**
+   Alignment in bytes of memory returned by u_aligned_alloc(). Must be a power
+   of two of at least 32.
+ */
+#ifndef U_ALIGNMENT
+#define U_ALIGNMENT 64
+#endif
+
+/**
+   Allocations of at least this many bytes are mapped with huge pages where
+   the system allows it.
+ */
+#ifndef U_HUGE_PAGE_THRESHOLD
+#define U_HUGE_PAGE_THRESHOLD (4 * 1024 * 1024)
+#endif
+
+void *u_aligned_alloc(size_t size);
+void *u_aligned_realloc(void *ptr, size_t size);
+void u_aligned_free(void *ptr);
+
+#endif
@@ -0,0 +1,138 @@
+/**
+   @file
+
+   @brief Lazy, fused queries over CSV files.
+
+   A query is built from a CSV source followed by any sequence of stages:
+   filters, projections, derived columns, sinks and aggregates. Building a
+   query does no work. u_query_run() then makes a single streaming pass over
+   the file, reading U_QUERY_BATCH rows at a time into reused buffers and
+   pushing each batch through every stage in turn. No struct u_csv or
+   struct u_dataframe is ever built, so memory use is bounded by the batch
+   size, not the file size.
+
+   Cells are passed to callbacks as an array of null-terminated strings. The
+   strings are only valid for the duration of the callback.
+
+   Here is an example that prints the mean of the third column of the rows
+   whose first column is "Joe", along with the number of such rows:
+
+   @verbatim
+   static bool is_joe(const char *cells[], size_t n, void *data)
+   {
+           return n > 0 && strcmp(cells[0], "Joe") == 0;
+   }
+
+   double mean, count;
+   struct u_query q = u_query_csv(f, true, ',');
+   u_query_filter(&q, is_joe, NULL);
+   u_query_aggregate(&q, 2, u_mean, &mean);
+   u_query_aggregate(&q, 2, u_count, &count);
+   u_query_run(&q);
+   u_query_free(&q);
+   @endverbatim
+*/
+
+#ifndef USEFUL_QUERY_H
+#define USEFUL_QUERY_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "useful/csv.h"
+#include "useful/string.h"
+
+/**
+   Number of rows read and processed together by u_query_run().
+ */
+#ifndef U_QUERY_BATCH
+#define U_QUERY_BATCH 1024
+#endif
+
+/**
+   Row predicate for u_query_filter(). Return true to keep the row.
+ */
+typedef bool (*u_query_pred) (const char *cells[], size_t n, void *data);
+
+/**
+   Column generator for u_query_derive(). Write the value of the new column
+   into out, which is empty on entry.
+ */
+typedef void (*u_query_derive_func) (const char *cells[], size_t n,
+                                     struct u_string * out, void *data);
+
+/**
+   Row consumer for u_query_sink().
+ */
+typedef void (*u_query_sink_func) (const char *cells[], size_t n, void *data);
+
+/**
+   Reductions available to u_query_aggregate(). Cells that aren't numbers are
+   NA and are skipped, as in u_dataframe_sum() and friends.
+ */
+enum u_aggregate {
+        u_count,
+        u_sum,
+        u_min,
+        u_max,
+        u_mean
+};
+
+/**
+   Kinds of query stage.
+ */
+enum u_query_stage_type {
+        u_query_filter_stage,
+        u_query_project_stage,
+        u_query_derive_stage,
+        u_query_sink_stage,
+        u_query_write_stage,
+        u_query_aggregate_stage
+};
+
+/**
+   One step of a query.
+ */
+struct u_query_stage {
+        enum u_query_stage_type type;
+        void *data;
+        union {
+                u_query_pred pred;
+                u_query_derive_func derive;
+                u_query_sink_func sink;
+                FILE *f;
+        };
+        // Columns kept by a projection, or the column aggregated.
+        size_t *cols;
+        size_t ncols;
+        // Aggregate destination and running state
+        enum u_aggregate agg;
+        double *result;
+        double acc;
+        size_t n;
+};
+
+/**
+   Holds a query until it is run.
+ */
+struct u_query {
+        FILE *f;
+        bool header;
+        char delim;
+        size_t len;
+        size_t capacity;
+        struct u_query_stage *stages;
+};
+
+struct u_query u_query_csv(FILE * f, bool header, char delim);
+void u_query_filter(struct u_query *q, u_query_pred pred, void *data);
+void u_query_project(struct u_query *q, const size_t cols[], size_t n);
+void u_query_derive(struct u_query *q, u_query_derive_func derive, void *data);
+void u_query_sink(struct u_query *q, u_query_sink_func sink, void *data);
+void u_query_write(struct u_query *q, FILE * f);
+void u_query_aggregate(struct u_query *q, size_t col, enum u_aggregate agg,
+                       double *result);
+size_t u_query_run(struct u_query *q);
+void u_query_free(struct u_query *q);
+
+#endif
@@ -0,0 +1,285 @@
+/**
+  @file
+
+  @brief Bounded lock-free queues for passing values between threads.
+
+  U_SPSC_DEFINE(name, type) generates a ring buffer, struct name, for one
+  producer thread and one consumer thread. Each side owns one index and
+  reads the other's with acquire loads only when its cached copy says the
+  ring is full (or empty), so in the steady state a push or pop touches no
+  cache line the other thread writes.
+
+  U_MPMC_DEFINE(name, type) generates a queue, struct name, that any number
+  of threads may push to and pop from at once. It is Dmitry Vyukov's bounded
+  queue: every slot has a sequence number that says whether it is ready to
+  be written or read on the current lap, and producers (consumers) claim
+  slots with a compare-and-swap on a shared index.
+
+  Both use C11 atomics. The indices written by different threads are kept
+  on separate cache lines (U_CACHE_LINE bytes), and the slots come from
+  u_aligned_alloc(). Capacities are rounded up to a power of two. Push and
+  pop never block: they return false when the queue is full or empty. The
+  batch functions name_push_n() and name_pop_n() move as many values as
+  they can, up to n, with one synchronization, and return how many.
+
+  @verbatim
+  U_SPSC_DEFINE(row_queue, struct u_csv_row *)
+
+  struct row_queue q;
+  row_queue_init(&q, 1024);
+  // reader thread
+  while (!row_queue_push(&q, row))
+          sched_yield();
+  // worker thread
+  struct u_csv_row *batch[64];
+  size_t n = row_queue_pop_n(&q, batch, 64);
+  @endverbatim
+*/
+
+#ifndef USEFUL_QUEUE_H
+#define USEFUL_QUEUE_H
+
+#include <errno.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "useful/memory.h"
+
+/**
+  Size of a cache line. Indices written by different threads are this far
+  apart.
+  */
+#ifndef U_CACHE_LINE
+#define U_CACHE_LINE 64
+#endif
+
+/**
+  Rounds a queue capacity up to a power of two, at least 2. Returns 0 if it
+  would overflow.
+  */
+static inline size_t u_queue_capacity(size_t n)
+{
+        size_t capacity = 2;
+        while (capacity < n) {
+                if (capacity > SIZE_MAX / 2)
+                        return 0;
+                capacity *= 2;
+        }
+        return capacity;
+}
+
+/**
+  Defines a single-producer single-consumer ring buffer, struct name, and
+  static inline functions to manage it: name_init(), name_push(),
+  name_push_n(), name_pop(), name_pop_n(), name_len() and name_free().
+
+  @param name Name of the struct and prefix of the functions
+  @param type Type of the values
+  */
+#define U_SPSC_DEFINE(name, type)                                           \
+struct name {                                                               \
+    alignas(U_CACHE_LINE) atomic_size_t head;   /* Written by consumer */   \
+    size_t tail_cache;                                                      \
+    alignas(U_CACHE_LINE) atomic_size_t tail;   /* Written by producer */   \
+    size_t head_cache;                                                      \
+    alignas(U_CACHE_LINE) size_t mask;                                      \
+    type *vals;                                                             \
+};                                                                          \
+                                                                            \
+/* Initializes a ring that holds at least capacity values. */               \
+static inline bool name##_init(struct name *q, size_t capacity)             \
+{                                                                           \
+    capacity = u_queue_capacity(capacity);                                  \
+    if (capacity == 0 || capacity > SIZE_MAX / sizeof(type)) {              \
+        errno = ENOMEM;                                                     \
+        return false;                                                       \
+    }                                                                       \
+    if (NULL == (q->vals = u_aligned_alloc(capacity * sizeof(type))))       \
+        return false;                                                       \
+    q->mask = capacity - 1;                                                 \
+    atomic_init(&q->head, 0);                                               \
+    atomic_init(&q->tail, 0);                                               \
+    q->head_cache = q->tail_cache = 0;                                      \
+    return true;                                                            \
+}                                                                           \
+                                                                            \
+static inline size_t name##_push_n(struct name *q, type const *vals,        \
+                                   size_t n)                                \
+{                                                                           \
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);     \
+    size_t room = q->mask + 1 - (tail - q->head_cache);                     \
+    if (room < n) {                                                         \
+        q->head_cache = atomic_load_explicit(&q->head,                      \
+                                             memory_order_acquire);         \
+        room = q->mask + 1 - (tail - q->head_cache);                        \
+        if (n > room)                                                       \
+            n = room;                                                       \
+    }                                                                       \
+    for (size_t i = 0; i < n; ++i)                                          \
+        q->vals[(tail + i) & q->mask] = vals[i];                            \
+    atomic_store_explicit(&q->tail, tail + n, memory_order_release);        \
+    return n;                                                               \
+}                                                                           \
+                                                                            \
+static inline bool name##_push(struct name *q, type val)                    \
+{                                                                           \
+    return name##_push_n(q, &val, 1) == 1;                                  \
+}                                                                           \
+                                                                            \
+static inline size_t name##_pop_n(struct name *q, type *vals, size_t n)     \
+{                                                                           \
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);     \
+    size_t avail = q->tail_cache - head;                                    \
+    if (avail < n) {                                                        \
+        q->tail_cache = atomic_load_explicit(&q->tail,                      \
+                                             memory_order_acquire);         \
+        avail = q->tail_cache - head;                                       \
+        if (n > avail)                                                      \
+            n = avail;                                                      \
+    }                                                                       \
+    for (size_t i = 0; i < n; ++i)                                          \
+        vals[i] = q->vals[(head + i) & q->mask];                            \
+    atomic_store_explicit(&q->head, head + n, memory_order_release);        \
+    return n;                                                               \
+}                                                                           \
+                                                                            \
+static inline bool name##_pop(struct name *q, type *val)                    \
+{                                                                           \
+    return name##_pop_n(q, val, 1) == 1;                                    \
+}                                                                           \
+                                                                            \
+/* Number of values in the ring. Only a hint while both threads run. */     \
+static inline size_t name##_len(struct name *q)                             \
+{                                                                           \
+    return atomic_load_explicit(&q->tail, memory_order_acquire) -           \
+        atomic_load_explicit(&q->head, memory_order_acquire);               \
+}                                                                           \
+                                                                            \
+static inline void name##_free(struct name *q)                              \
+{                                                                           \
+    u_aligned_free(q->vals);                                                \
+    q->vals = NULL;                                                         \
+}
+
+/**
+  Defines a multi-producer multi-consumer queue, struct name, and static
+  inline functions to manage it: name_init(), name_push(), name_push_n(),
+  name_pop(), name_pop_n() and name_free().
+
+  @param name Name of the struct and prefix of the functions
+  @param type Type of the values
+  */
+#define U_MPMC_DEFINE(name, type)                                           \
+struct name##_slot {                                                        \
+    atomic_size_t seq;                                                      \
+    type val;                                                               \
+};                                                                          \
+                                                                            \
+struct name {                                                               \
+    alignas(U_CACHE_LINE) atomic_size_t push_pos;                           \
+    alignas(U_CACHE_LINE) atomic_size_t pop_pos;                            \
+    alignas(U_CACHE_LINE) size_t mask;                                      \
+    struct name##_slot *slots;                                              \
+};                                                                          \
+                                                                            \
+/* Initializes a queue that holds at least capacity values. */              \
+static inline bool name##_init(struct name *q, size_t capacity)             \
+{                                                                           \
+    capacity = u_queue_capacity(capacity);                                  \
+    if (capacity == 0 || capacity > SIZE_MAX / sizeof(*q->slots)) {         \
+        errno = ENOMEM;                                                     \
+        return false;                                                       \
+    }                                                                       \
+    q->slots = u_aligned_alloc(capacity * sizeof(*q->slots));               \
+    if (q->slots == NULL)                                                   \
+        return false;                                                       \
+    for (size_t i = 0; i < capacity; ++i)                                   \
+        atomic_init(&q->slots[i].seq, i);                                   \
+    q->mask = capacity - 1;                                                 \
+    atomic_init(&q->push_pos, 0);                                           \
+    atomic_init(&q->pop_pos, 0);                                            \
+    return true;                                                            \
+}                                                                           \
+                                                                            \
+/* Claims up to n consecutive slots whose sequence number is offset past    \
+   their position, returning the first position and setting *n to the       \
+   number claimed. */                                                       \
+static inline size_t name##_claim_(struct name *q, atomic_size_t *index,    \
+                                   size_t offset, size_t *n)                \
+{                                                                           \
+    size_t pos = atomic_load_explicit(index, memory_order_relaxed);         \
+    if (*n == 0)                                                            \
+        return pos;                                                         \
+    for (;;) {                                                              \
+        size_t k = 0;                                                       \
+        while (k < *n) {                                                    \
+            struct name##_slot *s = &q->slots[(pos + k) & q->mask];         \
+            size_t seq = atomic_load_explicit(&s->seq,                      \
+                                              memory_order_acquire);        \
+            if (seq != pos + k + offset)                                    \
+                break;                                                      \
+            ++k;                                                            \
+        }                                                                   \
+        if (k == 0) {                                                       \
+            size_t seq = atomic_load_explicit(&q->slots[pos & q->mask].seq, \
+                                              memory_order_acquire);        \
+            if ((intptr_t)(seq - (pos + offset)) < 0) {                     \
+                *n = 0;                                                     \
+                return pos;                                                 \
+            }                                                               \
+            pos = atomic_load_explicit(index, memory_order_relaxed);        \
+            continue;                                                       \
+        }                                                                   \
+        if (atomic_compare_exchange_weak_explicit(index, &pos, pos + k,     \
+                                                  memory_order_relaxed,     \
+                                                  memory_order_relaxed)) {  \
+            *n = k;                                                         \
+            return pos;                                                     \
+        }                                                                   \
+    }                                                                       \
+}                                                                           \
+                                                                            \
+static inline size_t name##_push_n(struct name *q, type const *vals,        \
+                                   size_t n)                                \
+{                                                                           \
+    size_t pos = name##_claim_(q, &q->push_pos, 0, &n);                     \
+    for (size_t i = 0; i < n; ++i) {                                        \
+        struct name##_slot *s = &q->slots[(pos + i) & q->mask];             \
+        s->val = vals[i];                                                   \
+        atomic_store_explicit(&s->seq, pos + i + 1, memory_order_release);  \
+    }                                                                       \
+    return n;                                                               \
+}                                                                           \
+                                                                            \
+static inline bool name##_push(struct name *q, type val)                    \
+{                                                                           \
+    return name##_push_n(q, &val, 1) == 1;                                  \
+}                                                                           \
+                                                                            \
+static inline size_t name##_pop_n(struct name *q, type *vals, size_t n)     \
+{                                                                           \
+    size_t pos = name##_claim_(q, &q->pop_pos, 1, &n);                      \
+    for (size_t i = 0; i < n; ++i) {                                        \
+        struct name##_slot *s = &q->slots[(pos + i) & q->mask];             \
+        vals[i] = s->val;                                                   \
+        atomic_store_explicit(&s->seq, pos + i + q->mask + 1,               \
+                              memory_order_release);                        \
+    }                                                                       \
+    return n;                                                               \
+}                                                                           \
+                                                                            \
+static inline bool name##_pop(struct name *q, type *val)                    \
+{                                                                           \
+    return name##_pop_n(q, val, 1) == 1;                                    \
+}                                                                           \
+                                                                            \
+static inline void name##_free(struct name *q)                              \
+{                                                                           \
+    u_aligned_free(q->slots);                                               \
+    q->slots = NULL;                                                        \
+}
+
+#endif
@@ -0,0 +1,133 @@
+/**
+   @file
+
+   @brief Fast, seedable pseudorandom numbers.
+
+   A struct u_rng is a xoshiro256** generator: 256 bits of state, a period
+   of 2^256 - 1, output that passes every statistical test in common use,
+   and a few shifts, rotations and multiplications per 64-bit number. It is
+   not suitable for cryptography.
+
+   Each thread has a generator of its own, returned by u_rng_default(),
+   so threads drawing numbers never contend for a lock the way they do in
+   rand(). Each is seeded differently the first time it is used. Seed one
+   with u_rng_seed() to make a run repeatable. For parallel simulations
+   that must be repeatable, seed one generator and hand each thread a copy,
+   calling u_rng_jump() between copies: each jump moves 2^128 numbers
+   ahead, so the copies never overlap.
+
+   u_rng_below() draws an integer below a bound without bias and, almost
+   always, without a division (Lemire's method). u_rng_fill() and
+   u_rng_fill_doubles() fill arrays in bulk, keeping the state in registers.
+
+   @verbatim
+   struct u_rng rng;
+   u_rng_seed(&rng, 42);
+   double x[1000];
+   u_rng_fill_doubles(&rng, x, 1000);
+   uint64_t die = 1 + u_rng_below(&rng, 6);
+   u_rng_shuffle(&rng, x, 1000, sizeof(double));
+   @endverbatim
+*/
+
+#ifndef USEFUL_RANDOM_H
+#define USEFUL_RANDOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+   Seed of the default generator of the first thread to use one. Later
+   threads get the following seeds.
+ */
+#ifndef U_RNG_SEED
+#define U_RNG_SEED 0x5eed
+#endif
+
+/**
+   State of a xoshiro256** generator.
+ */
+struct u_rng {
+        uint64_t s[4];
+};
+
+static inline uint64_t u_rng_rotl_(uint64_t x, int k)
+{
+        return (x << k) | (x >> (64 - k));
+}
+
+/**
+   Draws a number with all 64 bits random.
+ */
+static inline uint64_t u_rng_next(struct u_rng *rng)
+{
+        uint64_t *s = rng->s;
+        uint64_t result = u_rng_rotl_(s[1] * 5, 7) * 9;
+        uint64_t t = s[1] << 17;
+
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = u_rng_rotl_(s[3], 45);
+        return result;
+}
+
+/**
+   Multiplies two 64-bit numbers, returning the high 64 bits of the product
+   and setting *lo to the low 64 bits.
+ */
+static inline uint64_t u_rng_mul_(uint64_t a, uint64_t b, uint64_t *lo)
+{
+#ifdef __SIZEOF_INT128__
+        __extension__ unsigned __int128 p = (unsigned __int128)a * b;
+        *lo = (uint64_t)p;
+        return (uint64_t)(p >> 64);
+#else
+        uint64_t a0 = (uint32_t)a, a1 = a >> 32, b0 = (uint32_t)b, b1 = b >> 32;
+        uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+        uint64_t mid = (p00 >> 32) + (uint32_t)p01 + (uint32_t)p10;
+        *lo = (mid << 32) | (uint32_t)p00;
+        return p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+#endif
+}
+
+/**
+   Draws an integer from 0 to n - 1, every one equally likely. It is the
+   high half of the product of a random number and n, redrawn in the rare
+   case that the low half shows it would favour some results. Only then is
+   a division needed.
+
+   @param rng Generator to draw from
+   @param n Bound, or 0 to get 0
+ */
+static inline uint64_t u_rng_below(struct u_rng *rng, uint64_t n)
+{
+        uint64_t lo, hi = u_rng_mul_(u_rng_next(rng), n, &lo);
+        if (lo < n) {
+                uint64_t threshold = -n % n;
+                while (lo < threshold)
+                        hi = u_rng_mul_(u_rng_next(rng), n, &lo);
+        }
+        return hi;
+}
+
+/**
+   Draws a double uniformly from [0, 1), with 53 random bits.
+ */
+static inline double u_rng_double(struct u_rng *rng)
+{
+        return (u_rng_next(rng) >> 11) * 0x1.0p-53;
+}
+
+void u_rng_seed(struct u_rng *rng, uint64_t seed);
+void u_rng_jump(struct u_rng *rng);
+void u_rng_long_jump(struct u_rng *rng);
+struct u_rng *u_rng_default(void);
+void u_rng_fill(struct u_rng *rng, uint64_t *out, size_t n);
+void u_rng_fill_doubles(struct u_rng *rng, double *out, size_t n);
+void u_rng_fill_bytes(struct u_rng *rng, void *out, size_t n);
+void u_rng_shuffle(struct u_rng *rng, void *data, size_t nmemb, size_t size);
+
+#endif
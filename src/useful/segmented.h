@@ -0,0 +1,201 @@
+/**
+  @file
+
+  @brief Segmented arrays, whose elements never move.
+
+  U_SEGMENTED_DEFINE(name, type, shift) generates struct name, an array of
+  type stored in chunks of 2^shift elements, and static inline functions to
+  manage it. A directory of pointers to the chunks finds element i in chunk
+  i >> shift, so indexing costs one more load than a plain array. Growing
+  allocates a new chunk and at most grows the directory, so:
+
+  - appending never copies the elements already stored;
+  - pointers to elements stay valid until the element is popped, or the
+    array is cleared or freed;
+  - no single allocation is larger than a chunk or the directory, which
+    holds one pointer per chunk.
+
+  Loops over every element run fastest chunk by chunk, with name_chunk(),
+  over consecutive elements:
+
+  @verbatim
+  U_SEGMENTED_DEFINE(dbl_chunks, double, 12)
+
+  struct dbl_chunks s;
+  dbl_chunks_init(&s);
+  for (size_t i = 0; i < n; ++i)
+          dbl_chunks_push(&s, values[i]);
+  double *first = dbl_chunks_at(&s, 0);       // stays valid
+  double sum = 0;
+  for (size_t k = 0; k < dbl_chunks_chunk_count(&s); ++k) {
+          size_t len;
+          double *chunk = dbl_chunks_chunk(&s, k, &len);
+          for (size_t i = 0; i < len; ++i)
+                  sum += chunk[i];
+  }
+  dbl_chunks_free(&s);
+  @endverbatim
+
+  Functions that allocate return false (or NULL), leaving the array
+  unchanged, if memory runs out.
+*/
+
+#ifndef USEFUL_SEGMENTED_H
+#define USEFUL_SEGMENTED_H
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "useful/array.h"
+
+/**
+  Defines a segmented array, struct name, and static inline functions to
+  manage it: name_init(), name_init_allocator(), name_reserve(),
+  name_push(), name_push_n(), name_pop(), name_at(), name_chunk_count(),
+  name_chunk(), name_clear() and name_free(). The directory and chunks come
+  from the allocator given to name_init_allocator() or, failing that, from
+  the thread's allocator when the array first allocates, which it keeps.
+
+  @param name Name of the struct and prefix of the functions
+  @param type Type of the elements
+  @param shift Base 2 logarithm of the number of elements in a chunk
+  */
+#define U_SEGMENTED_DEFINE(name, type, shift)                               \
+struct name {                                                               \
+    size_t len;                                                             \
+    size_t chunks;          /* Chunks allocated */                          \
+    size_t dir_capacity;    /* Chunk pointers the directory holds */        \
+    type **dir;                                                             \
+    const struct u_allocator *allocator;                                    \
+};                                                                          \
+                                                                            \
+static inline void name##_init_allocator(struct name *s,                    \
+                                         const struct u_allocator *alloc)   \
+{                                                                           \
+    s->len = s->chunks = s->dir_capacity = 0;                               \
+    s->dir = NULL;                                                          \
+    s->allocator = alloc;                                                   \
+}                                                                           \
+                                                                            \
+static inline void name##_init(struct name *s)                              \
+{                                                                           \
+    name##_init_allocator(s, NULL);                                         \
+}                                                                           \
+                                                                            \
+/* Makes room for n elements. */                                            \
+static inline bool name##_reserve(struct name *s, size_t n)                 \
+{                                                                           \
+    size_t chunk = (size_t)1 << (shift);                                    \
+    if (n > SIZE_MAX - (chunk - 1)) {                                       \
+        errno = ENOMEM;                                                     \
+        return false;                                                       \
+    }                                                                       \
+    size_t chunks = (n + chunk - 1) >> (shift);                             \
+    if (s->allocator == NULL && chunks > s->chunks)                         \
+        s->allocator = u_allocator_get();                                   \
+    if (chunks > s->dir_capacity) {                                         \
+        size_t capacity = u_array_next_capacity(s->dir_capacity, chunks,    \
+                                                sizeof(type *));            \
+        if (capacity == 0 || chunk > SIZE_MAX / sizeof(type)) {             \
+            errno = ENOMEM;                                                 \
+            return false;                                                   \
+        }                                                                   \
+        type **dir = u_array_resize(s->allocator, s->dir,                   \
+                                    s->dir_capacity * sizeof(type *),       \
+                                    capacity * sizeof(type *));             \
+        if (dir == NULL)                                                    \
+            return false;                                                   \
+        s->dir = dir;                                                       \
+        s->dir_capacity = capacity;                                         \
+    }                                                                       \
+    for (; s->chunks < chunks; ++s->chunks) {                               \
+        s->dir[s->chunks] = u_array_resize(s->allocator, NULL, 0,           \
+                                           chunk * sizeof(type));           \
+        if (s->dir[s->chunks] == NULL)                                      \
+            return false;                                                   \
+    }                                                                       \
+    return true;                                                            \
+}                                                                           \
+                                                                            \
+static inline type *name##_slot_(const struct name *s, size_t i)            \
+{                                                                           \
+    return &s->dir[i >> (shift)][i & (((size_t)1 << (shift)) - 1)];         \
+}                                                                           \
+                                                                            \
+static inline type *name##_at(const struct name *s, size_t i)               \
+{                                                                           \
+    assert(i < s->len);                                                     \
+    return name##_slot_(s, i);                                              \
+}                                                                           \
+                                                                            \
+/* Appends x, returning its address, or NULL if memory runs out. */         \
+static inline type *name##_push(struct name *s, type x)                     \
+{                                                                           \
+    if (s->len == s->chunks << (shift) && !name##_reserve(s, s->len + 1))   \
+        return NULL;                                                        \
+    type *p = name##_slot_(s, s->len++);                                    \
+    *p = x;                                                                 \
+    return p;                                                               \
+}                                                                           \
+                                                                            \
+static inline bool name##_push_n(struct name *s, type const *vals,          \
+                                 size_t n)                                  \
+{                                                                           \
+    if (n > SIZE_MAX - s->len || !name##_reserve(s, s->len + n))            \
+        return false;                                                       \
+    while (n > 0) {                                                         \
+        size_t off = s->len & (((size_t)1 << (shift)) - 1);                 \
+        size_t k = ((size_t)1 << (shift)) - off;                            \
+        if (k > n)                                                          \
+            k = n;                                                          \
+        memcpy(s->dir[s->len >> (shift)] + off, vals, k * sizeof(type));    \
+        s->len += k;                                                        \
+        vals += k;                                                          \
+        n -= k;                                                             \
+    }                                                                       \
+    return true;                                                            \
+}                                                                           \
+                                                                            \
+static inline type name##_pop(struct name *s)                               \
+{                                                                           \
+    assert(s->len);                                                         \
+    return *name##_slot_(s, --s->len);                                      \
+}                                                                           \
+                                                                            \
+/* Number of chunks holding elements. */                                    \
+static inline size_t name##_chunk_count(const struct name *s)               \
+{                                                                           \
+    return (s->len + ((size_t)1 << (shift)) - 1) >> (shift);                \
+}                                                                           \
+                                                                            \
+/* Gets chunk k, setting *len to the number of elements in it. */           \
+static inline type *name##_chunk(const struct name *s, size_t k,            \
+                                 size_t *len)                               \
+{                                                                           \
+    assert(k < name##_chunk_count(s));                                      \
+    size_t first = k << (shift);                                            \
+    *len = s->len - first < ((size_t)1 << (shift)) ? s->len - first         \
+        : (size_t)1 << (shift);                                             \
+    return s->dir[k];                                                       \
+}                                                                           \
+                                                                            \
+/* Empties the array, keeping its chunks. */                                \
+static inline void name##_clear(struct name *s)                             \
+{                                                                           \
+    s->len = 0;                                                             \
+}                                                                           \
+                                                                            \
+static inline void name##_free(struct name *s)                              \
+{                                                                           \
+    for (size_t k = 0; k < s->chunks; ++k)                                  \
+        u_array_release(s->allocator, s->dir[k],                            \
+                        ((size_t)1 << (shift)) * sizeof(type));             \
+    u_array_release(s->allocator, s->dir,                                   \
+                    s->dir_capacity * sizeof(type *));                      \
+    name##_init_allocator(s, s->allocator);                                 \
+}
+
+#endif
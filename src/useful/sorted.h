@@ -0,0 +1,161 @@
+/**
+  @file
+
+  @brief Searching sorted arrays.
+
+  U_SORTED_DEFINE(name, type, less) generates static inline functions that
+  search sorted arrays of type, ordered by less, a function or function-like
+  macro taking two values and returning true if the first comes before the
+  second. u_less() does for numbers. The functions take a pointer and a
+  length, so they work with the vals and len of arrays from U_ARRAY_DEFINE()
+  as well as with plain C arrays.
+
+  - name_sort() sorts an array with qsort().
+  - name_lower_bound() and name_upper_bound() are binary searches whose loop
+    has no unpredictable branches: each step is a conditional move, and both
+    places the next step may look at are prefetched while it is decided.
+  - name_linear_lower_bound() counts the elements less than the key without
+    branching, which compilers turn into SIMD compares. It beats binary
+    search on arrays of a few dozen elements.
+  - name_eytzinger() copies a sorted array into Eytzinger (breadth first)
+    order, where the children of element k are 2k and 2k + 1, and
+    name_eytzinger_search() searches it. The elements compared in the first
+    steps of every search share a few cache lines, and the search prefetches
+    the cache line holding the descendants of the current element a few
+    levels down (four for 4-byte keys), so a search of a large table waits
+    for far fewer cache misses.
+
+  @verbatim
+  U_ARRAY_DEFINE(dbl_array, double)
+  U_SORTED_DEFINE(dbl, double, u_less)
+
+  dbl_sort(a.vals, a.len);
+  size_t lo = dbl_lower_bound(a.vals, a.len, 10.0);
+  size_t hi = dbl_upper_bound(a.vals, a.len, 20.0);
+  // a.vals[lo] to a.vals[hi - 1] are in [10, 20]
+
+  double *e = malloc((a.len + 1) * sizeof(double));
+  size_t *rank = malloc((a.len + 1) * sizeof(size_t));
+  dbl_eytzinger(a.vals, a.len, e, rank);
+  size_t k = dbl_eytzinger_search(e, a.len, 10.0);
+  // k == 0 if every element is less than 10, otherwise e[k] is the first
+  // element not less than 10, and a.vals[rank[k]] is the same element
+  @endverbatim
+*/
+
+#ifndef USEFUL_SORTED_H
+#define USEFUL_SORTED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+/**
+  Orders numbers for U_SORTED_DEFINE().
+  */
+#define u_less(a, b) ((a) < (b))
+
+/**
+  Number of elements of a type that fit in a cache line, at least 1.
+  */
+#define U_SORTED_PER_LINE(type) (sizeof(type) < 64 ? 64 / sizeof(type) : 1)
+
+/**
+  Defines static inline functions to sort and search arrays of type.
+
+  @param name Prefix of the functions
+  @param type Type of the elements
+  @param less Function or macro returning true if its first argument comes
+  before its second
+  */
+#define U_SORTED_DEFINE(name, type, less)                                   \
+static inline int name##_cmp_(const void *a, const void *b)                 \
+{                                                                           \
+    type const *x = a;                                                      \
+    type const *y = b;                                                      \
+    return less(*x, *y) ? -1 : less(*y, *x) ? 1 : 0;                        \
+}                                                                           \
+                                                                            \
+static inline void name##_sort(type *a, size_t n)                           \
+{                                                                           \
+    qsort(a, n, sizeof(type), name##_cmp_);                                 \
+}                                                                           \
+                                                                            \
+/* Index of the first element not less than key, or n. */                   \
+static inline size_t name##_lower_bound(type const *a, size_t n, type key)  \
+{                                                                           \
+    type const *base = a;                                                   \
+    if (n == 0)                                                             \
+        return 0;                                                           \
+    while (n > 1) {                                                         \
+        size_t half = n / 2;                                                \
+        __builtin_prefetch(base + half / 2);                                \
+        __builtin_prefetch(base + half + half / 2);                         \
+        base = less(base[half], key) ? base + half : base;                  \
+        n -= half;                                                          \
+    }                                                                       \
+    return (base - a) + less(*base, key);                                   \
+}                                                                           \
+                                                                            \
+/* Index of the first element greater than key, or n. */                    \
+static inline size_t name##_upper_bound(type const *a, size_t n, type key)  \
+{                                                                           \
+    type const *base = a;                                                   \
+    if (n == 0)                                                             \
+        return 0;                                                           \
+    while (n > 1) {                                                         \
+        size_t half = n / 2;                                                \
+        __builtin_prefetch(base + half / 2);                                \
+        __builtin_prefetch(base + half + half / 2);                         \
+        base = less(key, base[half]) ? base : base + half;                  \
+        n -= half;                                                          \
+    }                                                                       \
+    return (base - a) + !less(key, *base);                                  \
+}                                                                           \
+                                                                            \
+/* Same as name_lower_bound(), by counting. For short arrays. */            \
+static inline size_t name##_linear_lower_bound(type const *a, size_t n,     \
+                                               type key)                    \
+{                                                                           \
+    size_t count = 0;                                                       \
+    for (size_t i = 0; i < n; ++i)                                          \
+        count += less(a[i], key);                                           \
+    return count;                                                           \
+}                                                                           \
+                                                                            \
+static inline size_t name##_eytzinger_fill_(type const *sorted, size_t n,   \
+                                            type *out, size_t *rank,        \
+                                            size_t i, size_t k)             \
+{                                                                           \
+    if (k <= n) {                                                           \
+        i = name##_eytzinger_fill_(sorted, n, out, rank, i, 2 * k);         \
+        out[k] = sorted[i];                                                 \
+        if (rank)                                                           \
+            rank[k] = i;                                                    \
+        i = name##_eytzinger_fill_(sorted, n, out, rank, i + 1, 2 * k + 1); \
+    }                                                                       \
+    return i;                                                               \
+}                                                                           \
+                                                                            \
+/* Copies n sorted elements into out[1] to out[n] in Eytzinger order. If    \
+   rank isn't NULL, rank[k] is set to the index in sorted of out[k]. */     \
+static inline void name##_eytzinger(type const *sorted, size_t n,           \
+                                    type *out, size_t *rank)                \
+{                                                                           \
+    name##_eytzinger_fill_(sorted, n, out, rank, 0, 1);                     \
+}                                                                           \
+                                                                            \
+/* Index in e of the first element not less than key, or 0 if there is      \
+   none. e holds n elements in Eytzinger order, from name_eytzinger(). */   \
+static inline size_t name##_eytzinger_search(type const *e, size_t n,       \
+                                             type key)                      \
+{                                                                           \
+    size_t k = 1;                                                           \
+    while (k <= n) {                                                        \
+        __builtin_prefetch(e + k * U_SORTED_PER_LINE(type));                \
+        k = 2 * k + less(e[k], key);                                        \
+    }                                                                       \
+    return k >> __builtin_ffsll(~(unsigned long long)k);                    \
+}
+
+#endif
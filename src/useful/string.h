@@ -11,7 +11,9 @@
  * This creates a struct u_string and allocates memory for it.  A struct
  * u_string simply consists of a char * called str, and two size_t variables
  * len (the length of str including null terminator) and capacity (how much
- * memory is currently available for str).
+ * memory is currently available for str). It also remembers the allocator
+ * (see allocator.h) that str came from, and is always resized and freed with
+ * that one.
  *
  * All the macros and functions expect null terminated strings.  All the macros
  * and functions that modify or create strings will leave them null terminated.
@@ -19,6 +21,23 @@
  * C string so long as it is kept constant. If you modify it outside of this
  * API, then you're responsible for ensuring len and capacity are set correctly.
  *
+ * To build strings in bulk, use u_string_append(), u_string_append_string(),
+ * u_string_insert() and u_string_replace(), which take lengths, grow the
+ * string at most once and copy with memcpy. Call u_string_reserve() first
+ * when the final length is known, so that nothing is reallocated at all.
+ *
+ * To look at parts of a string without copying them, use struct
+ * u_string_view, a pointer and a length. u_split_init() and u_split_next()
+ * tokenize a string into views of it, allocating nothing:
+ *
+ @verbatim
+ struct u_split it;
+ struct u_string_view tok;
+ u_split_init(&it, line, strlen(line), " \t");
+ while (u_split_next(&it, &tok))
+         printf("%.*s\n", (int)tok.len, tok.str);
+ @endverbatim
+ *
  */
 
 #ifndef USEFUL_STRING_H
@@ -26,6 +45,7 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "array.h"
 
 
@@ -36,8 +56,48 @@ struct u_string {
         size_t len;
         size_t capacity;
         char *str;
+        const struct u_allocator *allocator;    // Of str, or NULL if unset
+};
+
+/**
+ * Refers to len chars of a string owned by someone else. The chars need not
+ * be null terminated, so a view can be part of a longer string.
+ */
+struct u_string_view {
+        const char *str;
+        size_t len;
+};
+
+/**
+ * A set of delimiter chars, one bit per char value, so testing a char is a
+ * shift and a mask instead of a scan of the delimiters.
+ */
+struct u_delims {
+        uint64_t bits[4];
+};
+
+/**
+ * Iterates over the tokens of a string. See u_split_init().
+ */
+struct u_split {
+        const char *pos;
+        const char *end;
+        int single;             // The only delimiter, or -1 if there are more
+        struct u_delims delims;
 };
 
+/**
+ * Checks if c is one of a set of delimiters.
+ *
+ * @param d Set of delimiters, from u_delims_init()
+ * @param c Char to check
+ */
+static inline bool u_delims_has(const struct u_delims *d, char c)
+{
+        unsigned char u = c;
+        return (d->bits[u >> 6] >> (u & 63)) & 1;
+}
+
 /*
  * Holds an array of strings.
  */
@@ -55,6 +115,7 @@ struct u_string_array {
  */
 #define U_STRING(string) \
     struct u_string (string); \
+    (string).allocator = u_allocator_get(); \
     U_ARRAY((string), str); \
     U_ARRAY_PUSH(string, str, '\0')
 
@@ -63,7 +124,7 @@ struct u_string_array {
  *
  * @param string String variable to free.
  */
-#define U_STRING_FREE(string) U_ARRAY_FREE(string, str)
+#define U_STRING_FREE(string) u_free_with((string).allocator, (string).str)
 
 /**
  * Empties a string and null terminates it.
@@ -99,19 +160,46 @@ do { \
  * @param array Variable containing the array of strings that must be freed.
  */
 #define U_STRING_ARRAY_FREE(array) \
-    U_ARRAY_FREE_ELEMS_CUSTOM(array, strings, U_ARRAY_FREE, str)
+do { \
+        for (size_t __i = 0; __i < (array).len; ++__i) \
+                U_STRING_FREE((array).strings[__i]); \
+        U_ARRAY_FREE(array, strings); \
+} while(0)
 
+bool u_string_reserve(struct u_string *dest, size_t n);
+bool u_string_append(struct u_string *dest, const char *src, size_t n);
+bool u_string_append_string(struct u_string *dest, const struct u_string *src);
+bool u_string_insert(struct u_string *dest, size_t index, const char *src,
+                     size_t n);
+bool u_string_replace(struct u_string *dest, size_t index, size_t n,
+                      const char *src, size_t m);
 void u_strcat(struct u_string *dest, const char *src);
 void u_strcpy(struct u_string *dest, const char *src);
 char *u_fgets(struct u_string *dest, FILE * stream);
 int u_sprintf(struct u_string *dest, const char *format, ...);
 int u_sprintf_cat(struct u_string *dest, const char *fmt, ...);
+bool u_string_append_int(struct u_string *dest, long long x);
+bool u_string_append_uint(struct u_string *dest, unsigned long long x);
+bool u_string_append_double(struct u_string *dest, double x, int precision);
 void u_pushchar(struct u_string *dest, char c);
 struct u_string u_substr(const struct u_string *string, size_t index, size_t n);
+struct u_string_view u_string_view_of(const char *s);
+struct u_string_view u_string_view_of_string(const struct u_string *s);
+bool u_string_view_equal(struct u_string_view a, struct u_string_view b);
+void u_delims_init(struct u_delims *d, const char *delims);
+void u_split_init(struct u_split *it, const char *str, size_t len,
+                  const char *delims);
+bool u_split_next(struct u_split *it, struct u_string_view *token);
 struct u_string_array u_string_split(const char *string_to_split,
                                      const char *delims);
 struct u_string u_join(const struct u_string_array *array, const char *delim);
 struct u_string u_join_conv(size_t n, size_t bytes, const void *array,
                             const char *delim, char *(*conv)(const void *), bool free_str);
+struct u_string u_join_write(size_t n, size_t bytes, const void *array,
+                             const char *delim,
+                             size_t (*conv)(char *buf, size_t size,
+                                            const void *elem));
+size_t u_write_int(char *buf, size_t size, const void *elem);
+size_t u_write_double(char *buf, size_t size, const void *elem);
 
 #endif
@@ -0,0 +1,74 @@
+/**
+   @file
+
+   @brief Incremental reading of CSV files that are being appended to.
+
+   Open a file with u_csv_tail_open(). Each call to u_csv_tail_poll() (or
+   u_csv_tail_poll_dataframe()) reads only the bytes appended since the last
+   call, parses the complete rows among them and appends those rows to an
+   existing struct u_csv (or struct u_dataframe). A row that is still being
+   written is kept, along with its quoting state, until the rest of it
+   arrives. u_csv_tail_wait() sleeps until the file changes, using inotify
+   where available.
+
+   @verbatim
+   struct u_csv cs = u_csv_new(false, NULL, 0);
+   struct u_csv_tail tail = u_csv_tail_open("service.log.csv", true, ',', 0);
+   for (;;) {
+           u_csv_tail_poll(&tail, &cs);
+           // ... look at the new rows ...
+           u_csv_tail_wait(&tail, 60000);
+   }
+   @endverbatim
+
+   If the file shrinks, it is assumed to have been truncated and is read
+   again from the start. If another file takes its name, as when a log is
+   rotated, the rest of the old file is read and then the new file from the
+   start.
+*/
+
+#ifndef USEFUL_TAIL_H
+#define USEFUL_TAIL_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "useful/csv.h"
+
+/**
+   Minimum number of bytes read from the file at a time.
+ */
+#ifndef U_TAIL_CHUNK
+#define U_TAIL_CHUNK 65536
+#endif
+
+/**
+   Holds the state of a file being followed.
+ */
+struct u_csv_tail {
+        char *path;
+        int fd;
+        int watch_fd;           // inotify descriptor, or -1
+        int file_wd;            // inotify watch of the file, or -1
+        off_t offset;           // Bytes of the file consumed so far
+        bool header;
+        bool skip_header;       // The header row hasn't been read yet
+        char delim;
+        bool inquote;           // Quoting state at the end of pending
+        size_t scanned;         // Bytes of pending already scanned for rows
+        size_t complete;        // Bytes of pending that form complete rows
+        // Bytes read but not yet parsed
+        size_t len;
+        size_t capacity;
+        char *pending;
+};
+
+struct u_csv_tail u_csv_tail_open(const char *path, bool header, char delim,
+                                  off_t offset);
+size_t u_csv_tail_poll(struct u_csv_tail *tail, struct u_csv *cs);
+size_t u_csv_tail_poll_dataframe(struct u_csv_tail *tail,
+                                 struct u_dataframe *df);
+bool u_csv_tail_wait(struct u_csv_tail *tail, int timeout_ms);
+void u_csv_tail_close(struct u_csv_tail *tail);
+
+#endif
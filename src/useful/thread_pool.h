@@ -0,0 +1,86 @@
+/**
+   @file
+
+   @brief A work-stealing thread pool, task groups and parallel for loops.
+
+   A struct u_thread_pool runs tasks (a function and an argument) on a fixed
+   set of worker threads. Each worker has its own Chase-Lev deque: tasks a
+   worker creates go on its deque, it runs them newest first, and idle
+   workers steal the oldest tasks from other workers' deques. Tasks created
+   by other threads go through a shared lock-free queue (see queue.h). Idle
+   workers sleep on a condition variable, so an idle pool costs nothing.
+
+   Tasks are run in groups. u_task_group_wait() waits for every task run in a
+   group, and the waiting thread runs pool tasks itself meanwhile, so tasks
+   may create groups and wait for them without deadlocking the pool.
+
+   u_parallel_for() splits a range of indices into chunks of at least grain
+   indices and runs them on the pool, splitting in halves so that idle
+   workers steal large chunks.
+
+   Most programs should use the one shared pool returned by
+   u_thread_pool_default(), with a worker per online CPU, rather than
+   creating their own and oversubscribing the cores. Every function that
+   takes a pool uses the default pool if it is passed NULL.
+
+   @verbatim
+   static void scale(size_t begin, size_t end, void *arg)
+   {
+           double *x = arg;
+           for (size_t i = begin; i < end; ++i)
+                   x[i] *= 2;
+   }
+
+   u_parallel_for(NULL, 0, n, 4096, scale, x);
+   @endverbatim
+
+   Workers use the default allocator (see allocator.h).
+*/
+
+#ifndef USEFUL_THREAD_POOL_H
+#define USEFUL_THREAD_POOL_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+   Number of tasks each worker's deque holds. A worker that creates a task
+   when its deque is full runs the task at once.
+ */
+#ifndef U_THREAD_POOL_DEQUE_SIZE
+#define U_THREAD_POOL_DEQUE_SIZE 4096
+#endif
+
+/**
+   Number of tasks the queue for tasks from outside the pool holds.
+ */
+#ifndef U_THREAD_POOL_QUEUE_SIZE
+#define U_THREAD_POOL_QUEUE_SIZE 4096
+#endif
+
+struct u_thread_pool;
+
+/**
+   A set of tasks that can be waited for together.
+ */
+struct u_task_group {
+        struct u_thread_pool *pool;
+        atomic_size_t pending;  // Tasks run in the group but not finished
+};
+
+struct u_thread_pool *u_thread_pool_new(unsigned threads);
+struct u_thread_pool *u_thread_pool_default(void);
+unsigned u_thread_pool_size(const struct u_thread_pool *pool);
+void u_thread_pool_free(struct u_thread_pool *pool);
+
+void u_task_group_init(struct u_task_group *group, struct u_thread_pool *pool);
+void u_task_group_run(struct u_task_group *group, void (*func) (void *arg),
+                      void *arg);
+void u_task_group_wait(struct u_task_group *group);
+
+void u_parallel_for(struct u_thread_pool *pool, size_t begin, size_t end,
+                    size_t grain, void (*body) (size_t begin, size_t end,
+                                                void *arg), void *arg);
+
+#endif
@@ -0,0 +1,53 @@
+/**
+   @file
+
+   @brief Validating, repairing and transcoding UTF-8.
+
+   u_utf8_valid() checks that bytes are well-formed UTF-8: no stray or
+   missing continuation bytes, overlong encodings, surrogates or code points
+   above U+10FFFF. On CPUs with AVX2 (checked at run time) it checks 32
+   bytes at a time without branching, using the lookup-table algorithm of
+   Keiser and Lemire: three table lookups on the high and low nibbles of
+   each byte and the one before it classify every error that a pair of
+   bytes can show, and the few that need more context are found from the
+   two and three bytes before. Blocks of ASCII are skipped after one
+   compare. That is fast enough to run on every block of input as it is
+   read, e.g. on the cells of each row read by u_csv_read_cells() (see
+   u_csv_cells_valid_utf8()).
+
+   u_string_append_utf8() copies bytes into a struct u_string, replacing
+   each ill-formed sequence with U+FFFD, the replacement character, the way
+   the Unicode standard recommends. u_string_append_latin1() and
+   u_string_append_utf16() convert legacy input to UTF-8, copying runs of
+   ASCII a block at a time.
+
+   @verbatim
+   U_STRING(clean);
+   if (!u_utf8_valid(buf, n)) {
+           u_string_append_utf8(&clean, buf, n);
+           // ... use clean.str instead of buf ...
+   }
+   printf("%zu code points\n", u_utf8_count(buf, n));
+   @endverbatim
+*/
+
+#ifndef USEFUL_UTF8_H
+#define USEFUL_UTF8_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "useful/string.h"
+
+bool u_utf8_valid(const char *s, size_t n);
+size_t u_utf8_count(const char *s, size_t n);
+bool u_string_valid_utf8(const struct u_string *s);
+size_t u_string_utf8_len(const struct u_string *s);
+bool u_string_append_utf8(struct u_string *dest, const char *s, size_t n);
+bool u_string_repair_utf8(struct u_string *s);
+bool u_string_append_latin1(struct u_string *dest, const char *s, size_t n);
+bool u_string_append_utf16(struct u_string *dest, const uint16_t *s,
+                           size_t n);
+
+#endif
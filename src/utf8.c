@@ -0,0 +1,498 @@
+/**
+   \file
+
+   \brief Definitions of UTF-8 functions
+
+*/
+#include <errno.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define U_UTF8_SIMD
+#endif
+
+#include "useful/utf8.h"
+
+/**
+   Checks if a byte is a continuation byte, 10xxxxxx.
+ */
+
+static inline bool cont(unsigned char c)
+{
+        return (c & 0xc0) == 0x80;
+}
+
+/**
+   Measures the sequence at the start of s.
+
+   @param s Bytes to look at
+   @param n Number of bytes, at least 1
+   @param bad Set to the length of the maximal subpart of an ill-formed
+   sequence, the bytes to replace with one U+FFFD, if the sequence is
+   ill-formed
+
+   @return Length of the sequence, or 0 if it is ill-formed
+ */
+
+static size_t sequence(const unsigned char *s, size_t n, size_t *bad)
+{
+        unsigned char c = s[0], lo = 0x80, hi = 0xbf;
+        size_t len;
+
+        *bad = 1;
+        if (c < 0x80)
+                return 1;
+        if (c < 0xc2 || c > 0xf4)
+                return 0;
+        len = c < 0xe0 ? 2 : c < 0xf0 ? 3 : 4;
+        if (c == 0xe0)
+                lo = 0xa0;
+        else if (c == 0xed)
+                hi = 0x9f;
+        else if (c == 0xf0)
+                lo = 0x90;
+        else if (c == 0xf4)
+                hi = 0x8f;
+        if (n < 2 || s[1] < lo || s[1] > hi)
+                return 0;
+        for (size_t i = 2; i < len; ++i) {
+                *bad = i;
+                if (i >= n || !cont(s[i]))
+                        return 0;
+        }
+        return len;
+}
+
+/**
+   Validates bytes one sequence at a time, skipping ASCII 8 bytes at a time.
+ */
+
+static bool valid_scalar(const unsigned char *s, size_t n)
+{
+        size_t i = 0, bad;
+
+        while (i < n) {
+                if (i + 8 <= n) {
+                        uint64_t w;
+                        memcpy(&w, s + i, 8);
+                        if (!(w & UINT64_C(0x8080808080808080))) {
+                                i += 8;
+                                continue;
+                        }
+                }
+                size_t len = sequence(s + i, n - i, &bad);
+                if (len == 0)
+                        return false;
+                i += len;
+        }
+        return true;
+}
+
+#ifdef U_UTF8_SIMD
+
+/* Errors that the lookup tables flag, one bit each. Each table gives, for
+   a nibble, the errors that nibble allows; a pair of bytes has an error if
+   the high and low nibbles of the first and the high nibble of the second
+   all allow it. */
+#define TOO_SHORT (1 << 0)      // Lead byte not followed by a continuation
+#define TOO_LONG (1 << 1)       // ASCII followed by a continuation
+#define OVERLONG_3 (1 << 2)
+#define TOO_LARGE (1 << 3)
+#define SURROGATE (1 << 4)
+#define OVERLONG_2 (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4 (1 << 6)
+#define TWO_CONTS (1 << 7)      // Two continuations; fine if a lead is
+                                // two or three bytes back
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#define TABLE(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+/**
+   State carried from one block of 32 bytes to the next.
+ */
+
+struct state {
+        __m256i prev;           // Previous block
+        __m256i incomplete;     // Where it ends in the middle of a sequence
+        __m256i error;          // Non-zero once an error has been seen
+};
+
+/**
+   Checks a block of 32 bytes, given the three bytes before it.
+ */
+
+__attribute__ ((target("avx2")))
+static inline void check_block(struct state *st, __m256i in)
+{
+        if (_mm256_movemask_epi8(in) == 0) {
+                st->error = _mm256_or_si256(st->error, st->incomplete);
+                st->incomplete = _mm256_setzero_si256();
+                st->prev = in;
+                return;
+        }
+
+        const __m256i byte_1_high = TABLE(TOO_LONG, TOO_LONG, TOO_LONG,
+                                          TOO_LONG, TOO_LONG, TOO_LONG,
+                                          TOO_LONG, TOO_LONG, TWO_CONTS,
+                                          TWO_CONTS, TWO_CONTS, TWO_CONTS,
+                                          TOO_SHORT | OVERLONG_2,
+                                          TOO_SHORT,
+                                          TOO_SHORT | OVERLONG_3 |
+                                          SURROGATE,
+                                          TOO_SHORT | TOO_LARGE |
+                                          TOO_LARGE_1000 | OVERLONG_4);
+        const __m256i byte_1_low = TABLE(CARRY | OVERLONG_3 | OVERLONG_2 |
+                                         OVERLONG_4, CARRY | OVERLONG_2,
+                                         CARRY, CARRY, CARRY | TOO_LARGE,
+                                         CARRY | TOO_LARGE | TOO_LARGE_1000,
+                                         CARRY | TOO_LARGE | TOO_LARGE_1000,
+                                         CARRY | TOO_LARGE | TOO_LARGE_1000,
+                                         CARRY | TOO_LARGE | TOO_LARGE_1000,
+                                         CARRY | TOO_LARGE | TOO_LARGE_1000,
+                                         CARRY | TOO_LARGE | TOO_LARGE_1000,
+                                         CARRY | TOO_LARGE | TOO_LARGE_1000,
+                                         CARRY | TOO_LARGE | TOO_LARGE_1000,
+                                         CARRY | TOO_LARGE | TOO_LARGE_1000 |
+                                         SURROGATE,
+                                         CARRY | TOO_LARGE | TOO_LARGE_1000,
+                                         CARRY | TOO_LARGE | TOO_LARGE_1000);
+        const __m256i byte_2_high = TABLE(TOO_SHORT, TOO_SHORT, TOO_SHORT,
+                                          TOO_SHORT, TOO_SHORT, TOO_SHORT,
+                                          TOO_SHORT, TOO_SHORT,
+                                          TOO_LONG | OVERLONG_2 | TWO_CONTS |
+                                          OVERLONG_3 | TOO_LARGE_1000 |
+                                          OVERLONG_4,
+                                          TOO_LONG | OVERLONG_2 | TWO_CONTS |
+                                          OVERLONG_3 | TOO_LARGE,
+                                          TOO_LONG | OVERLONG_2 | TWO_CONTS |
+                                          SURROGATE | TOO_LARGE,
+                                          TOO_LONG | OVERLONG_2 | TWO_CONTS |
+                                          SURROGATE | TOO_LARGE,
+                                          TOO_SHORT, TOO_SHORT, TOO_SHORT,
+                                          TOO_SHORT);
+        const __m256i low = _mm256_set1_epi8(0x0f);
+
+        // The last 16 bytes of prev and the first 16 of in
+        __m256i spliced = _mm256_permute2x128_si256(st->prev, in, 0x21);
+        __m256i prev1 = _mm256_alignr_epi8(in, spliced, 15);
+        __m256i prev2 = _mm256_alignr_epi8(in, spliced, 14);
+        __m256i prev3 = _mm256_alignr_epi8(in, spliced, 13);
+
+        __m256i high1 = _mm256_and_si256(_mm256_srli_epi16(prev1, 4), low);
+        __m256i low1 = _mm256_and_si256(prev1, low);
+        __m256i high2 = _mm256_and_si256(_mm256_srli_epi16(in, 4), low);
+        __m256i sc = _mm256_and_si256(_mm256_shuffle_epi8(byte_1_high, high1),
+                                      _mm256_shuffle_epi8(byte_1_low, low1));
+        sc = _mm256_and_si256(sc, _mm256_shuffle_epi8(byte_2_high, high2));
+
+        // Bytes two after a lead of 3 or 4 bytes, or three after a lead of 4,
+        // must be continuations, so there TWO_CONTS is expected, not an error
+        __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8(0xe0 - 0x80));
+        __m256i fourth = _mm256_subs_epu8(prev3,
+                                          _mm256_set1_epi8(0xf0 - 0x80));
+        __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth),
+                                          _mm256_set1_epi8((char)0x80));
+        st->error = _mm256_or_si256(st->error, _mm256_xor_si256(must23, sc));
+
+        // A lead byte too close to the end to be complete
+        const __m256i max = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+                                             -1, -1, -1, -1, -1, -1, -1, -1,
+                                             -1, -1, -1, -1, -1, -1, -1, -1,
+                                             -1, -1, -1, -1, -1,
+                                             (char)(0xf0 - 1),
+                                             (char)(0xe0 - 1),
+                                             (char)(0xc0 - 1));
+        st->incomplete = _mm256_subs_epu8(in, max);
+        st->prev = in;
+}
+
+__attribute__ ((target("avx2")))
+static bool valid_avx2(const unsigned char *s, size_t n)
+{
+        struct state st = {
+                _mm256_setzero_si256(), _mm256_setzero_si256(),
+                _mm256_setzero_si256()
+        };
+        size_t i = 0;
+
+        for (; i + 32 <= n; i += 32)
+                check_block(&st, _mm256_loadu_si256((const void *)(s + i)));
+        if (i < n) {
+                unsigned char last[32] = { 0 };
+                memcpy(last, s + i, n - i);
+                check_block(&st, _mm256_loadu_si256((const void *)last));
+        }
+        st.error = _mm256_or_si256(st.error, st.incomplete);
+        return _mm256_testz_si256(st.error, st.error);
+}
+
+#endif
+
+/**
+   Checks if bytes are well-formed UTF-8.
+
+   @param s Bytes to check, which needn't be null terminated
+   @param n Number of bytes
+
+   @return true if they are
+ */
+
+bool u_utf8_valid(const char *s, size_t n)
+{
+#ifdef U_UTF8_SIMD
+        if (n >= 32 && __builtin_cpu_supports("avx2"))
+                return valid_avx2((const unsigned char *)s, n);
+#endif
+        return valid_scalar((const unsigned char *)s, n);
+}
+
+/**
+   Counts the code points of well-formed UTF-8, i.e. the bytes that aren't
+   continuation bytes, 16 at a time on x86-64.
+
+   @param s Bytes to count
+   @param n Number of bytes
+
+   @return Number of code points
+ */
+
+size_t u_utf8_count(const char *s, size_t n)
+{
+        size_t count = 0, i = 0;
+
+#ifdef U_UTF8_SIMD
+        const __m128i conts = _mm_set1_epi8((char)0xbf);
+        for (; i + 16 <= n; i += 16) {
+                __m128i x = _mm_loadu_si128((const void *)(s + i));
+                // Continuation bytes are -128 to -65 as signed chars
+                count += __builtin_popcount(_mm_movemask_epi8
+                                            (_mm_cmpgt_epi8(x, conts)));
+        }
+#endif
+        for (; i < n; ++i)
+                count += !cont(s[i]);
+        return count;
+}
+
+/**
+   Checks if a string is well-formed UTF-8.
+
+   @param s String to check
+
+   @return true if it is
+ */
+
+bool u_string_valid_utf8(const struct u_string *s)
+{
+        return u_utf8_valid(s->str, s->len ? s->len - 1 : 0);
+}
+
+/**
+   Counts the code points of a string of well-formed UTF-8.
+
+   @param s String to count
+
+   @return Number of code points, not counting the null terminator
+ */
+
+size_t u_string_utf8_len(const struct u_string *s)
+{
+        return u_utf8_count(s->str, s->len ? s->len - 1 : 0);
+}
+
+/**
+   Makes room to append up to n bytes to a string.
+
+   @return Where to write them, or NULL (with errno set) if memory runs out
+ */
+
+static char *room(struct u_string *dest, size_t n)
+{
+        size_t end = dest->len ? dest->len - 1 : 0;
+        if (n >= SIZE_MAX - end) {
+                errno = ENOMEM;
+                return NULL;
+        }
+        if (!u_string_reserve(dest, end + n + 1))
+                return NULL;
+        return dest->str + end;
+}
+
+/**
+   Null terminates a string whose chars end at p.
+ */
+
+static bool finish(struct u_string *dest, char *p)
+{
+        *p = '\0';
+        dest->len = p - dest->str + 1;
+        return true;
+}
+
+/**
+   Appends bytes to a string, replacing each ill-formed sequence (more
+   exactly, each maximal subpart of one) with U+FFFD.
+
+   @param dest String to append to
+   @param s Bytes to append, which must not be part of dest
+   @param n Number of bytes
+
+   @return true, or false with errno set if memory runs out, leaving dest
+   unchanged
+ */
+
+bool u_string_append_utf8(struct u_string *dest, const char *s, size_t n)
+{
+        if (u_utf8_valid(s, n))
+                return u_string_append(dest, s, n);
+
+        // Each bad byte becomes at most three
+        char *p = n > SIZE_MAX / 3 ? NULL : room(dest, 3 * n);
+        if (p == NULL) {
+                errno = ENOMEM;
+                return false;
+        }
+        const unsigned char *u = (const unsigned char *)s;
+        size_t i = 0, bad;
+        while (i < n) {
+                size_t len = sequence(u + i, n - i, &bad);
+                if (len) {
+                        memcpy(p, s + i, len);
+                        p += len;
+                        i += len;
+                } else {
+                        memcpy(p, "\xef\xbf\xbd", 3);
+                        p += 3;
+                        i += bad;
+                }
+        }
+        return finish(dest, p);
+}
+
+/**
+   Replaces each ill-formed sequence of a string with U+FFFD.
+
+   @param s String to repair
+
+   @return true, or false with errno set if memory runs out, leaving s
+   unchanged
+ */
+
+bool u_string_repair_utf8(struct u_string *s)
+{
+        if (u_string_valid_utf8(s))
+                return true;
+        struct u_string t = { 0, 0, NULL, s->allocator };
+        if (!u_string_append_utf8(&t, s->str, s->len - 1))
+                return false;
+        U_STRING_FREE(*s);
+        *s = t;
+        return true;
+}
+
+/**
+   Converts Latin-1 (ISO 8859-1) to UTF-8 and appends it to a string. Runs of
+   ASCII are copied 16 bytes at a time.
+
+   @param dest String to append to
+   @param s Latin-1 chars to convert, which must not be part of dest
+   @param n Number of chars
+
+   @return true, or false with errno set if memory runs out, leaving dest
+   unchanged
+ */
+
+bool u_string_append_latin1(struct u_string *dest, const char *s, size_t n)
+{
+        char *p = n > SIZE_MAX / 2 ? NULL : room(dest, 2 * n);
+        if (p == NULL) {
+                errno = ENOMEM;
+                return false;
+        }
+        size_t i = 0;
+        while (i < n) {
+#ifdef U_UTF8_SIMD
+                if (i + 16 <= n) {
+                        __m128i x = _mm_loadu_si128((const void *)(s + i));
+                        if (_mm_movemask_epi8(x) == 0) {
+                                _mm_storeu_si128((void *)p, x);
+                                p += 16;
+                                i += 16;
+                                continue;
+                        }
+                }
+#endif
+                unsigned char c = s[i++];
+                if (c < 0x80) {
+                        *p++ = c;
+                } else {
+                        *p++ = 0xc0 | c >> 6;
+                        *p++ = 0x80 | (c & 0x3f);
+                }
+        }
+        return finish(dest, p);
+}
+
+/**
+   Converts UTF-16 to UTF-8 and appends it to a string. Unpaired surrogates
+   become U+FFFD. Runs of ASCII are converted 8 units at a time.
+
+   @param dest String to append to
+   @param s UTF-16 code units, in the byte order of the machine
+   @param n Number of code units
+
+   @return true, or false with errno set if memory runs out, leaving dest
+   unchanged
+ */
+
+bool u_string_append_utf16(struct u_string *dest, const uint16_t *s, size_t n)
+{
+        char *p = n > SIZE_MAX / 3 ? NULL : room(dest, 3 * n);
+        if (p == NULL) {
+                errno = ENOMEM;
+                return false;
+        }
+        size_t i = 0;
+        while (i < n) {
+#ifdef U_UTF8_SIMD
+                if (i + 8 <= n) {
+                        __m128i x = _mm_loadu_si128((const void *)(s + i));
+                        __m128i high = _mm_and_si128(x, _mm_set1_epi16
+                                                     ((short)0xff80));
+                        if (_mm_movemask_epi8(_mm_cmpeq_epi16
+                                              (high, _mm_setzero_si128()))
+                            == 0xffff) {
+                                _mm_storel_epi64((void *)p,
+                                                 _mm_packus_epi16(x, x));
+                                p += 8;
+                                i += 8;
+                                continue;
+                        }
+                }
+#endif
+                uint32_t c = s[i++];
+                if (c >= 0xd800 && c < 0xdc00 && i < n && s[i] >= 0xdc00 &&
+                    s[i] < 0xe000)
+                        c = 0x10000 + ((c - 0xd800) << 10) + (s[i++] - 0xdc00);
+                else if (c >= 0xd800 && c < 0xe000)
+                        c = 0xfffd;
+                if (c < 0x80) {
+                        *p++ = c;
+                } else if (c < 0x800) {
+                        *p++ = 0xc0 | c >> 6;
+                        *p++ = 0x80 | (c & 0x3f);
+                } else if (c < 0x10000) {
+                        *p++ = 0xe0 | c >> 12;
+                        *p++ = 0x80 | ((c >> 6) & 0x3f);
+                        *p++ = 0x80 | (c & 0x3f);
+                } else {
+                        *p++ = 0xf0 | c >> 18;
+                        *p++ = 0x80 | ((c >> 12) & 0x3f);
+                        *p++ = 0x80 | ((c >> 6) & 0x3f);
+                        *p++ = 0x80 | (c & 0x3f);
+                }
+        }
+        return finish(dest, p);
+}
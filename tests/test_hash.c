@@ -0,0 +1,145 @@
+/**
+   @file
+   @brief Randomized check of the hash map against a plain array.
+*/
+
+#include <stdlib.h>
+
+#include "useful/hash.h"
+#include "useful/random.h"
+#include "useful/test.h"
+
+/**
+   Number of distinct keys, few enough that most operations find their key
+   already there.
+ */
+#define KEYS 4096
+
+/**
+   Number of random operations per run.
+ */
+#define OPS 200000
+
+/**
+   Whether test_hash() sends every key to one of a few home slots, which
+   makes probe runs long and has removals shift many entries back.
+ */
+static bool collide;
+
+static uint64_t test_hash(uint64_t x)
+{
+        if (collide)
+                return (x % 7) * UINT64_C(0x9e3779b97f4a7c15);
+        return u_hash_u64(x);
+}
+
+U_HASH_MAP_DEFINE(test_map, uint64_t, uint64_t, test_hash, u_u64_equal)
+
+/**
+   What the map should hold: key k is there if present[k], with value
+   vals[k].
+ */
+
+struct reference {
+        bool present[KEYS];
+        uint64_t vals[KEYS];
+        size_t len;
+};
+
+/**
+   Checks that the map holds exactly the entries of the reference, both by
+   looking every key up and by walking its slots.
+ */
+
+static void check_all(const struct test_map *m, const struct reference *ref,
+                      struct u_test_group *group)
+{
+        size_t seen = 0;
+
+        for (uint64_t k = 0; k < KEYS; ++k)
+                U_TESTEQ(test_map_contains(m, k), ref->present[k], *group);
+        for (size_t i = test_map_next(m, 0); i < m->capacity;
+             i = test_map_next(m, i + 1)) {
+                uint64_t k = m->keys[i];
+                U_TESTLT(k, KEYS, *group);
+                if (k >= KEYS)
+                        continue;
+                U_TESTEQ(ref->present[k], true, *group);
+                U_TESTEQ(m->vals[i], ref->vals[k], *group);
+                ++seen;
+        }
+        U_TESTEQ(seen, ref->len, *group);
+}
+
+/**
+   Runs random puts, get_or_puts, removes and gets on the map and on the
+   reference, checking the result of each and the whole map now and then.
+ */
+
+static void check_random(uint64_t seed, struct u_test_group *group)
+{
+        struct test_map m;
+        struct reference *ref = calloc(1, sizeof(*ref));
+        struct u_rng rng;
+
+        test_map_init(&m);
+        u_rng_seed(&rng, seed);
+        for (size_t op = 0; op < OPS; ++op) {
+                uint64_t k = u_rng_below(&rng, KEYS);
+                uint64_t v = u_rng_next(&rng);
+                uint64_t *p;
+
+                switch (u_rng_below(&rng, 4)) {
+                case 0:
+                        U_TESTEQ(test_map_put(&m, k, v), true, *group);
+                        ref->len += !ref->present[k];
+                        ref->present[k] = true;
+                        ref->vals[k] = v;
+                        break;
+                case 1:
+                        p = test_map_get_or_put(&m, k, v);
+                        U_TESTEQ(p != NULL, true, *group);
+                        if (!ref->present[k]) {
+                                ref->present[k] = true;
+                                ref->vals[k] = v;
+                                ++ref->len;
+                        }
+                        if (p)
+                                U_TESTEQ(*p, ref->vals[k], *group);
+                        break;
+                case 2:
+                        U_TESTEQ(test_map_remove(&m, k), ref->present[k],
+                                 *group);
+                        ref->len -= ref->present[k];
+                        ref->present[k] = false;
+                        break;
+                default:
+                        p = test_map_get(&m, k);
+                        U_TESTEQ(p != NULL, ref->present[k], *group);
+                        if (p && ref->present[k])
+                                U_TESTEQ(*p, ref->vals[k], *group);
+                }
+                U_TESTEQ(m.len, ref->len, *group);
+                if (op % 10000 == 0)
+                        check_all(&m, ref, group);
+        }
+        check_all(&m, ref, group);
+
+        test_map_clear(&m);
+        U_TESTEQ(m.len, 0, *group);
+        U_TESTEQ(test_map_next(&m, 0), m.capacity, *group);
+        test_map_free(&m);
+        free(ref);
+}
+
+int main(void)
+{
+        struct u_test_group group;
+
+        u_test_group_new(&group);
+        check_random(1, &group);
+        collide = true;
+        check_random(2, &group);
+        u_test_group_summary(&group);
+        return group.failures != 0;
+}
@@ -0,0 +1,196 @@
+/**
+   @file
+   @brief Stress tests of the lock-free queues.
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "useful/queue.h"
+#include "useful/test.h"
+
+#define PRODUCERS 4
+#define CONSUMERS 4
+
+/**
+   Number of values each producer pushes.
+ */
+#define PER_PRODUCER 200000
+
+#define TOTAL ((size_t)PRODUCERS * PER_PRODUCER)
+
+/**
+   Small enough that the queue is often full and wraps around many times.
+ */
+#define CAPACITY 64
+
+#define BATCH 8
+
+U_MPMC_DEFINE(mpmc, size_t)
+U_SPSC_DEFINE(spsc, size_t)
+
+/**
+   State shared by the MPMC producers and consumers. Value p * PER_PRODUCER
+   + i is the i-th value pushed by producer p.
+ */
+
+struct mpmc_test {
+        struct mpmc q;
+        atomic_size_t popped;   // Values popped by all consumers
+        atomic_uchar *seen;     // Times each value was popped
+        atomic_uint errors;     // Values popped out of order, or unknown
+};
+
+struct producer {
+        struct mpmc_test *t;
+        size_t first;
+};
+
+static void *produce(void *arg)
+{
+        struct producer *p = arg;
+        size_t i = 0;
+
+        while (i < PER_PRODUCER) {
+                if (i % 3) {
+                        if (mpmc_push(&p->t->q, p->first + i))
+                                ++i;
+                        else
+                                sched_yield();
+                        continue;
+                }
+                size_t vals[BATCH], n = 0;
+                for (; n < BATCH && i + n < PER_PRODUCER; ++n)
+                        vals[n] = p->first + i + n;
+                size_t pushed = mpmc_push_n(&p->t->q, vals, n);
+                if (pushed == 0)
+                        sched_yield();
+                i += pushed;
+        }
+        return NULL;
+}
+
+/**
+   Pops until every value has been popped. A consumer pops positions in
+   increasing order, so it must see each producer's values in the order
+   they were pushed.
+ */
+
+static void *consume(void *arg)
+{
+        struct mpmc_test *t = arg;
+        size_t last[PRODUCERS];
+
+        for (size_t p = 0; p < PRODUCERS; ++p)
+                last[p] = SIZE_MAX;
+        while (atomic_load(&t->popped) < TOTAL) {
+                size_t vals[BATCH];
+                size_t n = mpmc_pop_n(&t->q, vals, 1 + t->popped % BATCH);
+                if (n == 0) {
+                        sched_yield();
+                        continue;
+                }
+                for (size_t i = 0; i < n; ++i) {
+                        size_t p = vals[i] / PER_PRODUCER;
+                        if (vals[i] >= TOTAL || (last[p] != SIZE_MAX &&
+                                                 vals[i] <= last[p])) {
+                                atomic_fetch_add(&t->errors, 1);
+                                continue;
+                        }
+                        last[p] = vals[i];
+                        atomic_fetch_add(&t->seen[vals[i]], 1);
+                }
+                atomic_fetch_add(&t->popped, n);
+        }
+        return NULL;
+}
+
+static void test_mpmc(struct u_test_group *group)
+{
+        struct mpmc_test t;
+        struct producer producers[PRODUCERS];
+        pthread_t threads[PRODUCERS + CONSUMERS];
+        size_t once = 0;
+        size_t v;
+
+        U_TESTEQ(mpmc_init(&t.q, CAPACITY), true, *group);
+        atomic_init(&t.popped, 0);
+        atomic_init(&t.errors, 0);
+        t.seen = calloc(TOTAL, sizeof(*t.seen));
+
+        for (size_t i = 0; i < CONSUMERS; ++i)
+                pthread_create(&threads[PRODUCERS + i], NULL, consume, &t);
+        for (size_t i = 0; i < PRODUCERS; ++i) {
+                producers[i].t = &t;
+                producers[i].first = i * PER_PRODUCER;
+                pthread_create(&threads[i], NULL, produce, &producers[i]);
+        }
+        for (size_t i = 0; i < PRODUCERS + CONSUMERS; ++i)
+                pthread_join(threads[i], NULL);
+
+        for (size_t i = 0; i < TOTAL; ++i)
+                once += t.seen[i] == 1;
+        U_TESTEQ(atomic_load(&t.errors), 0, *group);
+        U_TESTEQ(atomic_load(&t.popped), TOTAL, *group);
+        U_TESTEQ(once, TOTAL, *group);
+        U_TESTEQ(mpmc_pop(&t.q, &v), false, *group);
+
+        free(t.seen);
+        mpmc_free(&t.q);
+}
+
+static void *spsc_produce(void *arg)
+{
+        struct spsc *q = arg;
+
+        for (size_t i = 0; i < TOTAL;) {
+                size_t vals[BATCH], n = 0;
+                for (; n < BATCH && i + n < TOTAL; ++n)
+                        vals[n] = i + n;
+                size_t pushed = spsc_push_n(q, vals, i % 2 ? 1 : n);
+                if (pushed == 0)
+                        sched_yield();
+                i += pushed;
+        }
+        return NULL;
+}
+
+/**
+   Pushes values on one thread and checks that the other pops them all, in
+   order.
+ */
+
+static void test_spsc(struct u_test_group *group)
+{
+        struct spsc q;
+        pthread_t producer;
+        size_t next = 0, wrong = 0;
+
+        U_TESTEQ(spsc_init(&q, CAPACITY), true, *group);
+        pthread_create(&producer, NULL, spsc_produce, &q);
+        while (next < TOTAL) {
+                size_t vals[BATCH];
+                size_t n = spsc_pop_n(&q, vals, 1 + next % BATCH);
+                if (n == 0)
+                        sched_yield();
+                for (size_t i = 0; i < n; ++i)
+                        wrong += vals[i] != next++;
+        }
+        pthread_join(producer, NULL);
+        U_TESTEQ(wrong, 0, *group);
+        U_TESTEQ(spsc_len(&q), 0, *group);
+        spsc_free(&q);
+}
+
+int main(void)
+{
+        struct u_test_group group;
+
+        u_test_group_new(&group);
+        test_mpmc(&group);
+        test_spsc(&group);
+        u_test_group_summary(&group);
+        return group.failures != 0;
+}
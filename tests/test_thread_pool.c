@@ -0,0 +1,180 @@
+/**
+   @file
+   @brief Stress tests of the thread pool.
+*/
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "useful/test.h"
+#include "useful/thread_pool.h"
+
+/**
+   More than U_THREAD_POOL_DEQUE_SIZE and U_THREAD_POOL_QUEUE_SIZE, so that
+   deques and the queue for tasks from outside fill up.
+ */
+#define TASKS 20000
+
+/**
+   Tasks run by a tree of depth DEPTH where every task runs FANOUT more.
+ */
+#define DEPTH 5
+#define FANOUT 6
+
+#define SUBMITTERS 4
+
+static atomic_size_t count;
+
+static void inc(void *arg)
+{
+        (void)arg;
+        atomic_fetch_add(&count, 1);
+}
+
+struct node {
+        struct u_thread_pool *pool;
+        unsigned depth;
+};
+
+/**
+   Counts itself and runs FANOUT children in a group of its own, waiting for
+   them from inside the pool.
+ */
+
+static void tree(void *arg)
+{
+        struct node *n = arg;
+        struct node children[FANOUT];
+        struct u_task_group group;
+
+        atomic_fetch_add(&count, 1);
+        if (n->depth == 0)
+                return;
+        u_task_group_init(&group, n->pool);
+        for (size_t i = 0; i < FANOUT; ++i) {
+                children[i].pool = n->pool;
+                children[i].depth = n->depth - 1;
+                u_task_group_run(&group, tree, &children[i]);
+        }
+        u_task_group_wait(&group);
+}
+
+static size_t tree_size(unsigned depth)
+{
+        return depth ? 1 + FANOUT * tree_size(depth - 1) : 1;
+}
+
+/**
+   Runs TASKS tasks from inside a single task, more than its deque holds.
+ */
+
+static void flood(void *arg)
+{
+        struct u_task_group group;
+
+        u_task_group_init(&group, arg);
+        for (size_t i = 0; i < TASKS; ++i)
+                u_task_group_run(&group, inc, NULL);
+        u_task_group_wait(&group);
+}
+
+/**
+   Runs TASKS tasks from a thread outside the pool, in a group of its own.
+ */
+
+static void *submit(void *arg)
+{
+        struct u_task_group group;
+
+        u_task_group_init(&group, arg);
+        for (size_t i = 0; i < TASKS; ++i)
+                u_task_group_run(&group, inc, NULL);
+        u_task_group_wait(&group);
+        return NULL;
+}
+
+/**
+   Counts how often u_parallel_for() passes each index to visit().
+ */
+
+static void visit(size_t begin, size_t end, void *arg)
+{
+        atomic_uchar *visits = arg;
+
+        for (size_t i = begin; i < end; ++i)
+                atomic_fetch_add(&visits[i], 1);
+}
+
+static void test_parallel_for(struct u_thread_pool *pool,
+                              struct u_test_group *group)
+{
+        static const size_t grains[] = { 0, 1, 7, 1000, 200000 };
+        const size_t begin = 13, end = 100003;
+        atomic_uchar *visits = calloc(end, sizeof(*visits));
+
+        for (size_t g = 0; g < sizeof(grains) / sizeof(*grains); ++g) {
+                size_t wrong = 0;
+                for (size_t i = 0; i < end; ++i)
+                        atomic_init(&visits[i], 0);
+                u_parallel_for(pool, begin, end, grains[g], visit, visits);
+                for (size_t i = 0; i < end; ++i)
+                        wrong += visits[i] != (i >= begin);
+                U_TESTEQ(wrong, 0, *group);
+        }
+        u_parallel_for(pool, end, end, 1, visit, visits);
+        free(visits);
+}
+
+static void test_pool(struct u_thread_pool *pool, struct u_test_group *group)
+{
+        struct u_task_group tasks;
+        struct node root = { pool, DEPTH };
+        pthread_t submitters[SUBMITTERS];
+
+        atomic_store(&count, 0);
+        u_task_group_init(&tasks, pool);
+        for (size_t i = 0; i < TASKS; ++i)
+                u_task_group_run(&tasks, inc, NULL);
+        u_task_group_wait(&tasks);
+        U_TESTEQ(atomic_load(&count), TASKS, *group);
+
+        atomic_store(&count, 0);
+        tree(&root);
+        U_TESTEQ(atomic_load(&count), tree_size(DEPTH), *group);
+
+        atomic_store(&count, 0);
+        u_task_group_init(&tasks, pool);
+        u_task_group_run(&tasks, flood, pool);
+        u_task_group_wait(&tasks);
+        U_TESTEQ(atomic_load(&count), TASKS, *group);
+
+        atomic_store(&count, 0);
+        for (size_t i = 0; i < SUBMITTERS; ++i)
+                pthread_create(&submitters[i], NULL, submit, pool);
+        for (size_t i = 0; i < SUBMITTERS; ++i)
+                pthread_join(submitters[i], NULL);
+        U_TESTEQ(atomic_load(&count), SUBMITTERS * TASKS, *group);
+
+        test_parallel_for(pool, group);
+}
+
+int main(void)
+{
+        static const unsigned sizes[] = { 1, 2, 3, 8 };
+        struct u_test_group group;
+
+        u_test_group_new(&group);
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); ++i) {
+                struct u_thread_pool *pool = u_thread_pool_new(sizes[i]);
+                U_TESTEQ(pool != NULL, true, group);
+                if (pool == NULL)
+                        continue;
+                U_TESTEQ(u_thread_pool_size(pool), sizes[i], group);
+                test_pool(pool, &group);
+                u_thread_pool_free(pool);
+        }
+        test_pool(NULL, &group);
+        u_test_group_summary(&group);
+        return group.failures != 0;
+}